@@ -1,17 +1,19 @@
 // audio_video_chat_gui.c
 // Bidirectional **audio + webcam video** chat with GTK GUI
 // ---------------------------------------------------------
-// Build (needs GTK3, pthread, OpenCV, SoX, FFmpeg libjpeg):
-//   g++ -std=c++17 audio_video_chat_gui.c -o av_chat_gui \
-//      $(pkg-config --cflags --libs gtk+-3.0 opencv4) -lpthread
-//   # SoX は rec/play 用、OpenCV はカメラ＆JPEG圧縮用
+// Build (needs GTK3, pthread, OpenCV, ALSA, SoX, FFmpeg libjpeg):
+//   g++ -std=c++17 MultiMediaPhone.cpp capture.cpp yuv_convert.cpp frame_pool.c video_view.cpp encoder_session.cpp rate_adapter.cpp framed_writer.c rtp_h264.cpp rtp_fec.cpp rtp_history.cpp udp_batch.cpp congestion_control.cpp pacer.cpp av_mux.cpp audio_engine.cpp -o av_chat_gui \
+//      $(pkg-config --cflags --libs gtk+-3.0 opencv4 libavcodec libswscale libavutil alsa) -lpthread
+//   # 通話の音声は ALSA（audio_engine）、SoX は呼び出し音・ボタン音用、OpenCV はカメラ＆JPEG圧縮用
 // 2025‑06‑19  (minimal demo)
 
 // ─── system / POSIX ──────────────────────────────────────
 #include <gtk/gtk.h>
 #include <pthread.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -19,6 +21,9 @@
 #include <thread>
 #include <chrono>
 #include <atomic>
+#include <algorithm>
+#include <random>
+#include <vector>
 
 
 // ─── FFmpeg (C ライブラリ) ───────────────────────────────
@@ -31,42 +36,31 @@ extern "C" {
 
 // ─── C++ ライブラリ (OpenCV など) ────────────────────────
 #include <opencv2/opencv.hpp> 
+#include "capture.h"
+#include "yuv_convert.h"
+#include "frame_pool.h"
+#include "video_view.h"
+#include "encoder_session.h"
+#include "rate_adapter.h"
+#include "framed_writer.h"
+#include "rtp_h264.h"
+#include "rtp_fec.h"
+#include "rtp_history.h"
+#include "udp_batch.h"
+#include "congestion_control.h"
+#include "pacer.h"
+#include "av_mux.h"
+#include "audio_engine.h"
 
-AVCodecContext *enc_ctx = nullptr;
-SwsContext     *sws_ctx = nullptr;
 static SwsContext     *dec_sws  = nullptr;
 static AVCodecContext *dec_ctx  = nullptr;
 
-bool init_encoder(int w, int h, int fps)
-{
-    const AVCodec *codec = avcodec_find_encoder_by_name("libx264");
-    if (!codec) { fprintf(stderr, "libx264 not found\n"); return false; }
-
-    enc_ctx = avcodec_alloc_context3(codec);
-    enc_ctx->width     = w;
-    enc_ctx->height    = h;
-    enc_ctx->pix_fmt   = AV_PIX_FMT_YUV420P;
-    enc_ctx->time_base = {1, fps};
-    enc_ctx->framerate = {fps, 1};
-    enc_ctx->bit_rate  = 800'000;               // 例: 800 kbps
-    // 低遅延用オプション
-    av_opt_set(enc_ctx->priv_data, "preset", "ultrafast", 0);
-    av_opt_set(enc_ctx->priv_data, "tune",   "zerolatency", 0);  /* :contentReference[oaicite:0]{index=0} */
-
-    if (avcodec_open2(enc_ctx, codec, nullptr) < 0) return false;
-
-    // BGR(OpenCV) → YUV420P 変換器
-    sws_ctx = sws_getContext(w, h, AV_PIX_FMT_BGR24,
-                             w, h, AV_PIX_FMT_YUV420P,
-                             SWS_FAST_BILINEAR, nullptr,nullptr,nullptr);
-    return sws_ctx;
-}
-
 
 /*──────────────────────
   CONFIGURATION
   audio : TCP <port>
-  video : TCP <port>+1 (JPEG圧縮フレーム)
+  video : TCP <port>+1 (H.264, 長さ付き) または RTP/UDP <port>+1 (VIDEO_TRANSPORT)
+          VIDEO_TRANSPORT_MUX なら音声も映像も TCP <port> の 1 本に多重化する
 ──────────────────────*/
 
 static void run_server(const char *port);
@@ -77,7 +71,7 @@ typedef struct {
     GtkWidget *entry_port;
     GtkWidget *radio_server;
     GtkWidget *label_status;
-    GtkWidget *image_peer;
+    GtkWidget *video_view;  // 相手映像 + 自分の映像 (GtkDrawingArea)
     GtkWidget *main_window; // メインウィンドウを追加
     pthread_t  worker;
     gboolean   running;
@@ -86,7 +80,8 @@ static App app = {0};
 
 static int srv_sock_audio=-1, cli_sock_audio=-1;
 static int srv_sock_video=-1, cli_sock_video=-1;
-static FILE *rec_stream=NULL;
+static int cli_sock_mux=-1, cli_sock_feedback=-1;   // 多重化: 本物の TCP と、フィードバックのチャネル
+static AudioEngine *audio=nullptr;   // 通話の間だけ開く
 
 /*──────────────────────
   GTK helper
@@ -97,153 +92,647 @@ static void set_status(const char*s){g_idle_add(status_cb,g_strdup(s));}
 /*──────────────────────
   VIDEO helpers
 ──────────────────────*/
-static void *send_video(void *) {
-    const int W = 640, H = 360, FPS = 30; // 解像度とFPSを設定
-    cv::VideoCapture cap(0);
-    if (!cap.isOpened() || !init_encoder(W, H, FPS)) return nullptr;
-
-    cap.set(cv::CAP_PROP_FRAME_WIDTH, W);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, H);
+#define SELF_VIEW_W 160   // 自分の映像（右下の小窓）
+#define SELF_VIEW_H 90
+#define VIDEO_INTRA_REFRESH 1   // 1: 周期 IDR の代わりに intra-refresh（2 秒で 1 周）
+#define VIDEO_ZC_MIN        (32 * 1024)   // これ以上のキーフレームは MSG_ZEROCOPY で送る
+
+/* 映像の運び方（両端で揃えること）。RTP なら 1 つの欠落が後ろのフレームを止めない */
+#define VIDEO_TRANSPORT_TCP 0
+#define VIDEO_TRANSPORT_RTP 1
+#define VIDEO_TRANSPORT_MUX 2     // 音声と同じ TCP に多重化。映像はチャンクに切られ、音声が先に出る
+#define VIDEO_TRANSPORT     VIDEO_TRANSPORT_TCP
+#define AV_MUX_CHUNK        1024  // 多重化で音声が待たされる最大量（映像の 1 チャンク）
+#define VIDEO_RTP_JITTER_MS 50    // 並べ替えを待つ時間。過ぎたら欠落として先へ進む
+#define VIDEO_RTP_MAX_PKTS  512   // 1 アクセスユニットのパケット数の上限（600KB 分）
+#define VIDEO_RTP_IDLE_MS   500   // これだけ何も届かなければ PLI を送り直す（最初の PLI が相手への挨拶）
+#define VIDEO_UDP_BATCH     32    // 1 回の sendmmsg / recvmmsg で扱うメッセージ数（1 = まとめない）
+#define VIDEO_UDP_GSO       1     // 同じ大きさの FU-A 断片は UDP_SEGMENT で 1 つの塊として渡す
+#define VIDEO_UDP_GRO       1
+#define VIDEO_FEC           FEC_XOR   // FEC_NONE / FEC_XOR / FEC_RS（受信側はどれでも直せる）
+#define VIDEO_FEC_MIN_RATIO 0.05      // 冗長パケットの割合。相手が報告する損失率に合わせて上げる
+#define VIDEO_FEC_MAX_RATIO 0.5
+#define VIDEO_FEC_MAX_GROUP 24        // FEC_RS の 1 グループのパケット数
+// グループはフレームをまたいで埋めるが、受信側が穴を諦めるより前に冗長を出す。
+// 送るパケットがこの間に 1 / 割合 個に満たない（低いビットレート）ときは、その分だけ割合が上がる
+#define VIDEO_FEC_MAX_DELAY_MS VIDEO_RTP_JITTER_MS
+#define VIDEO_RTCP_RR_MS    1000      // 損失率 (RTCP RR) を報告する間隔
+#define VIDEO_NACK          1         // 欠けたパケットを RTCP NACK で頼み、送信側は履歴から送り直す
+#define VIDEO_NACK_HISTORY  1024      // 送信側が残しておくパケット数（2 の累乗）
+#define VIDEO_NACK_RETRY_MS 20        // 同じ番号を頼み直す間隔
+#define VIDEO_NACK_TRIES    3
+#define VIDEO_NACK_MAX      64        // 1 回の NACK で頼む / 送り直す数
+#define VIDEO_CC            1         // 到着時刻のフィードバックから帯域を推定してエンコーダの目標にする
+#define VIDEO_CC_MIN_BPS    150'000   // FEC を含めた映像全体
+#define VIDEO_CC_MAX_BPS    2'500'000
+#define VIDEO_CC_FEEDBACK_MS 50       // 受信側が到着時刻を返す間隔
+#define VIDEO_PACER         1         // 1 フレームをまとめて出さず、目標ビットレートの数倍の速さにならして送る
+#define VIDEO_PACER_MULTIPLIER   2.5
+#define VIDEO_PACER_BURST_MS     5    // 続けて出してよい量
+#define VIDEO_PACER_MAX_QUEUE_MS 500  // 溜まった分はこの時間で出し切れる速さまで上げる
+#define VIDEO_PACER_QUEUE        1024 // 送り直し / 映像それぞれのパケット数
+/* 音声はプロセス内で録音・再生する。AUDIO_BACKEND_PULSE は -DAUDIO_WITH_PULSE -lpulse-simple でビルドしたとき */
+#define AUDIO_IO_BACKEND    AUDIO_BACKEND_ALSA
+#define AUDIO_DEVICE        "default"
+#define AUDIO_RATE          44100     // 16 ビット、モノラル（両端で揃えること）
+#define AUDIO_PKT_MS        10        // 1 回に送る長さ
+#define AUDIO_PERIOD_MS     5         // デバイスと読み書きする単位
+#define AUDIO_PERIODS       3         // デバイスのバッファ = period × これ
+#define AUDIO_FIFO_MS       40        // 入出力スレッドとの間に溜める上限
+#define AUDIO_IO_PRIO       20        // 入出力スレッドの SCHED_FIFO 優先度
+static const bool video_rtp = VIDEO_TRANSPORT == VIDEO_TRANSPORT_RTP;
+static const bool av_mux    = VIDEO_TRANSPORT == VIDEO_TRANSPORT_MUX;
+// 送ったパケットの履歴。send_video が残し、NACK を受けた receive_video が送り直す
+static RtpHistory video_history(video_rtp && VIDEO_NACK ? VIDEO_NACK_HISTORY : 1);
+static std::atomic<uint32_t> video_peer_ssrc{0};
+static std::atomic<uint32_t> video_own_ssrc{0};    // 受信スレッドが送る NACK の送り主
+static std::atomic<int>      video_peer_loss{0};   // 相手が RR で報告した FEC 前の損失率 (1/256)
+// 帯域推定。send_video が送った時刻を、receive_video が相手のフィードバックを渡す
+static CongestionController video_cc;
+// 送信ペーサ。send_video と再送が積み、pace_video が時間をならして送る。音声は送った分を知らせる
+static Pacer video_pacer([] {
+    PacerConfig c;
+    c.multiplier    = VIDEO_PACER_MULTIPLIER;
+    c.burst_ms      = VIDEO_PACER_BURST_MS;
+    c.max_queue_ms  = VIDEO_PACER_MAX_QUEUE_MS;
+    c.queue_packets = video_rtp && VIDEO_PACER ? VIDEO_PACER_QUEUE : 1;
+    return c;
+}());
+
+/* 映像ソケットは双方向。長さ欄の最上位ビットが立っていれば本体のない制御メッセージ */
+#define VIDEO_CTRL_FLAG 0x80000000u
+#define VIDEO_CTRL_IDR  (VIDEO_CTRL_FLAG | 1)   // デコードに失敗したのでキーフレームがほしい
+
+// 映像ソケットに書くのは send_video だけにして、受信側からはフラグで頼む
+static std::atomic<bool> idr_to_request{false};   // 自分のデコーダが壊れた → 相手へ頼む
+static std::atomic<bool> idr_requested{false};    // 相手から頼まれた → 自分のエンコーダへ
+// RTP: 受信側が作った RR の報告ブロック（fraction lost | 累積損失, 最大番号）を send_video が送る
+static std::atomic<bool>     rr_to_send{false};
+static std::atomic<uint64_t> rr_block{0};
+
+static gboolean release_display_pool(gpointer data);
+
+static int64_t video_now_ms()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
 
-    AVFrame *frame = av_frame_alloc();
-    frame->format = enc_ctx->pix_fmt;
-    frame->width = enc_ctx->width;
-    frame->height = enc_ctx->height;
-    av_frame_get_buffer(frame, 32);
+static int64_t video_now_us()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
 
-    AVPacket *pkt = av_packet_alloc();
-    int64_t pts = 0;
+static void *send_video(void *) {
+    EncoderConfig cfg;   // 640x360, 30fps, 800 kbps（通話中に変更できる）
+    cfg.intra_refresh = VIDEO_INTRA_REFRESH;
+    if (cfg.intra_refresh) cfg.keyint = 2 * cfg.fps;
+    // NV12 なら mmap バッファをそのまま x264 へ、YUYV なら 1 回の詰め替えだけ
+    static const CapturePixFmt prefer[] = {CAP_FMT_NV12, CAP_FMT_YUYV};
+    CaptureSource *cap = capture_open(0, cfg.width, cfg.height, cfg.fps, prefer, 2);
+    if (!cap) return nullptr;
+    EncoderSession enc;
+    if (!enc.open(cfg, cap->width(), cap->height(), cap->format())) {
+        delete cap;
+        return nullptr;
+    }
 
-    cv::Mat bgr;
-    auto period = std::chrono::milliseconds(1000 / FPS); // FPS制限
+    // 自分の映像: カメラ形式から小さな BGRx へ直接縮小する
+    FramePool  *self_pool = frame_pool_create(SELF_VIEW_W, SELF_VIEW_H, 4, 3);
+    SwsContext *self_sws  = sws_getContext(cap->width(), cap->height(), capture_av_fmt(cap->format()),
+                                           SELF_VIEW_W, SELF_VIEW_H, AV_PIX_FMT_BGRA,
+                                           SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+
+    // 送信待ちが溜まったらビットレート → 解像度の順に下げ、それでも遅れるフレームは捨てる
+    // （RTP で帯域推定するときは推定値が上限を決めるので、こちらは推定の上限まで許す）
+    RateAdapterConfig rcfg;
+    rcfg.max_bitrate = video_rtp && VIDEO_CC ? VIDEO_CC_MAX_BPS : cfg.bitrate;
+    RateAdapter rate(rcfg);
+    SocketBacklog backlog;
+
+    // フレームの最後のセグメントを Nagle で ACK 待ちにしない
+    int one = 1;
+    setsockopt(cli_sock_video, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // 制御メッセージと 1 フレームを 1 回の sendmsg で送る
+    FramedWriter *out = framed_writer_create(cli_sock_video, FW_LEN_BE32, VIDEO_ZC_MIN);
+    // RTP: 1 アクセスユニットを MTU 以下のパケットに分ける
+    RtpPacketizer rtp(std::random_device{}());
+    video_own_ssrc = rtp.ssrc();
+    std::vector<RtpPacket>   rtp_pkts(video_rtp ? VIDEO_RTP_MAX_PKTS : 0);
+    UdpBatchSender udp_tx(cli_sock_video, VIDEO_UDP_BATCH, VIDEO_UDP_GSO);
+    // 欠けたパケットは再送を待たずに受信側で作り直させる（冗長はグループを閉じたフレームの直後に同じまとめ送りで）
+    FecConfig fcfg;
+    fcfg.scheme    = VIDEO_FEC;
+    fcfg.min_ratio = VIDEO_FEC_MIN_RATIO;
+    fcfg.max_ratio = VIDEO_FEC_MAX_RATIO;
+    fcfg.max_group = VIDEO_FEC_MAX_GROUP;
+    fcfg.max_delay_ms = VIDEO_FEC_MAX_DELAY_MS;
+    FecEncoder fec(fcfg);
+    std::vector<FecPacket>   fec_pkts(video_rtp ? VIDEO_RTP_MAX_PKTS / 2 : 0);
+    std::vector<UdpDatagram> rtp_dgs(rtp_pkts.size() + fec_pkts.size());
+    video_history.clear();
+    CcConfig ccfg;
+    ccfg.start_bitrate = cfg.bitrate;
+    ccfg.min_bitrate   = VIDEO_CC_MIN_BPS;
+    ccfg.max_bitrate   = VIDEO_CC_MAX_BPS;
+    video_cc.reset(ccfg);
+    video_pacer.reset(cfg.bitrate);
+
+    CaptureFrame cf;
+    cf.index = -1;
     while (cli_sock_video >= 0) {
         auto t0 = std::chrono::steady_clock::now();
-        cap >> bgr;
-        if (bgr.empty()) break;
-
-        // BGRからRGBに変換
-        cv::cvtColor(bgr, bgr, cv::COLOR_BGR2RGB);
-
-        // BGR → YUV420P
-        const uint8_t *bgr_data[1] = {bgr.data};
-        int bgr_stride[1] = {static_cast<int>(bgr.step)};
-        sws_scale(sws_ctx, bgr_data, bgr_stride, 0, H,
-                  frame->data, frame->linesize);
-
-        frame->pts = pts++; // 1フレーム進める
-
-        // エンコード
-        avcodec_send_frame(enc_ctx, frame);
-        while (avcodec_receive_packet(enc_ctx, pkt) == 0) {
-            uint32_t n = htonl(pkt->size);
-            if (send(cli_sock_video, &n, 4, 0) <= 0) goto finish;
-            if (send(cli_sock_video, pkt->data, pkt->size, 0) <= 0) goto finish;
-            av_packet_unref(pkt);
+        if (!cap->grab(cf)) break;
+
+        if (ImageFrame *sv = self_pool && self_sws ? frame_pool_acquire(self_pool) : nullptr) {
+            const uint8_t *src_data[4];
+            int src_stride[4];
+            capture_planes(cf, src_data, src_stride);
+            uint8_t *dst_data[4] = {sv->data, nullptr, nullptr, nullptr};
+            int dst_stride[4]    = {sv->stride, 0, 0, 0};
+            sws_scale(self_sws, src_data, src_stride, 0, cf.height, dst_data, dst_stride);
+            video_view_publish_self(app.video_view, sv);
+        }
+
+        // 受信側とのやりとり: 頼まれた IDR を次のフレームで出す / こちらの要求を送る
+        if (idr_requested.exchange(false)) enc.request_keyframe();
+        if (idr_to_request.exchange(false)) {
+            if (video_rtp) {
+                uint8_t pli[12];
+                send(cli_sock_video, pli, rtcp_write_pli(pli, rtp.ssrc(), video_peer_ssrc), 0);
+            } else if (av_mux) {
+                // フィードバックのチャネルは相手の映像の待ちを追い越す
+                uint32_t w = htonl(VIDEO_CTRL_IDR);
+                send(cli_sock_feedback, &w, 4, MSG_NOSIGNAL);
+            } else {
+                framed_writer_add_word(out, VIDEO_CTRL_IDR);
+            }
+        }
+        if (av_mux) {
+            // 相手の受信側からの要求（4 バイトずつしか書かれないので、ずれずに読める）
+            uint32_t w;
+            while (recv(cli_sock_feedback, &w, 4, MSG_DONTWAIT) == 4)
+                if (ntohl(w) == VIDEO_CTRL_IDR) {
+                    fprintf(stderr, "video: peer requested a keyframe\n");
+                    idr_requested = true;
+                }
+        }
+
+        if (rr_to_send.exchange(false)) {
+            uint64_t b = rr_block;
+            int32_t  cum = (int32_t)((uint32_t)(b >> 32) << 8) >> 8;   // 24 ビットの符号を戻す
+            uint8_t  rr[32];
+            send(cli_sock_video, rr, rtcp_write_rr(rr, rtp.ssrc(), video_peer_ssrc, b >> 56, cum, (uint32_t)b), 0);
+        }
+        if (video_rtp) fec.set_loss(video_peer_loss / 256.0);
+
+        socket_backlog(cli_sock_video, &backlog);
+        if (video_rtp && VIDEO_PACER) {
+            // 送信待ちの大半はペーサの中。出ていく速さもペーサが決めている
+            backlog.unsent      += video_pacer.queued_bytes();
+            backlog.delivery_bps = video_pacer.pacing_bps();
+        }
+        RateDecision rd = rate.update(backlog, 0);
+        if (rd.changed) {
+            int w, h;
+            RateAdapter::scaled_size(rd.level, cfg.width, cfg.height, &w, &h);
+            enc.set_bitrate(rd.bitrate);
+            enc.set_resolution(w, h);
+        }
+        if (video_rtp && VIDEO_CC) {
+            // 推定は FEC を含めた全体の速さ。実際に付いている冗長の分を除いた残りをエンコーダへ（5 % 以上動いたら）。
+            // 送信待ちで RateAdapter が下げていればそちらに従う
+            video_cc.set_rtt(video_history.rtt_ms());
+            int64_t media_bps = std::min((int64_t)(video_cc.target_bitrate() / (1 + fec.overhead())), rate.bitrate());
+            int64_t cur_bps   = enc.config().bitrate;
+            if (rd.changed || llabs(media_bps - cur_bps) * 20 > cur_bps) enc.set_bitrate(media_bps);
+        }
+        if (video_rtp && VIDEO_PACER)
+            video_pacer.set_target(VIDEO_CC ? video_cc.target_bitrate()
+                                            : (int64_t)(enc.config().bitrate * (1 + fec.overhead())));
+        if (rd.skip) {
+            cap->release(cf);
+            if (framed_writer_flush(out) < 0) break;   // 積んだ制御メッセージは捨てない
+            std::this_thread::sleep_until(t0 + std::chrono::milliseconds(1000 / enc.config().fps));
+            continue;
+        }
+
+        // 変換してエンコード（カメラ直結のときは送り終わるまで cf を返さない）
+        if (!enc.submit(cf)) break;
+        if (!enc.native()) cap->release(cf);
+        while (AVPacket *pkt = enc.receive()) {
+            if (video_rtp) {
+                // pts はミリ秒 → 90 kHz。届かなかったパケットは受信側が PLI で知らせてくる
+                int n = rtp.packetize(pkt->data, pkt->size, (uint32_t)(pkt->pts * (RTP_CLOCK_RATE / 1000)),
+                                      rtp_pkts.data(), VIDEO_RTP_MAX_PKTS);
+                int m = n > 0 ? fec.protect(rtp_pkts.data(), n, fec_pkts.data(), (int)fec_pkts.size()) : 0;
+                int64_t now_us = video_now_us();
+                if (VIDEO_NACK) {
+                    // 受信側が穴を諦めるのは後ろが届いてから VIDEO_RTP_JITTER_MS 後。送り直しもそれまでに
+                    int64_t now = now_us / 1000;
+                    for (int i = 0; i < n; i++)
+                        video_history.put(rtp_pkts[i].data, rtp_pkts[i].len, now, now + VIDEO_RTP_JITTER_MS);
+                }
+                if (VIDEO_PACER) {
+                    // 冗長は同じフレームのメディアの後ろに並ぶ。送るのは pace_video
+                    for (int i = 0; i < n; i++) video_pacer.push(PACE_VIDEO, rtp_pkts[i].data, rtp_pkts[i].len, now_us);
+                    for (int i = 0; i < m; i++) video_pacer.push(PACE_VIDEO, fec_pkts[i].data, fec_pkts[i].len, now_us);
+                    continue;
+                }
+                for (int i = 0; i < n; i++) rtp_dgs[i] = {rtp_pkts[i].data, rtp_pkts[i].len};
+                for (int i = 0; i < m; i++) rtp_dgs[n + i] = {fec_pkts[i].data, fec_pkts[i].len};
+                udp_tx.send(rtp_dgs.data(), n + m);
+                // 到着時刻が返ってくるのはメディアパケットだけ（冗長の分は受信側の速さに含まれない）
+                if (VIDEO_CC)
+                    for (int i = 0; i < n; i++)
+                        video_cc.on_packet_sent((uint16_t)(rtp_pkts[i].data[2] << 8 | rtp_pkts[i].data[3]),
+                                                rtp_pkts[i].len, now_us);
+                continue;
+            }
+            // 大きなキーフレームは参照を持ったままゼロコピーで送る（セッションの pkt は次で再利用される）
+            AVPacket *held = (pkt->flags & AV_PKT_FLAG_KEY) && pkt->size >= VIDEO_ZC_MIN ? av_packet_clone(pkt) : nullptr;
+            if (held) pkt = held;
+            framed_writer_add(out, pkt->data, pkt->size);
+            if (held) framed_writer_hold_packet(out, held);   // 送り終わったら手放す
+            if (framed_writer_flush(out) < 0) goto finish;
         }
+        if (framed_writer_flush(out) < 0) break;   // 制御メッセージだけのとき
+        if (cf.index >= 0) cap->release(cf);
 
-        std::this_thread::sleep_until(t0 + period); // FPS制限
+        // FPS制限（fps は通話中に変わることがある）
+        std::this_thread::sleep_until(t0 + std::chrono::milliseconds(1000 / enc.config().fps));
     }
 finish:
-    av_packet_free(&pkt);
-    av_frame_free(&frame);
-    avcodec_free_context(&enc_ctx);
-    sws_freeContext(sws_ctx);
+    if (video_rtp) {
+        const UdpBatchStats &st = udp_tx.stats();
+        if (!VIDEO_PACER)   // ペーサを使うときは pace_video が出す
+            fprintf(stderr, "video: udp tx %llu datagrams in %llu syscalls (%.1f per call, %llu GSO sends)\n",
+                    (unsigned long long)st.datagrams, (unsigned long long)st.syscalls,
+                    st.syscalls ? (double)st.datagrams / st.syscalls : 0.0, (unsigned long long)st.gso);
+        fprintf(stderr, "video: fec (%s) %llu parity for %llu media packets, target ratio %.2f, "
+                        "effective %.2f of media bytes\n",
+                rtp_fec_impl_name(), (unsigned long long)fec.fec_packets(),
+                (unsigned long long)fec.media_packets(), fec.ratio(),
+                fec.media_bytes() ? (double)fec.fec_bytes() / fec.media_bytes() : 0.0);
+        RtpHistoryStats hs = video_history.stats();
+        fprintf(stderr, "video: nack requested %llu, resent %llu, too late %llu, in flight %llu, gone %llu (rtt %d ms)\n",
+                (unsigned long long)hs.requested, (unsigned long long)hs.resent, (unsigned long long)hs.too_late,
+                (unsigned long long)hs.in_flight, (unsigned long long)hs.missing, video_history.rtt_ms());
+        CcState cs = video_cc.state();
+        fprintf(stderr, "video: cc target %lld bps (delay %lld, loss %lld, acked %lld), trend %.2f / %.2f\n",
+                (long long)cs.target_bps, (long long)cs.delay_bps, (long long)cs.loss_bps,
+                (long long)cs.acked_bps, cs.trend, cs.threshold);
+    }
+    framed_writer_destroy(out);
+    enc.close();
+    sws_freeContext(self_sws);
+    if (self_pool) g_idle_add(release_display_pool, self_pool);
+    if (cf.index >= 0) cap->release(cf);
+    delete cap;
     return nullptr;
 }
 
-static gboolean update_peer_image(gpointer data)
+/* RTP: ペーサから出す時刻が来たパケットを送る（send_video と再送はペーサに積むだけ） */
+static void *pace_video(void *)
 {
-    // data == GdkPixbuf*
-    GtkImage *img = GTK_IMAGE(app.image_peer);
-    gtk_image_set_from_pixbuf(img, (GdkPixbuf*)data);
-    g_object_unref(G_OBJECT(data));
+    UdpBatchSender tx(cli_sock_video, VIDEO_UDP_BATCH, VIDEO_UDP_GSO);
+    std::vector<PacerPacket> pkts(VIDEO_UDP_BATCH);
+    std::vector<UdpDatagram> dgs(pkts.size());
+    while (cli_sock_video >= 0) {
+        int64_t now = video_now_us(), next;
+        int n = video_pacer.pop(now, pkts.data(), (int)pkts.size(), &next);
+        for (int i = 0; i < n; i++) {
+            const PacerPacket &p = pkts[i];
+            dgs[i] = {p.data, p.len};
+            // 帯域推定の送信時刻は実際に出した時刻（送り直しと冗長は到着時刻が返ってこない）
+            if (VIDEO_CC && p.cls == PACE_VIDEO && !fec_is_fec(p.data, p.len))
+                video_cc.on_packet_sent((uint16_t)(p.data[2] << 8 | p.data[3]), p.len, now);
+        }
+        if (n > 0) tx.send(dgs.data(), n);
+        // 空なら積まれるまで、バケツが空なら次に出せる時刻まで（通話の終わりを見るため長くは寝ない）
+        if (n < (int)pkts.size()) video_pacer.wait(next < 0 ? 100'000 : std::min<int64_t>(next - now, 100'000));
+    }
+    const UdpBatchStats &st = tx.stats();
+    PacerStats ps = video_pacer.stats();
+    fprintf(stderr, "video: udp tx %llu datagrams in %llu syscalls (%.1f per call, %llu GSO sends)\n",
+            (unsigned long long)st.datagrams, (unsigned long long)st.syscalls,
+            st.syscalls ? (double)st.datagrams / st.syscalls : 0.0, (unsigned long long)st.gso);
+    fprintf(stderr, "video: pacer sent %llu video, %llu resent, dropped %llu, audio %llu bytes ahead, queue delay avg %.1f ms, max %d ms\n",
+            (unsigned long long)ps.sent[PACE_VIDEO], (unsigned long long)ps.sent[PACE_RETRANSMIT],
+            (unsigned long long)ps.dropped, (unsigned long long)ps.audio_bytes, ps.avg_delay_ms, ps.max_delay_ms);
+    return nullptr;
+}
+
+#define DISPLAY_POOL_SIZE 4   // 表示中 + 表示待ち + デコード中 + 予備
+
+// 通話終了時: ビューが握っているフレームを手放してからプールを消す
+static gboolean release_display_pool(gpointer data)
+{
+    video_view_clear(app.video_view);
+    frame_pool_destroy((FramePool*)data);
     return G_SOURCE_REMOVE;
 }
+
+/* 映像ソケットから H.264 を 1 かたまり受け取る（制御メッセージはここで片付ける）。
+   TCP: 長さ付きの 1 アクセスユニット / RTP: 並べ直して揃った 1 アクセスユニット。
+   lost: RTP でこの前に欠落があった。通話が終わったら false */
+struct VideoRx {
+    RtpDepacketizer  rtp{VIDEO_RTP_JITTER_MS};
+    FecDecoder       fec;                  // 欠けたパケットは並べ直しの待ち時間のうちに作り直す
+    RtpPacket        recovered[FEC_MAX_M];
+    UdpBatchReceiver udp;
+    UdpBatchSender   rtx;                  // 頼まれた再送
+    std::vector<RtpPacket>   rtx_pkts;
+    std::vector<UdpDatagram> rtx_dgs;
+    bool             peer_known = false;   // サーバ側は最初に届いた相手へ connect する
+    int64_t          last_rr_ms = 0;
+    ArrivalRecorder  arrivals;             // 帯域推定のため、メディアパケットの到着時刻を相手へ返す
+    int64_t          last_fb_ms = 0;
+    explicit VideoRx(int sock)
+        : udp(sock, video_rtp ? VIDEO_UDP_BATCH : 1, video_rtp && VIDEO_UDP_GRO),
+          rtx(sock, VIDEO_UDP_BATCH, VIDEO_UDP_GSO), rtx_pkts(video_rtp ? VIDEO_NACK_MAX : 0), rtx_dgs(rtx_pkts.size()) {}
+};
+
+static bool receive_video_unit(VideoRx &rx, std::vector<uint8_t> &buf, bool *lost)
+{
+    *lost = false;
+    if (!video_rtp) {
+        for (;;) {
+            uint32_t len_n;
+            if (recv(cli_sock_video,&len_n,4,MSG_WAITALL) <= 0) return false;
+            uint32_t len = ntohl(len_n);
+            if (len & VIDEO_CTRL_FLAG) {
+                /* 制御メッセージ（相手の受信側から） */
+                if (len == VIDEO_CTRL_IDR) {
+                    fprintf(stderr, "video: peer requested a keyframe\n");
+                    idr_requested = true;
+                }
+                continue;
+            }
+            buf.resize(len);
+            ssize_t r = 0;
+            while (r < (ssize_t)len) {
+                ssize_t n = recv(cli_sock_video, buf.data()+r, len-r, 0);
+                if (n <= 0) return false;
+                r += n;
+            }
+            return true;
+        }
+    }
+
+    for (;;) {
+        uint32_t ts;
+        if (rx.rtp.pop(buf, &ts, lost, video_now_ms())) return true;
+        if (cli_sock_video < 0) return false;
+        struct sockaddr_in from;
+        int n = rx.udp.receive(&from);   // 届いている分をまとめて
+        if (n < 0) {
+            /* しばらく何も来ない: 相手がまだこちらを知らないか、キーフレームごと落ちた */
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { idr_to_request = true; continue; }
+            if (errno == EINTR || errno == ECONNREFUSED) continue;   // 相手のポートがまだ開いていない
+            return false;
+        }
+        if (n > 0 && !rx.peer_known) {
+            connect(cli_sock_video, (struct sockaddr*)&from, sizeof(from));
+            rx.peer_known = true;
+        }
+        int64_t now = video_now_ms();
+        for (int i = 0; i < n; i++) {
+            const uint8_t *dg = rx.udp.at(i).data;
+            int len = rx.udp.at(i).len;
+            if (rtcp_is_rtcp(dg, len)) {
+                if (rtcp_is_pli(dg, len)) {
+                    fprintf(stderr, "video: peer requested a keyframe (PLI)\n");
+                    idr_requested = true;
+                }
+                int fl = rtcp_rr_fraction_lost(dg, len);
+                if (fl >= 0) video_peer_loss = fl;
+                if (VIDEO_CC) {
+                    if (fl >= 0) video_cc.on_loss_report(fl / 256.0, video_now_us());
+                    if (cc_is_feedback(dg, len)) { video_cc.on_feedback(dg, len, video_now_us()); continue; }
+                }
+                /* 再送の要求: 間に合うものだけ履歴から送り直す。UDP はデータグラムごとに独立なので、
+                   send_video の次のフレームを待たずにこのスレッドから送る（ペーサを使うなら割り込ませる） */
+                uint16_t seqs[VIDEO_NACK_MAX];
+                int k = VIDEO_NACK ? rtcp_parse_nack(dg, len, seqs, VIDEO_NACK_MAX) : 0;
+                int r = k > 0 ? video_history.resend(seqs, k, now, rx.rtx_pkts.data()) : 0;
+                for (int j = 0; j < r; j++) {
+                    rx.rtx_dgs[j] = {rx.rtx_pkts[j].data, rx.rtx_pkts[j].len};
+                    if (VIDEO_CC) video_cc.on_retransmit((uint16_t)(rx.rtx_pkts[j].data[2] << 8 | rx.rtx_pkts[j].data[3]));
+                    // ペーサでは新しい映像より先に出る
+                    if (VIDEO_PACER) video_pacer.push(PACE_RETRANSMIT, rx.rtx_pkts[j].data, rx.rtx_pkts[j].len, video_now_us());
+                }
+                if (r > 0 && !VIDEO_PACER) rx.rtx.send(rx.rtx_dgs.data(), r);
+                continue;
+            }
+            if (!fec_is_fec(dg, len)) {
+                if (len >= RTP_HEADER_SIZE) {
+                    video_peer_ssrc = (uint32_t)dg[8] << 24 | dg[9] << 16 | dg[10] << 8 | dg[11];
+                    // カーネルの受信時刻（まとめ受けの待ちが遅延に入らない）
+                    if (VIDEO_CC) rx.arrivals.on_packet((uint16_t)(dg[2] << 8 | dg[3]), rx.udp.arrival_us(i));
+                }
+                rx.rtp.push(dg, len, now);
+            }
+            int r = rx.fec.push(dg, len, rx.recovered);
+            for (int j = 0; j < r; j++) rx.rtp.push(rx.recovered[j].data, rx.recovered[j].len, now);
+        }
+        if (VIDEO_NACK && n > 0) {
+            /* FEC でも埋まらなかった穴を頼む（冗長は同じまとめ受けで先に入っている） */
+            uint16_t seqs[VIDEO_NACK_MAX];
+            int k = rx.rtp.nack_list(seqs, VIDEO_NACK_MAX, now, VIDEO_NACK_RETRY_MS, VIDEO_NACK_TRIES);
+            uint8_t nack[12 + 4 * VIDEO_NACK_MAX];
+            if (k > 0) send(cli_sock_video, nack, rtcp_write_nack(nack, video_own_ssrc, video_peer_ssrc, seqs, k), 0);
+        }
+        if (VIDEO_CC && now - rx.last_fb_ms >= VIDEO_CC_FEEDBACK_MS) {
+            rx.last_fb_ms = now;
+            uint8_t fb[CC_FEEDBACK_MAX_SIZE];
+            int k = rx.arrivals.write_feedback(fb, video_own_ssrc, video_peer_ssrc);
+            if (k > 0) send(cli_sock_video, fb, k, 0);
+        }
+        if (n > 0 && now - rx.last_rr_ms >= VIDEO_RTCP_RR_MS) {
+            /* FEC で直す前の損失率を相手の FEC の強さに使ってもらう */
+            rx.last_rr_ms = now;
+            rr_block = (uint64_t)rx.fec.take_fraction_lost() << 56 |
+                       (uint64_t)((uint32_t)rx.fec.cumulative_lost() & 0xFFFFFF) << 32 | rx.fec.ext_highest_seq();
+            rr_to_send = true;
+        }
+    }
+}
+
 static void *receive_video(void*)
 {
     /* 1) デコーダ初期化（最初の 1 回だけ） */
     const AVCodec *dec = avcodec_find_decoder(AV_CODEC_ID_H264);
     dec_ctx = avcodec_alloc_context3(dec);
+    // パケットは 1 フレームずつ届く。並べ替えの待ちを入れずにすぐ出す
+    dec_ctx->flags  |= AV_CODEC_FLAG_LOW_DELAY;
     avcodec_open2(dec_ctx, dec, nullptr);
 
     AVPacket *pkt  = av_packet_alloc();
     AVFrame  *yuv  = av_frame_alloc();
-    AVFrame  *bgr  = av_frame_alloc();               // RGB/BGR 変換用
 
-    const int W = 640, H = 360; // 解像度を一致させる
-    dec_sws = sws_getContext(W, H, AV_PIX_FMT_YUV420P,
-                             W, H, AV_PIX_FMT_BGR24,
-                             SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+    /* 表示用 BGRx バッファのリング（ビューが使い終わったら戻ってくる）。
+       送信側は通話中に解像度を変えるので、大きさはデコード結果に合わせる */
+    FramePool *disp_pool = nullptr;
+    int disp_w = 0, disp_h = 0;
+    video_view_reset_stats(app.video_view);
+
+    /* デコードに失敗したら相手にキーフレームを頼む。届くまで 1 往復かかるので、
+       その間の失敗では頼み直さない */
+    auto last_idr_req = std::chrono::steady_clock::time_point();
+    SocketBacklog link;
 
-    /* BGR フレーム用バッファ確保 */
-    bgr->format = AV_PIX_FMT_BGR24;
-    bgr->width  = W;
-    bgr->height = H;
-    av_frame_get_buffer(bgr, 32);
+    VideoRx rx(cli_sock_video);
+    if (video_rtp) idr_to_request = true;   // 最初の PLI で相手（サーバ）にこちらのアドレスを教える
 
     std::vector<uint8_t> buf;
     for (;;) {
-        /* 2) 封入長を読んでパケットを受信 */
-        uint32_t len_n;
-        if (recv(cli_sock_video,&len_n,4,MSG_WAITALL) <= 0) break;
-        uint32_t len = ntohl(len_n);
-        buf.resize(len);
-        ssize_t r = 0;
-        while (r < (ssize_t)len) {
-            ssize_t n = recv(cli_sock_video, buf.data()+r, len-r, 0);
-            if (n <= 0) goto finish;
-            r += n;
-        }
+        /* 2) アクセスユニットを受信 */
+        bool lost;
+        if (!receive_video_unit(rx, buf, &lost)) break;
 
-        /* 3) H.264 パケット → AVPacket へ詰める */
+        /* 3) H.264 アクセスユニット（SPS/PPS 付きのこともある）→ AVPacket へ詰める */
         av_packet_unref(pkt);
         pkt->data = buf.data();
         pkt->size = buf.size();
 
-        /* 4) デコード */
-        if (avcodec_send_packet(dec_ctx, pkt) < 0) continue;
-        while (avcodec_receive_frame(dec_ctx, yuv) == 0) {
-            /* 5) YUV420P → BGR */
-            memset(bgr->data[0], 0, bgr->linesize[0] * bgr->height); // フレームをゼロクリア
+        /* 4) デコード。壊れていたら（途中参加で SPS がない・欠損）キーフレームを頼む */
+        int  sent   = avcodec_send_packet(dec_ctx, pkt);
+        bool broken = sent < 0 || lost;
+        while (sent >= 0 && avcodec_receive_frame(dec_ctx, yuv) == 0) {
+            if ((yuv->flags & AV_FRAME_FLAG_CORRUPT) || yuv->decode_error_flags) broken = true;
+            /* 5) 解像度が変わったら表示バッファと変換器だけ作り直す */
+            if (yuv->width != disp_w || yuv->height != disp_h) {
+                if (disp_pool) g_idle_add(release_display_pool, disp_pool);
+                disp_w = yuv->width;
+                disp_h = yuv->height;
+                disp_pool = frame_pool_create(disp_w, disp_h, 4, DISPLAY_POOL_SIZE);
+            }
+            dec_sws = sws_getCachedContext(dec_sws, disp_w, disp_h, (AVPixelFormat)yuv->format,
+                                           disp_w, disp_h, AV_PIX_FMT_BGRA,  // cairo RGB24 (BGRx) と同じ並び
+                                           SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+
+            /* 6) 空いている表示バッファを取る。GTK が追いついていなければこのフレームは捨てる */
+            ImageFrame *out = disp_pool ? frame_pool_acquire(disp_pool) : nullptr;
+            if (!out || !dec_sws) { image_frame_unref(out); continue; }
+
+            /* 7) YUV420P → BGRx（表示バッファへ直接書く） */
+            uint8_t *dst_data[4] = {out->data, nullptr, nullptr, nullptr};
+            int dst_stride[4]    = {out->stride, 0, 0, 0};
             sws_scale(dec_sws,
-                      yuv->data, yuv->linesize, 0, dec_ctx->height,
-                      bgr->data, bgr->linesize);
-
-            /* 6) BGR → GdkPixbuf (RGB 順) */
-            GdkPixbuf *pix = gdk_pixbuf_new_from_data(
-                bgr->data[0], GDK_COLORSPACE_RGB, FALSE, 8,
-                W, H, bgr->linesize[0],
-                nullptr, nullptr);          // ChatGPT では自前解放しない
-            g_idle_add(update_peer_image, pix);
+                      yuv->data, yuv->linesize, 0, yuv->height,
+                      dst_data, dst_stride);
+
+            /* 8) ビューへ（表示が終われば unref されてプールへ戻る） */
+            video_view_publish_peer(app.video_view, out);
+        }
+        if (broken) {
+            auto now = std::chrono::steady_clock::now();
+            socket_backlog(cli_sock_video, &link);
+            auto wait = std::chrono::milliseconds(std::max(100, 2 * link.rtt_ms));
+            if (now - last_idr_req >= wait) {
+                fprintf(stderr, "video: decode error, requesting keyframe\n");
+                last_idr_req   = now;
+                idr_to_request = true;
+            }
         }
     }
-finish:
-    av_frame_free(&bgr);
+    if (video_rtp) {
+        const UdpBatchStats &st = rx.udp.stats();
+        fprintf(stderr, "video: rtp received %llu, lost %llu, reordered %llu, late %llu, nacked %llu\n",
+                (unsigned long long)rx.rtp.received(), (unsigned long long)rx.rtp.lost(),
+                (unsigned long long)rx.rtp.reordered(), (unsigned long long)rx.rtp.late(),
+                (unsigned long long)rx.rtp.nacked());
+        fprintf(stderr, "video: fec received %llu parity, recovered %llu packets\n",
+                (unsigned long long)rx.fec.fec_received(), (unsigned long long)rx.fec.recovered());
+        fprintf(stderr, "video: udp rx %llu datagrams in %llu syscalls (%.1f per call, %llu GRO)\n",
+                (unsigned long long)st.datagrams, (unsigned long long)st.syscalls,
+                st.syscalls ? (double)st.datagrams / st.syscalls : 0.0, (unsigned long long)st.gso);
+    }
     av_frame_free(&yuv);
     av_packet_free(&pkt);
     sws_freeContext(dec_sws);
     avcodec_free_context(&dec_ctx);
+    uint64_t n_pub, n_shown, n_drop;
+    video_view_peer_stats(app.video_view, &n_pub, &n_shown, &n_drop);
+    fprintf(stderr, "video: decoded %llu, shown %llu, dropped before display %llu\n",
+            (unsigned long long)n_pub, (unsigned long long)n_shown, (unsigned long long)n_drop);
+    if (disp_pool) g_idle_add(release_display_pool, disp_pool);
     return nullptr;
 }
 
 /*──────────────────────
   AUDIO helpers (以前と同じ)
 ──────────────────────*/
+static AudioEngine *open_audio(){
+    AudioConfig c; c.backend=AUDIO_IO_BACKEND; c.capture_dev=c.playback_dev=AUDIO_DEVICE; c.rate=AUDIO_RATE; c.channels=1;
+    c.period_ms=AUDIO_PERIOD_MS; c.periods=AUDIO_PERIODS; c.fifo_ms=AUDIO_FIFO_MS; c.rt_priority=AUDIO_IO_PRIO;
+    AudioEngine *a=audio_open(c); if(!a) set_status("🔇 No audio device"); return a;
+}
+static void close_audio(){
+    if(!audio) return;
+    AudioStats s=audio->stats();
+    fprintf(stderr,"audio: xruns %llu capture / %llu playback, %llu frames dropped unread, %llu frames of silence\n",
+            (unsigned long long)s.capture_xruns,(unsigned long long)s.playback_xruns,
+            (unsigned long long)s.capture_dropped,(unsigned long long)s.playback_silence);
+    delete audio; audio=nullptr;
+}
 static void *send_audio(void*){
-    char b[4096]; ssize_t n;
-    while((n=fread(b,1,sizeof(b),rec_stream))>0){ if(cli_sock_audio<0)break; if(send(cli_sock_audio,b,n,0)<=0)break; }
+    if(!audio) return NULL;
+    int16_t b[AUDIO_RATE/1000*AUDIO_PKT_MS]; int n;
+    while(cli_sock_audio>=0 && (n=audio->read(b,sizeof(b)/sizeof(b[0]),100))>=0){ if(n==0)continue; if(send(cli_sock_audio,b,sizeof(b),0)<=0)break;
+        if(video_rtp && VIDEO_PACER) video_pacer.on_audio_sent(sizeof(b),video_now_us()); }   // 音声が先。映像はその分待つ
     return NULL;
 }
 static void *receive_audio(void*){
-    char b[4096]; ssize_t n; FILE* play=popen("play -t raw -b 16 -c 1 -e s -r 44100 -","w");
-    while(cli_sock_audio>=0 && (n=recv(cli_sock_audio,b,sizeof(b),0))>0){ fwrite(b,1,n,play);} pclose(play); return NULL; }
+    alignas(int16_t) char b[4096]; ssize_t n; size_t have=0;   // サンプルの途中で切れた 1 バイトは次へ持ち越す
+    while(cli_sock_audio>=0 && (n=recv(cli_sock_audio,b+have,sizeof(b)-have,0))>0){ have+=n;
+        if(audio) audio->write((const int16_t*)b,have/2,100);   // デバイスがなくても読み捨てて相手を詰まらせない
+        if(have&1) b[0]=b[have-1]; have&=1; }
+    return NULL; }
 
 /*──────────────────────
   NETWORK server/client
 ──────────────────────*/
 static int open_listen(int port){int s=socket(AF_INET,SOCK_STREAM,0); struct sockaddr_in a={0}; a.sin_family=AF_INET;a.sin_port=htons(port);a.sin_addr.s_addr=INADDR_ANY; bind(s,(struct sockaddr*)&a,sizeof(a)); listen(s,1); return s;}
+// RTP 用 UDP。キーフレームの塊を取りこぼさないよう受信バッファを大きめに、受信は時々起きて様子を見る
+static int open_udp(int port){int s=socket(AF_INET,SOCK_DGRAM,0); struct sockaddr_in a={0}; a.sin_family=AF_INET;a.sin_port=htons(port);a.sin_addr.s_addr=INADDR_ANY; bind(s,(struct sockaddr*)&a,sizeof(a));
+    int rb=1<<20; setsockopt(s,SOL_SOCKET,SO_RCVBUF,&rb,sizeof(rb));
+    struct timeval tv={0,VIDEO_RTP_IDLE_MS*1000}; setsockopt(s,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv)); return s;}
+static int open_udp_connect(const char*ip,int port){int s=open_udp(0); struct sockaddr_in a={0}; a.sin_family=AF_INET;a.sin_port=htons(port); inet_pton(AF_INET,ip,&a.sin_addr); connect(s,(struct sockaddr*)&a,sizeof(a)); return s;}
 static int open_connect(const char*ip,int port){int s=socket(AF_INET,SOCK_STREAM,0); struct sockaddr_in a={0}; a.sin_family=AF_INET;a.sin_port=htons(port); inet_pton(AF_INET,ip,&a.sin_addr); connect(s,(struct sockaddr*)&a,sizeof(a)); return s;}
 
+/* 多重化: 1 本の TCP を音声 / フィードバック / 映像のチャネルに分ける。
+   各スレッドには今までどおりのソケット（ローカルの socketpair）として見せる */
+static AvMux    *mux = nullptr;
+static pthread_t mux_tx, mux_rx;
+static void start_mux(int tcp){
+    MuxConfig mc; mc.chunk = AV_MUX_CHUNK;
+    cli_sock_mux = tcp;
+    mux = new AvMux(tcp, mc);
+    cli_sock_audio    = mux->open_channel(MUX_AUDIO);
+    cli_sock_feedback = mux->open_channel(MUX_FEEDBACK);
+    cli_sock_video    = mux->open_channel(MUX_VIDEO);
+    pthread_create(&mux_tx, NULL, +[](void*) -> void* { mux->run_send(); return NULL; }, NULL);
+    pthread_create(&mux_rx, NULL, +[](void*) -> void* { mux->run_recv(); return NULL; }, NULL);
+}
+static void stop_mux(){
+    pthread_join(mux_tx, NULL);
+    pthread_join(mux_rx, NULL);
+    const MuxStats &tx = mux->tx_stats();
+    fprintf(stderr, "mux: sent %llu audio / %llu video chunks, audio went ahead of queued video %llu times\n",
+            (unsigned long long)tx.chunks[MUX_AUDIO], (unsigned long long)tx.chunks[MUX_VIDEO],
+            (unsigned long long)tx.preempted);
+    const MuxStats &rx = mux->rx_stats();
+    fprintf(stderr, "mux: received video backlog peaked at %llu bytes, %llu channels closed unread, %llu bytes dropped\n",
+            (unsigned long long)rx.max_pending[MUX_VIDEO], (unsigned long long)rx.overflowed,
+            (unsigned long long)rx.dropped);
+    if (cli_sock_feedback >= 0) { close(cli_sock_feedback); cli_sock_feedback = -1; }
+    if (cli_sock_mux >= 0) { close(cli_sock_mux); cli_sock_mux = -1; }
+    delete mux; mux = nullptr;
+}
+
 // グローバル変数で音再生制御
 std::atomic<bool> is_ringing{false};
 
@@ -275,7 +764,8 @@ static void* ring_tone_thread(void*) {
 static void run_server(const char *port) {
     int p = atoi(port);
     srv_sock_audio = open_listen(p);
-    srv_sock_video = open_listen(p + 1);
+    if (video_rtp)    cli_sock_video = open_udp(p + 1);   // 相手のアドレスは最初のパケットで覚える
+    else if (!av_mux) srv_sock_video = open_listen(p + 1);
 
     // 呼び出し音を繰り返すスレッドを開始
     is_ringing = true;
@@ -283,33 +773,44 @@ static void run_server(const char *port) {
     pthread_create(&ring_thread, nullptr, ring_tone_thread, nullptr);
 
     cli_sock_audio = accept(srv_sock_audio, NULL, NULL);
-    cli_sock_video = accept(srv_sock_video, NULL, NULL);
+    if (av_mux) start_mux(cli_sock_audio);   // 1 本目だけで足りる
+    else if (!video_rtp) cli_sock_video = accept(srv_sock_video, NULL, NULL);
 
     // クライアントが接続したら呼び出し音を停止
     is_ringing = false;
     pthread_join(ring_thread, nullptr);
 
-    rec_stream = popen("rec -t raw -b 16 -c 1 -e s -r 44100 -", "r");
-    pthread_t ta, tr, tv_send, tv_recv;
+    audio = open_audio();
+    pthread_t ta, tr, tv_send, tv_recv, tv_pace;
+    bool paced = video_rtp && VIDEO_PACER;
     pthread_create(&ta, NULL, send_audio, NULL);
     pthread_create(&tr, NULL, receive_audio, NULL);
     pthread_create(&tv_send, NULL, send_video, NULL);
     pthread_create(&tv_recv, NULL, receive_video, NULL);
+    if (paced) pthread_create(&tv_pace, NULL, pace_video, NULL);
     pthread_join(ta, NULL);
     pthread_join(tr, NULL);
     pthread_join(tv_send, NULL);
     pthread_join(tv_recv, NULL);
+    if (paced) pthread_join(tv_pace, NULL);
+    close_audio();
+    if (av_mux) stop_mux();
 }
 static void run_client(const char *ip,const char *port){int p=atoi(port);
     cli_sock_audio=open_connect(ip,p);
-    cli_sock_video=open_connect(ip,p+1);
-    rec_stream=popen("rec -t raw -b 16 -c 1 -e s -r 44100 -","r");
-    pthread_t ta,tr,tv_send,tv_recv;
+    if(av_mux) start_mux(cli_sock_audio);
+    else cli_sock_video=video_rtp ? open_udp_connect(ip,p+1) : open_connect(ip,p+1);
+    audio=open_audio();
+    pthread_t ta,tr,tv_send,tv_recv,tv_pace; bool paced=video_rtp && VIDEO_PACER;
     pthread_create(&ta,NULL,send_audio,NULL);
     pthread_create(&tr,NULL,receive_audio,NULL);
     pthread_create(&tv_send,NULL,send_video,NULL);
     pthread_create(&tv_recv,NULL,receive_video,NULL);
+    if(paced) pthread_create(&tv_pace,NULL,pace_video,NULL);
     pthread_join(ta,NULL); pthread_join(tr,NULL); pthread_join(tv_send,NULL); pthread_join(tv_recv,NULL);
+    if(paced) pthread_join(tv_pace,NULL);
+    close_audio();
+    if(av_mux) stop_mux();
 }
 
 // ビープ音を鳴らす関数
@@ -458,10 +959,10 @@ static GtkWidget* build_ui() {
     gtk_grid_attach(GTK_GRID(grid), lbl_status, 0, 4, 3, 1);
 
     // ピア動画表示
-    GtkWidget* image_peer = gtk_image_new_from_icon_name("camera-web", GTK_ICON_SIZE_DIALOG);
-    app.image_peer = image_peer;
+    GtkWidget* video = video_view_new(320, 180);
+    app.video_view = video;
     gtk_grid_attach(GTK_GRID(grid), gtk_label_new("📹 Peer Video:"), 0, 5, 1, 1);
-    gtk_grid_attach(GTK_GRID(grid), image_peer, 1, 5, 2, 1);
+    gtk_grid_attach(GTK_GRID(grid), video, 1, 5, 2, 1);
 
     // サーバー/クライアント切り替え時の動作を追加
     g_signal_connect(radio_srv, "toggled", G_CALLBACK(+[](GtkToggleButton *btn, gpointer data) {
@@ -491,9 +992,9 @@ static GtkWidget* build_ui() {
         if (!app.running) return;
         if (cli_sock_audio > 0) { shutdown(cli_sock_audio, SHUT_RDWR); close(cli_sock_audio); cli_sock_audio = -1; }
         if (cli_sock_video > 0) { shutdown(cli_sock_video, SHUT_RDWR); close(cli_sock_video); cli_sock_video = -1; }
+        if (cli_sock_mux > 0) shutdown(cli_sock_mux, SHUT_RDWR);   // 閉じるのは stop_mux
         if (srv_sock_audio > 0) { close(srv_sock_audio); srv_sock_audio = -1; }
         if (srv_sock_video > 0) { close(srv_sock_video); srv_sock_video = -1; }
-        if (rec_stream) { pclose(rec_stream); rec_stream = NULL; }
         pthread_join(app.worker, NULL);
         app.running = FALSE;
         set_status("🟢 Stopped");
@@ -0,0 +1,446 @@
+// audio_engine.cpp
+// ALSA / PulseAudio の入出力スレッドと、アプリとの間の FIFO
+#include "audio_engine.h"
+#include <alsa/asoundlib.h>
+#ifdef AUDIO_WITH_PULSE
+#include <pulse/simple.h>
+#include <pulse/error.h>
+#endif
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+static int64_t mono_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// ── FIFO ─────────────────────────────────────────
+
+// 1 方向の 16 ビットサンプルの FIFO（生産者 1 / 消費者 1、ロックなし）
+//   入出力スレッドの側は待たない。アプリの側だけが ev（進むたびに増える）の futex で待つ。
+//   入出力スレッドは相手が眠っているときだけ起こすので、ふだんはシステムコールを呼ばない
+class SampleFifo {
+public:
+    explicit SampleFifo(uint32_t min_samples)
+    {
+        cap = 1;
+        while (cap < min_samples) cap <<= 1;
+        buf = new int16_t[cap]();
+    }
+    ~SampleFifo() { delete[] buf; }
+
+    uint32_t readable() const { return w.load(std::memory_order_acquire) - r.load(std::memory_order_acquire); }
+    uint32_t writable() const { return cap - readable(); }
+    uint32_t capacity() const { return cap; }
+
+    // 入るだけ書いて数を返す（生産者）
+    uint32_t push(const int16_t *p, uint32_t n)
+    {
+        uint32_t wi = w.load(std::memory_order_relaxed);
+        uint32_t room = cap - (wi - r.load(std::memory_order_acquire));
+        if (n > room) n = room;
+        uint32_t at = wi & (cap - 1), first = n < cap - at ? n : cap - at;
+        memcpy(buf + at, p, first * sizeof(int16_t));
+        memcpy(buf, p + first, (n - first) * sizeof(int16_t));
+        w.store(wi + n, std::memory_order_release);
+        return n;
+    }
+    // あるだけ（n まで）読んで数を返す（消費者）
+    uint32_t pop(int16_t *p, uint32_t n)
+    {
+        uint32_t ri = r.load(std::memory_order_relaxed);
+        uint32_t have = w.load(std::memory_order_acquire) - ri;
+        if (n > have) n = have;
+        uint32_t at = ri & (cap - 1), first = n < cap - at ? n : cap - at;
+        memcpy(p, buf + at, first * sizeof(int16_t));
+        memcpy(p + first, buf, (n - first) * sizeof(int16_t));
+        r.store(ri + n, std::memory_order_release);
+        return n;
+    }
+
+    // 入出力スレッド: 進めたのでアプリを起こす
+    void notify()
+    {
+        ev.fetch_add(1, std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_seq_cst))
+            syscall(SYS_futex, (uint32_t *)&ev, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+    void close()
+    {
+        closed.store(true, std::memory_order_seq_cst);
+        ev.fetch_add(1, std::memory_order_seq_cst);
+        syscall(SYS_futex, (uint32_t *)&ev, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+    bool is_closed() const { return closed.load(std::memory_order_acquire); }
+
+    // アプリ: readable() か writable() が n 以上になるまで待つ。閉じたか時間切れなら false
+    bool wait(bool for_read, uint32_t n, int64_t deadline_us)
+    {
+        for (;;) {
+            sleeping.store(1, std::memory_order_seq_cst);
+            uint32_t e = ev.load(std::memory_order_seq_cst);   // これより後に進めば futex が眠らない
+            bool ok = (for_read ? readable() : writable()) >= n;
+            int64_t left = deadline_us - mono_us();
+            if (ok || is_closed() || left <= 0) {
+                sleeping.store(0, std::memory_order_relaxed);
+                return ok && !is_closed();
+            }
+            struct timespec ts = {(time_t)(left / 1000000), (long)(left % 1000000) * 1000};
+            syscall(SYS_futex, (uint32_t *)&ev, FUTEX_WAIT_PRIVATE, e, &ts, nullptr, 0);
+        }
+    }
+
+private:
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32-bit word");
+    int16_t *buf;
+    uint32_t cap;                                 // サンプル数（2 の累乗）
+    alignas(64) std::atomic<uint32_t> w{0};       // 通し番号（添字は & (cap - 1)）
+    alignas(64) std::atomic<uint32_t> r{0};
+    alignas(64) std::atomic<uint32_t> ev{0};
+    std::atomic<uint32_t> sleeping{0};
+    std::atomic<bool>     closed{false};
+};
+
+// ── デバイス ────────────────────────────────────
+
+// 1 方向のデバイス。read / write は frames を全部処理するまで返らない（デバイスの速さで待つ）。
+// xrun から戻したときは 0、続けられなければ -1
+class AudioDevice {
+public:
+    virtual ~AudioDevice() {}
+    virtual int read(int16_t *p, int frames) = 0;
+    virtual int write(const int16_t *p, int frames) = 0;
+};
+
+class AlsaDevice : public AudioDevice {
+public:
+    ~AlsaDevice() override
+    {
+        if (pcm) {
+            snd_pcm_drop(pcm);
+            snd_pcm_close(pcm);
+        }
+    }
+
+    // period / buffer には決まった値が入る
+    bool open(const char *name, bool capture, const AudioConfig &c, int *period, int *buffer)
+    {
+        if (!name) name = "default";   // nullptr = 既定のデバイス
+        int err = snd_pcm_open(&pcm, name,
+                               capture ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK, 0);
+        if (err < 0) {
+            fprintf(stderr, "audio: cannot open %s for %s: %s\n", name, capture ? "capture" : "playback", snd_strerror(err));
+            pcm = nullptr;
+            return false;
+        }
+        channels = c.channels;
+
+        snd_pcm_hw_params_t *hw;
+        snd_pcm_hw_params_alloca(&hw);
+        unsigned rate = c.rate;
+        snd_pcm_uframes_t per = (snd_pcm_uframes_t)c.rate * c.period_ms / 1000;
+        snd_pcm_uframes_t buf = per * c.periods;
+        if ((err = snd_pcm_hw_params_any(pcm, hw)) < 0 ||
+            (err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+            (err = snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S16_LE)) < 0 ||
+            (err = snd_pcm_hw_params_set_channels(pcm, hw, c.channels)) < 0 ||
+            (err = snd_pcm_hw_params_set_rate_near(pcm, hw, &rate, nullptr)) < 0 ||
+            (err = snd_pcm_hw_params_set_period_size_near(pcm, hw, &per, nullptr)) < 0 ||
+            (err = snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &buf)) < 0 ||
+            (err = snd_pcm_hw_params(pcm, hw)) < 0) {
+            fprintf(stderr, "audio: %s: hw params: %s\n", name, snd_strerror(err));
+            return false;
+        }
+        if ((int)rate != c.rate)
+            fprintf(stderr, "audio: %s runs at %u Hz instead of %d\n", name, rate, c.rate);
+
+        // 録音は最初の read で、再生はバッファが埋まったら動き出す。1 period ずつ起こす
+        snd_pcm_sw_params_t *sw;
+        snd_pcm_sw_params_alloca(&sw);
+        if ((err = snd_pcm_sw_params_current(pcm, sw)) < 0 ||
+            (err = snd_pcm_sw_params_set_start_threshold(pcm, sw, capture ? 1 : buf)) < 0 ||
+            (err = snd_pcm_sw_params_set_avail_min(pcm, sw, per)) < 0 ||
+            (err = snd_pcm_sw_params(pcm, sw)) < 0 ||
+            (err = snd_pcm_prepare(pcm)) < 0) {
+            fprintf(stderr, "audio: %s: sw params: %s\n", name, snd_strerror(err));
+            return false;
+        }
+        *period = (int)per;
+        *buffer = (int)buf;
+        return true;
+    }
+
+    int read(int16_t *p, int frames) override
+    {
+        int done = 0;
+        while (done < frames) {
+            snd_pcm_sframes_t n = snd_pcm_readi(pcm, p + done * channels, frames - done);
+            if (n < 0) return recover((int)n);
+            done += n;
+        }
+        return done;
+    }
+
+    int write(const int16_t *p, int frames) override
+    {
+        int done = 0;
+        while (done < frames) {
+            snd_pcm_sframes_t n = snd_pcm_writei(pcm, p + done * channels, frames - done);
+            if (n < 0) return recover((int)n);
+            done += n;
+        }
+        return done;
+    }
+
+private:
+    // -EPIPE（xrun）と -ESTRPIPE（サスペンド）は戻して 0。それ以外は続けられない
+    int recover(int err)
+    {
+        if (err == -EINTR) return 0;
+        if (snd_pcm_recover(pcm, err, 1) < 0) {
+            fprintf(stderr, "audio: %s\n", snd_strerror(err));
+            return -1;
+        }
+        return 0;
+    }
+
+    snd_pcm_t *pcm = nullptr;
+    int        channels = 1;
+};
+
+#ifdef AUDIO_WITH_PULSE
+// pa_simple はサーバとのやり取りを内部でロックするので、入出力スレッドがロックなしなのは ALSA のときだけ。
+// xrun はサーバ側で起きるので数えられない（FIFO の無音 / 捨てた分だけ数える）
+class PulseDevice : public AudioDevice {
+public:
+    ~PulseDevice() override
+    {
+        if (s) pa_simple_free(s);
+    }
+
+    bool open(const char *name, bool capture, const AudioConfig &c, int *period, int *buffer)
+    {
+        pa_sample_spec ss;
+        ss.format   = PA_SAMPLE_S16LE;
+        ss.rate     = c.rate;
+        ss.channels = c.channels;
+        uint32_t per = (uint32_t)(c.rate * c.period_ms / 1000) * c.channels * sizeof(int16_t);
+        pa_buffer_attr ba;
+        ba.maxlength = (uint32_t)-1;
+        ba.tlength   = capture ? (uint32_t)-1 : per * c.periods;   // 再生: サーバに溜める量
+        ba.prebuf    = (uint32_t)-1;
+        ba.minreq    = capture ? (uint32_t)-1 : per;
+        ba.fragsize  = capture ? per : (uint32_t)-1;                // 録音: 1 回で届く量
+        // pa_simple では nullptr が既定のデバイス。ALSA と同じ "default" もそれにする
+        if (name && strcmp(name, "default") == 0) name = nullptr;
+        int err = 0;
+        s = pa_simple_new(nullptr, "av_chat", capture ? PA_STREAM_RECORD : PA_STREAM_PLAYBACK, name,
+                          capture ? "capture" : "playback", &ss, nullptr, &ba, &err);
+        if (!s) {
+            fprintf(stderr, "audio: pulse %s: %s\n", capture ? "capture" : "playback", pa_strerror(err));
+            return false;
+        }
+        channels = c.channels;
+        *period  = c.rate * c.period_ms / 1000;
+        *buffer  = *period * c.periods;
+        return true;
+    }
+
+    int read(int16_t *p, int frames) override
+    {
+        int err;
+        return pa_simple_read(s, p, (size_t)frames * channels * sizeof(int16_t), &err) < 0 ? -1 : frames;
+    }
+
+    int write(const int16_t *p, int frames) override
+    {
+        int err;
+        return pa_simple_write(s, p, (size_t)frames * channels * sizeof(int16_t), &err) < 0 ? -1 : frames;
+    }
+
+private:
+    pa_simple *s = nullptr;
+    int        channels = 1;
+};
+#endif
+
+// ── エンジン ────────────────────────────────────
+
+static void set_rt_priority(int prio)
+{
+    if (prio <= 0) return;
+    struct sched_param sp;
+    sp.sched_priority = prio;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0)
+        fprintf(stderr, "audio: no realtime priority (running as a normal thread)\n");
+}
+
+void *AudioEngine::capture_main(void *self)
+{
+    AudioEngine *e = (AudioEngine *)self;
+    set_rt_priority(e->cfg.rt_priority);
+    while (e->running.load(std::memory_order_relaxed)) {
+        int n = e->cap->read(e->cap_buf, e->period);
+        if (n < 0) break;
+        if (n == 0) {
+            e->n_cap_xruns.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        uint32_t want = (uint32_t)n * e->cfg.channels;
+        uint32_t put  = e->cap_fifo->push(e->cap_buf, want);
+        if (put < want)   // アプリが読んでいない。新しいほうを捨てる
+            e->n_cap_dropped.fetch_add((want - put) / e->cfg.channels, std::memory_order_relaxed);
+        e->cap_fifo->notify();
+    }
+    e->cap_fifo->close();
+    return nullptr;
+}
+
+void *AudioEngine::playback_main(void *self)
+{
+    AudioEngine *e = (AudioEngine *)self;
+    set_rt_priority(e->cfg.rt_priority);
+    uint32_t want = (uint32_t)e->period * e->cfg.channels;
+    while (e->running.load(std::memory_order_relaxed)) {
+        uint32_t got = e->play_fifo->pop(e->play_buf, want);
+        if (got < want) {   // 足りない分は無音にしてデバイスを止めない
+            memset(e->play_buf + got, 0, (want - got) * sizeof(int16_t));
+            e->n_play_silence.fetch_add((want - got) / e->cfg.channels, std::memory_order_relaxed);
+        }
+        e->play_fifo->notify();
+        int n = e->play->write(e->play_buf, e->period);
+        if (n < 0) break;
+        if (n == 0) e->n_play_xruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    e->play_fifo->close();
+    return nullptr;
+}
+
+AudioEngine *audio_open(const AudioConfig &c)
+{
+    AudioEngine *e = new AudioEngine();
+    e->cfg = c;
+    if (e->cfg.period_ms < AUDIO_MIN_PERIOD_MS) e->cfg.period_ms = AUDIO_MIN_PERIOD_MS;
+    if (e->cfg.periods < 2) e->cfg.periods = 2;
+    if (e->cfg.channels < 1) e->cfg.channels = 1;
+
+#ifdef AUDIO_WITH_PULSE
+    if (e->cfg.backend == AUDIO_BACKEND_PULSE) {
+        PulseDevice *cap = new PulseDevice(), *play = new PulseDevice();
+        e->cap = cap;
+        e->play = play;
+        e->pulse = true;
+        if (!cap->open(e->cfg.capture_dev, true, e->cfg, &e->period, &e->buffer) ||
+            !play->open(e->cfg.playback_dev, false, e->cfg, &e->period, &e->buffer)) {
+            delete e;
+            return nullptr;
+        }
+    }
+#else
+    if (e->cfg.backend == AUDIO_BACKEND_PULSE)
+        fprintf(stderr, "audio: built without AUDIO_WITH_PULSE, using ALSA\n");
+#endif
+    if (!e->pulse) {
+        AlsaDevice *cap = new AlsaDevice(), *play = new AlsaDevice();
+        e->cap = cap;
+        e->play = play;
+        int cap_period = 0, cap_buffer = 0;
+        if (!cap->open(e->cfg.capture_dev, true, e->cfg, &cap_period, &cap_buffer) ||
+            !play->open(e->cfg.playback_dev, false, e->cfg, &e->period, &e->buffer)) {
+            delete e;
+            return nullptr;
+        }
+        if (cap_period != e->period)
+            fprintf(stderr, "audio: capture period %d frames, playback %d\n", cap_period, e->period);
+    }
+
+    // 入出力スレッドが使うものはここで全部確保しておく
+    uint32_t fifo = (uint32_t)((int64_t)e->cfg.rate * e->cfg.fifo_ms / 1000) * e->cfg.channels;
+    uint32_t min_fifo = (uint32_t)e->period * e->cfg.channels * 2;
+    e->cap_fifo  = new SampleFifo(fifo > min_fifo ? fifo : min_fifo);
+    e->play_fifo = new SampleFifo(fifo > min_fifo ? fifo : min_fifo);
+    e->cap_buf   = new int16_t[(size_t)e->period * e->cfg.channels];
+    e->play_buf  = new int16_t[(size_t)e->period * e->cfg.channels];
+
+    e->cap_started  = pthread_create(&e->cap_thread, nullptr, AudioEngine::capture_main, e) == 0;
+    e->play_started = pthread_create(&e->play_thread, nullptr, AudioEngine::playback_main, e) == 0;
+    if (!e->cap_started || !e->play_started) {
+        delete e;
+        return nullptr;
+    }
+    fprintf(stderr, "audio: %s, %d Hz x %d, period %d frames, buffer %d frames\n",
+            e->backend_name(), e->cfg.rate, e->cfg.channels, e->period, e->buffer);
+    return e;
+}
+
+AudioEngine::~AudioEngine()
+{
+    stop();
+    if (cap_started)  pthread_join(cap_thread, nullptr);
+    if (play_started) pthread_join(play_thread, nullptr);
+    delete cap;
+    delete play;
+    delete cap_fifo;
+    delete play_fifo;
+    delete[] cap_buf;
+    delete[] play_buf;
+}
+
+void AudioEngine::stop()
+{
+    running.store(false);
+    // 入出力スレッドは長くても 1 period で気づく。アプリの待ちはここで返す
+    if (cap_fifo)  cap_fifo->close();
+    if (play_fifo) play_fifo->close();
+}
+
+int AudioEngine::read(int16_t *dst, int frames, int timeout_ms)
+{
+    uint32_t n = (uint32_t)frames * cfg.channels;
+    if (n > cap_fifo->capacity()) return -1;   // いつまでもそろわない
+    if (!cap_fifo->wait(true, n, mono_us() + (int64_t)timeout_ms * 1000))
+        return cap_fifo->is_closed() ? -1 : 0;
+    cap_fifo->pop(dst, n);
+    return frames;
+}
+
+int AudioEngine::write(const int16_t *src, int frames, int timeout_ms)
+{
+    int64_t  deadline = mono_us() + (int64_t)timeout_ms * 1000;
+    uint32_t n = (uint32_t)frames * cfg.channels, done = 0;
+    uint32_t step = (uint32_t)period * cfg.channels;   // 1 period 空くたびに詰める
+    while (done < n) {
+        if (play_fifo->is_closed()) return -1;
+        done += play_fifo->push(src + done, n - done);
+        if (done == n) break;
+        uint32_t need = n - done < step ? n - done : step;
+        if (!play_fifo->wait(false, need, deadline)) break;
+    }
+    if (play_fifo->is_closed() && done == 0) return -1;
+    return done / cfg.channels;
+}
+
+AudioStats AudioEngine::stats() const
+{
+    AudioStats s;
+    s.capture_xruns    = n_cap_xruns.load(std::memory_order_relaxed);
+    s.playback_xruns   = n_play_xruns.load(std::memory_order_relaxed);
+    s.capture_dropped  = n_cap_dropped.load(std::memory_order_relaxed);
+    s.playback_silence = n_play_silence.load(std::memory_order_relaxed);
+    s.period_frames    = period;
+    s.buffer_frames    = buffer;
+    return s;
+}
+
+const char *AudioEngine::backend_name() const
+{
+    return pulse ? "pulse" : "alsa";
+}
@@ -0,0 +1,85 @@
+// audio_engine.h
+// プロセス内の音声入出力（SoX の rec / play をパイプでつなぐ代わり）
+//   - ALSA（既定）か PulseAudio / PipeWire (pa_simple, -DAUDIO_WITH_PULSE でビルドしたとき)
+//   - 録音と再生それぞれに専用のスレッドを 1 本ずつ回し、デバイスとは period 単位
+//     （既定 5ms）で読み書きする。このスレッドはロックも確保もしない
+//   - アプリとの間は方向ごとのロックなし FIFO。アプリ側は read() / write() で待てる
+//   - 再生の FIFO が空になれば無音を出してデバイスを止めない（数える）
+//   - xrun（録音のオーバーラン / 再生のアンダーラン）はその場で戻して数える
+//   フォーマットは 16 ビット符号付きリトルエンディアン、インターリーブ
+#ifndef AUDIO_ENGINE_H
+#define AUDIO_ENGINE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+#define AUDIO_MIN_PERIOD_MS 5   // これより短い period は起床が増えるだけで、受け付けないデバイスも多い
+
+enum AudioBackend {
+    AUDIO_BACKEND_ALSA,
+    AUDIO_BACKEND_PULSE,   // AUDIO_WITH_PULSE なしでビルドしたときは ALSA に落ちる
+};
+
+struct AudioConfig {
+    AudioBackend backend      = AUDIO_BACKEND_ALSA;
+    const char  *capture_dev  = "default";   // ALSA の PCM 名 / Pulse のソース名（nullptr = 既定）
+    const char  *playback_dev = "default";
+    int rate        = 44100;
+    int channels    = 1;
+    int period_ms   = AUDIO_MIN_PERIOD_MS;   // 1 回の読み書きの長さ
+    int periods     = 3;                     // デバイスのバッファ = period × periods
+    int fifo_ms     = 60;                    // アプリとの間の FIFO（方向ごと）
+    int rt_priority = 20;                    // 入出力スレッドの SCHED_FIFO 優先度（取れなければそのまま）
+};
+
+struct AudioStats {
+    uint64_t capture_xruns;      // デバイスのオーバーラン（読むのが間に合わなかった）
+    uint64_t playback_xruns;     // デバイスのアンダーラン
+    uint64_t capture_dropped;    // アプリが読まずに FIFO があふれて捨てたフレーム
+    uint64_t playback_silence;   // FIFO が空で代わりに出した無音のフレーム
+    int      period_frames;      // デバイスと決まった値
+    int      buffer_frames;
+};
+
+class AudioDevice;
+class SampleFifo;
+
+class AudioEngine {
+public:
+    ~AudioEngine();   // stop() してスレッドを待ち、デバイスを閉じる
+
+    // frames フレームそろうまで待って読む。読んだ数、時間切れなら 0、止まっていれば -1
+    int  read(int16_t *dst, int frames, int timeout_ms);
+    // 入るまで待って書く。書けた数（時間切れならそこまで）、止まっていれば -1
+    int  write(const int16_t *src, int frames, int timeout_ms);
+    // 入出力を止め、待っている read() / write() を返す（どのスレッドからでも）
+    void stop();
+
+    AudioStats  stats() const;
+    const char *backend_name() const;
+    int         rate() const     { return cfg.rate; }
+    int         channels() const { return cfg.channels; }
+
+private:
+    friend AudioEngine *audio_open(const AudioConfig &cfg);
+    AudioEngine() {}
+    static void *capture_main(void *self);
+    static void *playback_main(void *self);
+
+    AudioConfig  cfg;
+    AudioDevice *cap = nullptr, *play = nullptr;
+    SampleFifo  *cap_fifo = nullptr, *play_fifo = nullptr;
+    int16_t     *cap_buf = nullptr, *play_buf = nullptr;   // 1 period 分（入出力スレッド専用）
+    int          period = 0, buffer = 0;
+    bool         pulse = false;
+    pthread_t    cap_thread, play_thread;
+    bool         cap_started = false, play_started = false;
+    std::atomic<bool>     running{true};
+    std::atomic<uint64_t> n_cap_xruns{0}, n_play_xruns{0}, n_cap_dropped{0}, n_play_silence{0};
+};
+
+// 録音と再生のデバイスを開き、入出力スレッドを動かす。開けなければ nullptr
+AudioEngine *audio_open(const AudioConfig &cfg);
+
+#endif
@@ -0,0 +1,254 @@
+// av_mux.cpp
+// チャンクの送り分けと受け分け
+#include "av_mux.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define MUX_CHUNK_MAX 65535   // 長さ欄が 16 ビット
+
+static const uint8_t hello[] = {'A', 'V', 'M', 'X', MUX_VERSION};
+
+AvMux::AvMux(int s, const MuxConfig &c) : sock(s), cfg(c)
+{
+    if (cfg.chunk < 1)             cfg.chunk = 1;
+    if (cfg.chunk > MUX_CHUNK_MAX) cfg.chunk = MUX_CHUNK_MAX;
+    for (int &fd : local) fd = -1;
+    // カーネルの未送信分が大きいと、そこで音声が映像の後ろに並んでしまう
+    if (cfg.notsent_lowat > 0)
+        setsockopt(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &cfg.notsent_lowat, sizeof(cfg.notsent_lowat));
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+AvMux::~AvMux()
+{
+    for (int fd : local)
+        if (fd >= 0) close(fd);
+}
+
+int AvMux::open_channel(MuxChannel ch)
+{
+    if (ch < 0 || ch >= MUX_CHANNELS || local[ch] >= 0) return -1;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) return -1;
+    for (int fd : sv) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &cfg.local_buf, sizeof(cfg.local_buf));
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &cfg.local_buf, sizeof(cfg.local_buf));
+    }
+    // こちら側はノンブロッキング: 読まれないチャネルで run_recv が止まらないように
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL, 0) | O_NONBLOCK);
+    local[ch] = sv[0];
+    return sv[1];
+}
+
+bool AvMux::write_chunk(int ch, const uint8_t *p, int len)
+{
+    uint8_t h[MUX_HEADER_SIZE] = {(uint8_t)ch, 0, (uint8_t)(len >> 8), (uint8_t)len};
+    struct iovec iov[2] = {{h, sizeof(h)}, {(void *)p, (size_t)len}};
+    struct msghdr m;
+    memset(&m, 0, sizeof(m));
+    m.msg_iov    = iov;
+    m.msg_iovlen = 2;
+    while (m.msg_iovlen > 0) {
+        ssize_t r = sendmsg(sock, &m, MSG_NOSIGNAL);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        // 書けたところまで進める
+        while (m.msg_iovlen > 0 && (size_t)r >= m.msg_iov->iov_len) {
+            r -= m.msg_iov->iov_len;
+            m.msg_iov++;
+            m.msg_iovlen--;
+        }
+        if (m.msg_iovlen > 0) {
+            m.msg_iov->iov_base = (char *)m.msg_iov->iov_base + r;
+            m.msg_iov->iov_len -= r;
+        }
+    }
+    tx.chunks[ch]++;
+    tx.bytes[ch] += len;
+    return true;
+}
+
+void AvMux::run_send()
+{
+    std::vector<uint8_t> buf(cfg.chunk);
+    struct pollfd pfd[MUX_CHANNELS];
+    int chan[MUX_CHANNELS], n = 0;
+    for (int ch = 0; ch < MUX_CHANNELS; ch++)   // 優先度の順に並べる
+        if (local[ch] >= 0) {
+            pfd[n].fd     = local[ch];
+            pfd[n].events = POLLIN;
+            chan[n++]     = ch;
+        }
+
+    if (!write_chunk(MUX_CONTROL, hello, sizeof(hello))) n = 0;
+    while (n > 0) {
+        if (poll(pfd, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        // 一番前のチャネルから 1 チャンクだけ出して、また全部を見直す
+        int i = 0;
+        while (i < n && !pfd[i].revents) i++;
+        if (i == n) continue;
+        ssize_t r = recv(pfd[i].fd, buf.data(), buf.size(), MSG_DONTWAIT);
+        if (r == 0) break;   // アプリが閉じた = 通話の終わり
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+            break;
+        }
+        for (int j = i + 1; j < n; j++)
+            if (pfd[j].revents & POLLIN) { tx.preempted++; break; }
+        if (!write_chunk(chan[i], buf.data(), (int)r)) break;
+    }
+    // 相手と自分の run_recv を止める
+    shutdown(sock, SHUT_RDWR);
+}
+
+// アプリ側に渡せなくなったチャネル: 溜めた分は捨て、アプリには終わりとして見せる。
+// 送るほう（アプリ → run_send）はそのまま使える
+void AvMux::close_local(int ch)
+{
+    rx.dropped += pending[ch].size() - pending_off[ch];
+    pending[ch].clear();
+    pending_off[ch] = 0;
+    local_gone[ch]  = true;
+    shutdown(local[ch], SHUT_WR);
+}
+
+// 溜まっている分を書けるだけ書く
+void AvMux::flush(int ch)
+{
+    std::vector<uint8_t> &q = pending[ch];
+    while (pending_off[ch] < q.size()) {
+        ssize_t r = send(local[ch], q.data() + pending_off[ch], q.size() - pending_off[ch], MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) close_local(ch);
+            return;
+        }
+        pending_off[ch] += r;
+    }
+    q.clear();
+    pending_off[ch] = 0;
+}
+
+// 1 チャンクをチャネルへ。書けない分は溜めて、溜まりすぎたらチャネルを閉じる
+void AvMux::deliver(int ch, const uint8_t *p, int len)
+{
+    if (pending_off[ch] == pending[ch].size()) {   // 前の分がなければまず直接書く
+        while (len > 0) {
+            ssize_t r = send(local[ch], p, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                rx.dropped += len;
+                close_local(ch);
+                return;
+            }
+            p   += r;
+            len -= r;
+        }
+        if (len == 0) return;
+    }
+    size_t queued = pending[ch].size() - pending_off[ch] + len;
+    if (queued > (size_t)cfg.local_pending) {
+        fprintf(stderr, "mux: channel %d is not being read (%zu bytes queued), closing it\n", ch, queued);
+        rx.overflowed++;
+        rx.dropped += len;
+        close_local(ch);
+        return;
+    }
+    if (pending_off[ch] > 0) {   // 書けた前の部分を詰める
+        pending[ch].erase(pending[ch].begin(), pending[ch].begin() + pending_off[ch]);
+        pending_off[ch] = 0;
+    }
+    pending[ch].insert(pending[ch].end(), p, p + len);
+    if (queued > rx.max_pending[ch]) rx.max_pending[ch] = queued;
+}
+
+bool AvMux::run_recv()
+{
+    // 受けたバイト列からチャンクを切り出す。読み残しを前に詰めても最大のチャンクが 1 つ入る大きさ
+    std::vector<uint8_t> in(2 * (MUX_HEADER_SIZE + MUX_CHUNK_MAX));
+    size_t have = 0;
+    bool greeted = false, ok = true, done = false;
+    struct pollfd pfd[1 + MUX_CHANNELS];
+    int chan[1 + MUX_CHANNELS];
+    while (!done) {
+        // TCP と、溜まりのあるチャネルが書けるようになるのを待つ
+        int n = 0;
+        pfd[n].fd     = sock;
+        pfd[n].events = POLLIN;
+        n++;
+        for (int ch = 0; ch < MUX_CHANNELS; ch++)
+            if (local[ch] >= 0 && !local_gone[ch] && pending_off[ch] < pending[ch].size()) {
+                pfd[n].fd     = local[ch];
+                pfd[n].events = POLLOUT;
+                chan[n++]     = ch;
+            }
+        if (poll(pfd, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 1; i < n; i++)
+            if (pfd[i].revents) flush(chan[i]);
+        if (!pfd[0].revents) continue;
+
+        ssize_t r = recv(sock, in.data() + have, in.size() - have, MSG_DONTWAIT);
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+            break;
+        }
+        if (r == 0) break;
+        have += r;
+
+        size_t off = 0;
+        while (have - off >= MUX_HEADER_SIZE) {
+            const uint8_t *h = in.data() + off;
+            int ch = h[0], len = h[2] << 8 | h[3];
+            if (have - off < (size_t)(MUX_HEADER_SIZE + len)) break;
+            const uint8_t *body = h + MUX_HEADER_SIZE;
+            off += MUX_HEADER_SIZE + len;
+            if (!greeted) {
+                // 多重化を知らない相手（音声だけの TCP）なら最初のチャンクで分かる
+                if (ch != MUX_CONTROL || len < (int)sizeof(hello) || memcmp(body, hello, 4) != 0) {
+                    fprintf(stderr, "mux: peer did not greet (not a multiplexed session?)\n");
+                    ok   = false;
+                    done = true;
+                    break;
+                }
+                if (body[4] != MUX_VERSION) fprintf(stderr, "mux: peer speaks version %d, we speak %d\n", body[4], MUX_VERSION);
+                greeted = true;
+                continue;
+            }
+            if (ch == MUX_CONTROL) continue;
+            // 知らないチャネル（新しい相手）と、閉じたチャネルの分は捨てる
+            if (ch >= MUX_CHANNELS || local[ch] < 0 || local_gone[ch]) {
+                rx.dropped += len;
+                continue;
+            }
+            rx.chunks[ch]++;
+            rx.bytes[ch] += len;
+            deliver(ch, body, len);
+        }
+        memmove(in.data(), in.data() + off, have - off);
+        have -= off;
+    }
+    // 相手がいなくなった: アプリの読み書きと run_send を止める
+    shutdown(sock, SHUT_RDWR);
+    for (int fd : local)
+        if (fd >= 0) shutdown(fd, SHUT_RDWR);
+    return ok;
+}
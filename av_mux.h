@@ -0,0 +1,82 @@
+// av_mux.h
+// 音声・映像・制御・フィードバックを 1 本の TCP 接続に多重化する
+//   送る単位は [チャネル 1][予約 1][長さ (ネットワークバイト順) 2][本体] のチャンク。
+//   本体は MuxConfig::chunk バイトまでなので、大きなキーフレームも細切れになって流れる
+//   送信: チャネルごとの待ちから、番号の小さいチャネルを先に 1 チャンクずつ出す（厳密な優先度）。
+//         映像を送っている途中でも、音声が来れば次のチャンクは音声になる。
+//         音声が待つのは書きかけの映像 1 チャンクと、カーネルの未送信分（TCP_NOTSENT_LOWAT で小さく保つ）
+//   アプリ側には open_channel() が返すローカルソケット（socketpair）として見せる。
+//   チャネルの中身はただのバイト列なので、今までの [長さ][本体] の読み書きがそのまま使える
+//   最初に制御チャネルで挨拶 ("AVMX" + 版) を交わし、相手が多重化に対応しているか確かめる
+//   受信: ローカルソケットのこちら側はノンブロッキング。アプリが読まずに詰まったチャネルの分は
+//         チャネルごとに溜めて、書けるようになったら書く（映像が詰まっても音声とフィードバックは流れる）。
+//         溜まりが local_pending を超えたチャネルは閉じる（中身はアプリの [長さ][本体] なので、
+//         途中だけ捨てると読み手が同期を失う）
+//   run_send() / run_recv() はそれぞれ専用のスレッドで回す。どちらかが終わればもう片方も終わる
+#ifndef AV_MUX_H
+#define AV_MUX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define MUX_HEADER_SIZE 4
+#define MUX_VERSION     1
+
+enum MuxChannel {   // 番号の小さいほうが先
+    MUX_CONTROL,    // 多重化そのものの挨拶
+    MUX_AUDIO,
+    MUX_FEEDBACK,   // 受信側から相手の送信側への報告（キーフレーム要求など）。映像の待ちを追い越す
+    MUX_VIDEO,
+    MUX_CHANNELS
+};
+
+struct MuxConfig {
+    int chunk         = 1024;       // 1 チャンクの本体の上限（音声が待つ最大量）
+    int notsent_lowat = 16 * 1024;  // カーネルに溜める未送信バイトの上限
+    int local_buf     = 1 << 20;    // ローカルソケットのバッファ
+    int local_pending = 4 << 20;    // 受信: アプリが読まないチャネルに溜めてよいバイト（超えたら閉じる）
+};
+
+struct MuxStats {
+    uint64_t chunks[MUX_CHANNELS] = {};
+    uint64_t bytes[MUX_CHANNELS]  = {};
+    uint64_t preempted = 0;   // 送信: 後ろのチャネルに待ちがあるのに先に出した回数
+    uint64_t dropped   = 0;   // 受信: 受け手のいない / 閉じたチャネルに届いたバイト
+    uint64_t overflowed = 0;  // 受信: 読まれずに溜まりすぎて閉じたチャネルの数
+    uint64_t max_pending[MUX_CHANNELS] = {};   // 受信: チャネルごとに溜まった最大バイト
+};
+
+class AvMux {
+public:
+    explicit AvMux(int sock, const MuxConfig &cfg = MuxConfig());
+    ~AvMux();   // ローカルソケットのこちら側を閉じる（TCP とアプリ側はそれぞれの持ち主が閉じる）
+
+    // チャネルを使う。アプリが読み書きするソケットを返す（失敗は -1）。run_* の前に呼ぶこと
+    int  open_channel(MuxChannel ch);
+
+    // アプリが書いたものをチャンクにして送る。アプリがソケットを閉じるか、送れなくなるまで返らない
+    void run_send();
+    // 届いたチャンクをチャネルのソケットへ。相手が切るまで返らない。挨拶が違えば false
+    bool run_recv();
+
+    // それぞれのスレッドが終わってから読む
+    const MuxStats &tx_stats() const { return tx; }
+    const MuxStats &rx_stats() const { return rx; }
+
+private:
+    bool write_chunk(int ch, const uint8_t *p, int len);
+    void deliver(int ch, const uint8_t *p, int len);
+    void flush(int ch);
+    void close_local(int ch);
+
+    int       sock;
+    MuxConfig cfg;
+    int       local[MUX_CHANNELS];   // こちら側の端（-1 = 使わない）
+    bool      local_gone[MUX_CHANNELS] = {};           // 受信: 書けなくなった / 閉じた
+    std::vector<uint8_t> pending[MUX_CHANNELS];        // 受信: アプリへまだ書けていない分
+    size_t    pending_off[MUX_CHANNELS] = {};          // pending の書けたところ
+    MuxStats  tx, rx;
+};
+
+#endif
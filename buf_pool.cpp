@@ -0,0 +1,123 @@
+// buf_pool.cpp
+// スラブと空きリスト
+#include "buf_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+// 音声パケット (20ms = 1764 バイト) / 小さな JPEG / 640x360 の JPEG / MJPEG カメラの大きなフレーム
+static const BufPoolClass default_classes[] = {
+    {2 * 1024,   256},
+    {32 * 1024,  64},
+    {128 * 1024, 48},
+    {512 * 1024, 8},
+};
+
+PoolBuf &PoolBuf::operator=(PoolBuf &&o) noexcept
+{
+    if (this != &o) {
+        reset();
+        h = o.h;
+        o.h = nullptr;
+    }
+    return *this;
+}
+
+void PoolBuf::reset()
+{
+    if (!h) return;
+    if (h->pool) {
+        h->pool->push(h);
+    } else {
+        h->~BufHeader();
+        free(h);
+    }
+    h = nullptr;
+}
+
+BufPool::BufPool(const BufPoolClass *classes, int n)
+{
+    if (!classes || n <= 0) {
+        classes = default_classes;
+        n = sizeof(default_classes) / sizeof(default_classes[0]);
+    }
+    for (int k = 0; k < n && n_cls < MAX_CLASSES; k++) {
+        Class &c = cls[n_cls];
+        c.size   = classes[k].size;
+        c.count  = classes[k].count;
+        c.stride = sizeof(BufHeader) + (((size_t)c.size + 63) & ~(size_t)63);
+        c.mem    = (char *)aligned_alloc(64, (size_t)c.stride * c.count);
+        if (!c.mem) continue;
+        memset(c.mem, 0, (size_t)c.stride * c.count);   // 通話中にページフォルトを起こさない
+        for (uint32_t i = 0; i < c.count; i++) {
+            BufHeader *h = new (block(c, i)) BufHeader();
+            h->pool = this;
+            h->cls  = n_cls;
+            h->idx  = i;
+            h->cap  = c.size;
+            h->next.store(i + 1 < c.count ? i + 2 : 0, std::memory_order_relaxed);
+        }
+        c.top.store(c.count ? 1 : 0, std::memory_order_relaxed);
+        n_cls++;
+    }
+}
+
+BufPool::~BufPool()
+{
+    for (int k = 0; k < n_cls; k++) free(cls[k].mem);
+}
+
+BufHeader *BufPool::pop(Class &c)
+{
+    uint64_t old = c.top.load(std::memory_order_acquire);
+    for (;;) {
+        uint32_t i1 = (uint32_t)old;
+        if (!i1) return nullptr;
+        BufHeader *h = block(c, i1 - 1);
+        // 世代を進めるので、読んだ next が古くても（ABA）CAS が失敗する
+        uint64_t nw = ((old >> 32) + 1) << 32 | h->next.load(std::memory_order_relaxed);
+        if (c.top.compare_exchange_weak(old, nw, std::memory_order_acq_rel, std::memory_order_acquire))
+            return h;
+    }
+}
+
+void BufPool::push(BufHeader *h)
+{
+    Class &c = cls[h->cls];
+    uint64_t old = c.top.load(std::memory_order_relaxed);
+    for (;;) {
+        h->next.store((uint32_t)old, std::memory_order_relaxed);
+        uint64_t nw = ((old >> 32) + 1) << 32 | (h->idx + 1);
+        if (c.top.compare_exchange_weak(old, nw, std::memory_order_release, std::memory_order_relaxed))
+            return;
+    }
+}
+
+PoolBuf BufPool::get(uint32_t size)
+{
+    n_gets.fetch_add(1, std::memory_order_relaxed);
+    PoolBuf b;
+    // 一番大きいクラスより大きいものは渡さない（長さは相手から届くこともある）
+    if (size > max_size()) {
+        n_rejected.fetch_add(1, std::memory_order_relaxed);
+        return b;
+    }
+    for (int k = 0; k < n_cls && !b.h; k++)
+        if (cls[k].size >= size) b.h = pop(cls[k]);
+    if (!b.h) {
+        n_fallback.fetch_add(1, std::memory_order_relaxed);
+        void *m = aligned_alloc(64, sizeof(BufHeader) + (((size_t)size + 63) & ~(size_t)63));
+        if (!m) return b;
+        b.h = new (m) BufHeader();
+        b.h->pool = nullptr;
+        b.h->cap  = size;
+    }
+    b.h->len = 0;
+    return b;
+}
+
+BufPoolStats BufPool::stats() const
+{
+    return {n_gets.load(std::memory_order_relaxed), n_fallback.load(std::memory_order_relaxed),
+            n_rejected.load(std::memory_order_relaxed)};
+}
@@ -0,0 +1,92 @@
+// buf_pool.h
+// メディア用バッファの大きさ別スラブ（ロックなし）
+//   大きさのクラスごとに同じ大きさのブロックを始めにまとめて確保し、触って（ページを割り当てて）おく。
+//   通話中の取り出し / 返却は空きリスト（番号 + 世代の 64 ビット CAS）だけで、malloc もロックもない
+//   - get(size): size が入る一番小さいクラスから。空いていなければ次のクラス、それもなければ
+//                malloc に落ちる（fallback に数える。遅くはなるが足りなくはならない）。
+//                一番大きいクラスより大きい size は空の PoolBuf を返す（rejected に数える）
+//   - PoolBuf:   ムーブだけできる持ち主。手放すと（デストラクタ / reset）元のクラスへ戻る。
+//                detach() / adopt() で本体のポインタ 1 つにして C の API やリングを通せる
+//   どのスレッドから get / 返却してもよい。プールはすべてのバッファが戻ってから消すこと
+#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+class BufPool;
+
+struct alignas(64) BufHeader {   // 本体の直前に置く（本体も 64 バイト境界）
+    BufPool              *pool;  // nullptr = malloc で取ったもの
+    uint32_t              cls, idx;
+    uint32_t              cap, len;
+    std::atomic<uint32_t> next;  // 空きリストの次（番号 + 1、0 = 終わり）
+};
+
+class PoolBuf {
+public:
+    PoolBuf() = default;
+    PoolBuf(PoolBuf &&o) noexcept : h(o.h) { o.h = nullptr; }
+    PoolBuf &operator=(PoolBuf &&o) noexcept;
+    PoolBuf(const PoolBuf &) = delete;
+    PoolBuf &operator=(const PoolBuf &) = delete;
+    ~PoolBuf() { reset(); }
+
+    void reset();   // 返す
+    explicit operator bool() const { return h != nullptr; }
+
+    char    *data() const     { return (char *)(h + 1); }
+    uint32_t size() const     { return h->len; }
+    uint32_t capacity() const { return h->cap; }
+    void     set_size(uint32_t n) { h->len = n; }
+
+    // 本体のポインタにして手放す / そのポインタから持ち主に戻す
+    char *detach() { char *p = h ? data() : nullptr; h = nullptr; return p; }
+    static PoolBuf adopt(char *p) { PoolBuf b; b.h = p ? (BufHeader *)p - 1 : nullptr; return b; }
+
+private:
+    friend class BufPool;
+    BufHeader *h = nullptr;
+};
+
+struct BufPoolClass {
+    uint32_t size;    // 本体のバイト数
+    uint32_t count;
+};
+
+struct BufPoolStats {
+    uint64_t gets;
+    uint64_t fallback;   // 空きがなく malloc に落ちた
+    uint64_t rejected;   // 大きすぎて渡さなかった
+};
+
+class BufPool {
+public:
+    enum { MAX_CLASSES = 8 };
+    // classes は小さい順。n = 0 なら音声パケットと JPEG フレーム向けの既定
+    explicit BufPool(const BufPoolClass *classes = nullptr, int n = 0);
+    ~BufPool();
+
+    // 中身は未初期化、size() = 0。max_size() を超えるか確保できなければ空
+    PoolBuf get(uint32_t size);
+    uint32_t max_size() const { return n_cls ? cls[n_cls - 1].size : 0; }
+    BufPoolStats stats() const;
+
+private:
+    friend class PoolBuf;
+    struct Class {
+        uint32_t size, count, stride;
+        char    *mem;
+        std::atomic<uint64_t> top{0};   // 上位 32 ビット = 世代、下位 = 番号 + 1
+    };
+    BufHeader *block(const Class &c, uint32_t i) const { return (BufHeader *)(c.mem + (size_t)c.stride * i); }
+    BufHeader *pop(Class &c);
+    void       push(BufHeader *h);
+
+    Class cls[MAX_CLASSES];
+    int   n_cls = 0;
+    std::atomic<uint64_t> n_gets{0}, n_fallback{0}, n_rejected{0};
+};
+
+#endif
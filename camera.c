@@ -1,29 +1,11 @@
 #include <opencv2/opencv.hpp>
 #include <stdio.h>
 #include "image_frame.h"
+#include "frame_pool.h"
 #include <stdlib.h>
 #include <string.h>
 
-// ImageFrame を作成する関数
-ImageFrame create_image_frame(const cv::Mat& frame) {
-    ImageFrame img;
-    img.width = frame.cols;
-    img.height = frame.rows;
-    img.channels = frame.channels();
-
-    size_t size = img.width * img.height * img.channels;
-    img.data = (unsigned char*)malloc(size);
-    memcpy(img.data, frame.data, size);
-
-    return img;
-}
-
-// メモリ解放
-void free_image_frame(ImageFrame* img) {
-    free(img->data);
-    img->data = NULL;
-}
-
+#define FRAME_POOL_SIZE 4 // capture / encoder / preview で同時に持てる枚数
 
 int main() {
     cv::VideoCapture cap(0); // カメラ0番（通常はデフォルトカメラ）
@@ -34,19 +16,38 @@ int main() {
     }
 
     cv::Mat frame;
+    cap >> frame; // 最初の 1 枚でサイズを決める
+    if (frame.empty()) {
+        fprintf(stderr, "Error: フレームが取得できません。\n");
+        return 1;
+    }
+
+    // 解像度からバッファを先に確保しておく（以降は毎フレームの malloc なし）
+    FramePool *pool = frame_pool_create(frame.cols, frame.rows, frame.channels(), FRAME_POOL_SIZE);
+    if (!pool) return 1;
 
     while (true) {
-        cap >> frame; // フレームを取得
-        if (frame.empty()) break;
+        ImageFrame *img = frame_pool_acquire(pool);
+        if (!img) { // 下流がまだ全部持っている → このフレームは捨てる
+            cap.grab();
+            continue;
+        }
+
+        // プールのバッファを Mat として包み、OpenCV に直接書き込ませる（memcpy なし）
+        cv::Mat dst(img->height, img->width, frame.type(), img->data, img->stride);
+        cap >> dst; // フレームを取得
+        if (dst.empty() || dst.data != img->data) { // サイズ変更などで別バッファになった
+            image_frame_unref(img);
+            break;
+        }
 
         // 映像を表示
-        //cv::imshow("Camera", frame);
-        // ImageFrame に変換（他モジュール用）
-        ImageFrame img = create_image_frame(frame);
+        //cv::imshow("Camera", dst);
 
-        //ここでBさん or Cさんの関数に img を渡す（例：encode_frame(&img) など）
+        //ここでBさん or Cさんの関数に img を渡す（例：encode_frame(image_frame_ref(img)) など）
+        //受け取った側は使い終わったら image_frame_unref() する
 
-        free_image_frame(&img); // 毎フレーム後に忘れず解放！
+        image_frame_unref(img); // 自分の参照を返す。最後の参照でプールに戻る
 
         if (cv::waitKey(1) == 'q') break;
    
@@ -54,5 +55,6 @@ int main() {
 
     cap.release();
     cv::destroyAllWindows();
+    frame_pool_destroy(pool);
     return 0;
 }
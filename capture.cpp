@@ -0,0 +1,250 @@
+// capture.cpp
+// V4L2 mmap キャプチャと OpenCV フォールバックの実装
+#include "capture.h"
+
+#include <opencv2/opencv.hpp>
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define V4L2_NUM_BUFS 4   // ドライバに渡すバッファ数
+
+static int xioctl(int fd, unsigned long req, void *arg) {
+    int r;
+    do { r = ioctl(fd, req, arg); } while (r < 0 && errno == EINTR);
+    return r;
+}
+
+static uint32_t to_fourcc(CapturePixFmt fmt) {
+    switch (fmt) {
+    case CAP_FMT_YUYV:  return V4L2_PIX_FMT_YUYV;
+    case CAP_FMT_NV12:  return V4L2_PIX_FMT_NV12;
+    case CAP_FMT_MJPEG: return V4L2_PIX_FMT_MJPEG;
+    default:            return 0;   // BGR24 はカメラから直接は取らない
+    }
+}
+
+const char *capture_fmt_name(CapturePixFmt fmt) {
+    switch (fmt) {
+    case CAP_FMT_BGR24: return "BGR24";
+    case CAP_FMT_YUYV:  return "YUYV";
+    case CAP_FMT_NV12:  return "NV12";
+    case CAP_FMT_MJPEG: return "MJPEG";
+    }
+    return "?";
+}
+
+void capture_planes(const CaptureFrame &f, const uint8_t *data[4], int stride[4]) {
+    for (int i = 0; i < 4; i++) { data[i] = nullptr; stride[i] = 0; }
+    data[0]   = f.data;
+    stride[0] = f.stride;
+    if (f.fmt == CAP_FMT_NV12) {   // UV 平面は Y 平面の直後に続く
+        data[1]   = f.data + (size_t)f.stride * f.height;
+        stride[1] = f.stride;
+    }
+}
+
+// ──────────────────────────────────────────────────
+//   V4L2 (mmap, ゼロコピー)
+// ──────────────────────────────────────────────────
+class V4l2Capture : public CaptureSource {
+    int fd = -1;
+    int w = 0, h = 0, stride = 0;
+    CapturePixFmt fmt = CAP_FMT_YUYV;
+    void  *maps[V4L2_NUM_BUFS] = {};
+    size_t lens[V4L2_NUM_BUFS] = {};
+    int    n_bufs = 0;
+    bool   streaming = false;
+
+public:
+    ~V4l2Capture() override {
+        if (streaming) {
+            int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            xioctl(fd, VIDIOC_STREAMOFF, &type);
+        }
+        for (int i = 0; i < n_bufs; i++)
+            if (maps[i] != MAP_FAILED && maps[i]) munmap(maps[i], lens[i]);
+        if (fd >= 0) close(fd);
+    }
+
+    bool open_dev(int dev, int req_w, int req_h, int fps,
+                  const CapturePixFmt *prefer, int n_prefer) {
+        char path[32];
+        snprintf(path, sizeof(path), "/dev/video%d", dev);
+        fd = open(path, O_RDWR | O_NONBLOCK);
+        if (fd < 0) return false;
+
+        struct v4l2_capability cap;
+        memset(&cap, 0, sizeof(cap));
+        if (xioctl(fd, VIDIOC_QUERYCAP, &cap) < 0) return false;
+        if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+            !(cap.capabilities & V4L2_CAP_STREAMING)) return false;
+
+        // 希望順にフォーマットを試す（ドライバが別の形式を返したら次へ）
+        bool ok = false;
+        struct v4l2_format f;
+        for (int i = 0; i < n_prefer && !ok; i++) {
+            uint32_t fourcc = to_fourcc(prefer[i]);
+            if (!fourcc) continue;
+            memset(&f, 0, sizeof(f));
+            f.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            f.fmt.pix.width       = req_w;
+            f.fmt.pix.height      = req_h;
+            f.fmt.pix.pixelformat = fourcc;
+            f.fmt.pix.field       = V4L2_FIELD_NONE;
+            if (xioctl(fd, VIDIOC_S_FMT, &f) == 0 && f.fmt.pix.pixelformat == fourcc) {
+                fmt = prefer[i];
+                ok = true;
+            }
+        }
+        if (!ok) return false;
+        w = f.fmt.pix.width;
+        h = f.fmt.pix.height;
+        stride = (fmt == CAP_FMT_MJPEG) ? 0 : (int)f.fmt.pix.bytesperline;
+
+        // フレームレート（対応していないドライバもあるので失敗は無視）
+        struct v4l2_streamparm parm;
+        memset(&parm, 0, sizeof(parm));
+        parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        parm.parm.capture.timeperframe.numerator   = 1;
+        parm.parm.capture.timeperframe.denominator = fps;
+        xioctl(fd, VIDIOC_S_PARM, &parm);
+
+        struct v4l2_requestbuffers req;
+        memset(&req, 0, sizeof(req));
+        req.count  = V4L2_NUM_BUFS;
+        req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        req.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) return false;
+        if (req.count > V4L2_NUM_BUFS) req.count = V4L2_NUM_BUFS;
+
+        for (uint32_t i = 0; i < req.count; i++) {
+            struct v4l2_buffer b;
+            memset(&b, 0, sizeof(b));
+            b.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            b.memory = V4L2_MEMORY_MMAP;
+            b.index  = i;
+            if (xioctl(fd, VIDIOC_QUERYBUF, &b) < 0) return false;
+            lens[i] = b.length;
+            maps[i] = mmap(NULL, b.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, b.m.offset);
+            n_bufs = i + 1;
+            if (maps[i] == MAP_FAILED) return false;
+            if (xioctl(fd, VIDIOC_QBUF, &b) < 0) return false;
+        }
+
+        int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (xioctl(fd, VIDIOC_STREAMON, &type) < 0) return false;
+        streaming = true;
+        return true;
+    }
+
+    bool grab(CaptureFrame &out) override {
+        struct pollfd p = {fd, POLLIN, 0};
+        for (;;) {
+            int r = poll(&p, 1, 2000);   // 2 秒来なければカメラ停止とみなす
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+
+            struct v4l2_buffer b;
+            memset(&b, 0, sizeof(b));
+            b.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            b.memory = V4L2_MEMORY_MMAP;
+            if (xioctl(fd, VIDIOC_DQBUF, &b) < 0) {
+                if (errno == EAGAIN) continue;
+                return false;
+            }
+            // 壊れたフレームはすぐ返してやり直す
+            if (b.flags & V4L2_BUF_FLAG_ERROR) { xioctl(fd, VIDIOC_QBUF, &b); continue; }
+
+            out.data   = (const uint8_t *)maps[b.index];
+            out.size   = b.bytesused;
+            out.width  = w;
+            out.height = h;
+            out.stride = stride;
+            out.fmt    = fmt;
+            out.index  = b.index;
+            return true;
+        }
+    }
+
+    void release(CaptureFrame &f) override {
+        if (f.index < 0) return;
+        struct v4l2_buffer b;
+        memset(&b, 0, sizeof(b));
+        b.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        b.memory = V4L2_MEMORY_MMAP;
+        b.index  = f.index;
+        xioctl(fd, VIDIOC_QBUF, &b);
+        f.index = -1;
+        f.data  = nullptr;
+    }
+
+    int width() const override { return w; }
+    int height() const override { return h; }
+    CapturePixFmt format() const override { return fmt; }
+};
+
+// ──────────────────────────────────────────────────
+//   OpenCV フォールバック (BGR24)
+// ──────────────────────────────────────────────────
+class CvCapture : public CaptureSource {
+    cv::VideoCapture cap;
+    cv::Mat frame;
+    int w = 0, h = 0;
+
+public:
+    bool open_dev(int dev, int req_w, int req_h) {
+        if (!cap.open(dev)) return false;
+        cap.set(cv::CAP_PROP_FRAME_WIDTH, req_w);
+        cap.set(cv::CAP_PROP_FRAME_HEIGHT, req_h);
+        w = (int)cap.get(cv::CAP_PROP_FRAME_WIDTH);
+        h = (int)cap.get(cv::CAP_PROP_FRAME_HEIGHT);
+        return true;
+    }
+
+    bool grab(CaptureFrame &out) override {
+        cap >> frame;
+        if (frame.empty()) return false;
+        w = frame.cols;
+        h = frame.rows;
+        out.data   = frame.data;
+        out.size   = frame.step * frame.rows;
+        out.width  = w;
+        out.height = h;
+        out.stride = (int)frame.step;
+        out.fmt    = CAP_FMT_BGR24;
+        out.index  = 0;
+        return true;
+    }
+
+    void release(CaptureFrame &f) override { f.index = -1; f.data = nullptr; }
+
+    int width() const override { return w; }
+    int height() const override { return h; }
+    CapturePixFmt format() const override { return CAP_FMT_BGR24; }
+};
+
+CaptureSource *capture_open(int dev, int w, int h, int fps,
+                            const CapturePixFmt *prefer, int n_prefer) {
+    V4l2Capture *v = new V4l2Capture();
+    if (v->open_dev(dev, w, h, fps, prefer, n_prefer)) {
+        fprintf(stderr, "capture: V4L2 mmap %dx%d %s\n", v->width(), v->height(),
+                capture_fmt_name(v->format()));
+        return v;
+    }
+    delete v;
+
+    CvCapture *c = new CvCapture();
+    if (c->open_dev(dev, w, h)) {
+        fprintf(stderr, "capture: OpenCV fallback %dx%d BGR24\n", c->width(), c->height());
+        return c;
+    }
+    delete c;
+    return nullptr;
+}
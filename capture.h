@@ -0,0 +1,53 @@
+// capture.h
+// カメラ入力の共通インターフェース
+//   - V4L2 (mmap) : カーネルのバッファをそのまま渡す（コピーなし）
+//   - OpenCV      : V4L2 が使えないときのフォールバック (BGR24)
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// カメラから受け取るピクセルフォーマット
+enum CapturePixFmt {
+    CAP_FMT_BGR24,   // packed BGR (OpenCV フォールバック)
+    CAP_FMT_YUYV,    // packed YUV 4:2:2
+    CAP_FMT_NV12,    // Y 平面 + UV インターリーブ平面
+    CAP_FMT_MJPEG,   // カメラ内で JPEG 圧縮済み
+};
+
+// 1 フレーム分のビュー。data は release() を呼ぶまで有効
+typedef struct {
+    const uint8_t *data;   // 先頭ピクセルへのポインタ（V4L2 では mmap 領域）
+    size_t         size;   // 有効バイト数 (bytesused)
+    int            width;
+    int            height;
+    int            stride; // 1 行のバイト数 (MJPEG では 0)
+    CapturePixFmt  fmt;
+    int            index;  // 内部バッファ番号（release 用）
+} CaptureFrame;
+
+class CaptureSource {
+public:
+    virtual ~CaptureSource() {}
+    // 次のフレームを待って取得する。失敗したら false
+    virtual bool grab(CaptureFrame &f) = 0;
+    // grab() で得たバッファを返却する
+    virtual void release(CaptureFrame &f) = 0;
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+    virtual CapturePixFmt format() const = 0;
+};
+
+// /dev/video<dev> を開く。prefer の順にフォーマットを試し、
+// V4L2 が使えなければ cv::VideoCapture (BGR24) にフォールバックする。
+// 失敗したら nullptr
+CaptureSource *capture_open(int dev, int w, int h, int fps,
+                            const CapturePixFmt *prefer, int n_prefer);
+
+const char *capture_fmt_name(CapturePixFmt fmt);
+
+// sws_scale などに渡せるよう平面ポインタと stride を埋める（MJPEG 以外）
+void capture_planes(const CaptureFrame &f, const uint8_t *data[4], int stride[4]);
+
+#endif
@@ -0,0 +1,351 @@
+// congestion_control.cpp
+// 到着時刻のフィードバックと遅延ベース / 損失ベースの帯域推定
+#include "congestion_control.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#define RTCP_APP            204
+#define FB_NAME             "ARRV"
+#define FB_HEADER           24
+#define FB_TICK_US          250        // 到着時刻の単位
+#define FB_NOT_RECEIVED     0xFFFF
+
+#define SENT_SLOTS          1024       // 送信時刻を覚えておくパケット数（2 の累乗）
+#define BURST_US            5000       // これ以内に送ったパケットは 1 つの塊として見る
+#define TREND_WINDOW        20
+#define TREND_SMOOTHING     0.9
+#define TREND_GAIN          4.0
+#define OVERUSE_TIME_MS     10.0
+#define THRESHOLD_K_UP      0.0087
+#define THRESHOLD_K_DOWN    0.039
+#define BETA                0.85
+#define ACKED_WINDOW_US     250000
+#define PACKET_BITS         (1200 * 8)
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static void put32(uint8_t *p, uint32_t v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+static uint16_t get16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static uint32_t get32(const uint8_t *p) { return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+bool cc_is_feedback(const uint8_t *pkt, int len)
+{
+    return len >= FB_HEADER && (pkt[0] >> 6) == 2 && pkt[1] == RTCP_APP && memcmp(pkt + 8, FB_NAME, 4) == 0;
+}
+
+// ── 受信側 ──────────────────────────────────────
+
+ArrivalRecorder::ArrivalRecorder()
+    : slots(SLOTS)
+{
+}
+
+void ArrivalRecorder::on_packet(uint16_t seq, int64_t arrival_us)
+{
+    if (!started) {
+        started = true;
+        next = highest = seq;
+    }
+    if ((int16_t)(seq - next) < 0) return;   // 報告済み（遅れて来た / 送り直し）
+    if ((uint16_t)(seq - next) >= SLOTS) {
+        next = highest = seq;                 // 大きく飛んだ: そこから数え直す
+    }
+    if ((int16_t)(seq - highest) > 0) highest = seq;
+    Slot &sl = slot(seq);
+    sl.seq        = seq;
+    sl.arrival_us = arrival_us;
+}
+
+int ArrivalRecorder::write_feedback(uint8_t *buf, uint32_t sender_ssrc, uint32_t media_ssrc)
+{
+    if (!started || (int16_t)(highest - next) < 0) return 0;
+    int count = std::min((int)(uint16_t)(highest - next) + 1, CC_FEEDBACK_MAX_PKTS);
+
+    int64_t ref = -1;
+    for (int i = 0; i < count; i++) {
+        const Slot &sl = slot(next + i);
+        if (sl.seq == (uint16_t)(next + i) && sl.arrival_us >= 0 && (ref < 0 || sl.arrival_us < ref))
+            ref = sl.arrival_us;
+    }
+    uint16_t base = next;
+    next += count;
+    if (ref < 0) return 0;   // 全部落ちた: 損失は RR で伝わる
+    ref /= FB_TICK_US;
+
+    int len = (FB_HEADER + 2 * count + 3) & ~3;
+    buf[0] = 0x80;           // subtype 0
+    buf[1] = RTCP_APP;
+    put16(buf + 2, len / 4 - 1);
+    put32(buf + 4, sender_ssrc);
+    memcpy(buf + 8, FB_NAME, 4);
+    put32(buf + 12, media_ssrc);
+    put16(buf + 16, base);
+    put16(buf + 18, count);
+    put32(buf + 20, (uint32_t)ref);
+    for (int i = 0; i < count; i++) {
+        Slot &sl = slot(base + i);
+        int64_t off = FB_NOT_RECEIVED;
+        if (sl.seq == (uint16_t)(base + i) && sl.arrival_us >= 0)
+            off = std::min<int64_t>(sl.arrival_us / FB_TICK_US - ref, FB_NOT_RECEIVED - 1);
+        sl.arrival_us = -1;
+        put16(buf + FB_HEADER + 2 * i, (uint16_t)off);
+    }
+    if (len > FB_HEADER + 2 * count) put16(buf + FB_HEADER + 2 * count, 0);
+    return len;
+}
+
+// ── 送信側 ──────────────────────────────────────
+
+CongestionController::CongestionController(const CcConfig &c)
+{
+    reset(c);
+}
+
+void CongestionController::reset(const CcConfig &c)
+{
+    std::lock_guard<std::mutex> g(lock);
+    cfg = c;
+    sent.assign(SENT_SLOTS, Sent());
+    last_ref_tick = -1;
+    cur = prev = Group();
+    accumulated = smoothed = 0;
+    first_arrival_us = -1;
+    num_deltas = 0;
+    win_x.assign(TREND_WINDOW, 0);
+    win_y.assign(TREND_WINDOW, 0);
+    win_pos = win_n = 0;
+    trend_ = modified_trend = 0;
+    threshold = 12.5;
+    last_threshold_us = -1;
+    time_over_ms = -1;
+    overuse_count = 0;
+    prev_trend = 0;
+    usage = CC_NORMAL;
+    acked_bps = acked_window_us = -1;
+    acked_bytes = 0;
+    delay_bps = target_bps = cfg.start_bitrate;
+    loss_bps = cfg.max_bitrate;
+    last_rate_us = last_decrease_us = -1;
+    avg_max_kbps = -1;
+    var_max_kbps = 0.4;
+    last_loss_decrease_us = -1;
+}
+
+void CongestionController::on_packet_sent(uint16_t seq, int bytes, int64_t now_us)
+{
+    std::lock_guard<std::mutex> g(lock);
+    Sent &s = sent[seq & (SENT_SLOTS - 1)];
+    s.seq       = seq;
+    s.used      = true;
+    s.ambiguous = false;
+    s.bytes     = bytes;
+    s.send_us   = now_us;
+}
+
+void CongestionController::on_retransmit(uint16_t seq)
+{
+    std::lock_guard<std::mutex> g(lock);
+    Sent &s = sent[seq & (SENT_SLOTS - 1)];
+    if (s.used && s.seq == seq) s.ambiguous = true;
+}
+
+void CongestionController::set_rtt(int ms)
+{
+    std::lock_guard<std::mutex> g(lock);
+    if (ms > 0) rtt_ms = ms;
+}
+
+bool CongestionController::on_feedback(const uint8_t *pkt, int len, int64_t now_us)
+{
+    if (!cc_is_feedback(pkt, len)) return false;
+    uint16_t base  = get16(pkt + 16);
+    int      count = get16(pkt + 18);
+    if (len < FB_HEADER + 2 * count) return false;
+
+    std::lock_guard<std::mutex> g(lock);
+    // 32 ビットの基準時刻を前回に近い方へ広げる（受信側の時計なので送信側とは比べない）
+    uint32_t ref32 = get32(pkt + 20);
+    int64_t  ref   = last_ref_tick < 0 ? ref32 : last_ref_tick + (int32_t)(ref32 - (uint32_t)last_ref_tick);
+    last_ref_tick = ref;
+
+    for (int i = 0; i < count; i++) {
+        uint16_t off = get16(pkt + FB_HEADER + 2 * i);
+        if (off == FB_NOT_RECEIVED) continue;
+        uint16_t seq = base + i;
+        Sent &s = sent[seq & (SENT_SLOTS - 1)];
+        if (!s.used || s.seq != seq) continue;
+        s.used = false;
+        if (!s.ambiguous) on_arrival(s, (ref + off) * FB_TICK_US, now_us);
+    }
+    update_delay_rate(now_us);
+    update_target();
+    return true;
+}
+
+void CongestionController::on_arrival(const Sent &s, int64_t arrival_us, int64_t now_us)
+{
+    // 実際に届いた速さ（到着時刻で 250 ms ごと）
+    if (acked_window_us < 0) acked_window_us = arrival_us;
+    acked_bytes += s.bytes;
+    if (arrival_us - acked_window_us >= ACKED_WINDOW_US) {
+        int64_t sample = acked_bytes * 8 * 1000000 / (arrival_us - acked_window_us);
+        acked_bps = acked_bps < 0 ? sample : (acked_bps + sample) / 2;
+        acked_window_us = arrival_us;
+        acked_bytes     = 0;
+    }
+
+    if (cur.first_send_us < 0) {
+        cur = {s.send_us, s.send_us, arrival_us, s.bytes};
+        return;
+    }
+    if (s.send_us < cur.first_send_us) return;   // 前の塊の追い越し
+    if (s.send_us - cur.first_send_us <= BURST_US) {
+        cur.last_send_us    = std::max(cur.last_send_us, s.send_us);
+        cur.last_arrival_us = std::max(cur.last_arrival_us, arrival_us);
+        cur.bytes          += s.bytes;
+        return;
+    }
+    // 塊が閉じた: 1 つ前の塊との間隔の差が片道遅延の変化
+    if (prev.first_send_us >= 0) {
+        double send_ms    = (cur.last_send_us - prev.last_send_us) / 1000.0;
+        double arrival_ms = (cur.last_arrival_us - prev.last_arrival_us) / 1000.0;
+        update_trend(arrival_ms - send_ms, send_ms, cur.last_arrival_us, now_us);
+    }
+    prev = cur;
+    cur  = {s.send_us, s.send_us, arrival_us, s.bytes};
+}
+
+void CongestionController::update_trend(double delay_delta_ms, double ts_delta_ms, int64_t arrival_us, int64_t now_us)
+{
+    num_deltas = std::min(num_deltas + 1, 1000);
+    accumulated += delay_delta_ms;
+    smoothed = TREND_SMOOTHING * smoothed + (1 - TREND_SMOOTHING) * accumulated;
+    if (first_arrival_us < 0) first_arrival_us = arrival_us;
+
+    win_x[win_pos] = (arrival_us - first_arrival_us) / 1000.0;
+    win_y[win_pos] = smoothed;
+    win_pos = (win_pos + 1) % TREND_WINDOW;
+    if (win_n < TREND_WINDOW) win_n++;
+
+    if (win_n == TREND_WINDOW) {
+        // 最小二乗の傾き
+        double mx = 0, my = 0;
+        for (int i = 0; i < win_n; i++) { mx += win_x[i]; my += win_y[i]; }
+        mx /= win_n;
+        my /= win_n;
+        double num = 0, den = 0;
+        for (int i = 0; i < win_n; i++) {
+            num += (win_x[i] - mx) * (win_y[i] - my);
+            den += (win_x[i] - mx) * (win_x[i] - mx);
+        }
+        if (den != 0) trend_ = num / den;
+    }
+    detect(std::min(num_deltas, 60) * trend_ * TREND_GAIN, ts_delta_ms, now_us);
+}
+
+void CongestionController::detect(double t, double ts_delta_ms, int64_t now_us)
+{
+    modified_trend = t;
+    if (num_deltas < 2) {
+        usage = CC_NORMAL;
+        return;
+    }
+    if (t > threshold) {
+        // 一瞬の山では反応せず、10 ms 以上続いて、まだ伸びているときだけ
+        time_over_ms = time_over_ms < 0 ? ts_delta_ms / 2 : time_over_ms + ts_delta_ms;
+        overuse_count++;
+        if (time_over_ms > OVERUSE_TIME_MS && overuse_count > 1 && t >= prev_trend) {
+            time_over_ms  = 0;
+            overuse_count = 0;
+            usage = CC_OVERUSING;
+        }
+    } else if (t < -threshold) {
+        time_over_ms  = -1;
+        overuse_count = 0;
+        usage = CC_UNDERUSING;
+    } else {
+        time_over_ms  = -1;
+        overuse_count = 0;
+        usage = CC_NORMAL;
+    }
+    prev_trend = t;
+
+    // しきい値は傾きに寄せていく（上げるときはゆっくり）。TCP と並んでも飢えないように
+    if (last_threshold_us < 0) last_threshold_us = now_us;
+    if (fabs(t) <= threshold + 15) {
+        double k  = fabs(t) < threshold ? THRESHOLD_K_DOWN : THRESHOLD_K_UP;
+        double dt = std::min((now_us - last_threshold_us) / 1000.0, 100.0);
+        threshold = std::min(std::max(threshold + k * (fabs(t) - threshold) * dt, 6.0), 600.0);
+    }
+    last_threshold_us = now_us;
+}
+
+void CongestionController::update_delay_rate(int64_t now_us)
+{
+    if (last_rate_us < 0) last_rate_us = now_us;
+    double dt = std::min((now_us - last_rate_us) / 1e6, 1.0);
+    last_rate_us = now_us;
+
+    if (usage == CC_OVERUSING) {
+        // 1 RTT に 1 回だけ下げる（下げた効果が見えるまで待つ）
+        if (last_decrease_us >= 0 && now_us - last_decrease_us < std::max(rtt_ms, 100) * 1000LL) return;
+        last_decrease_us = now_us;
+        int64_t r = acked_bps > 0 ? (int64_t)(BETA * acked_bps) : delay_bps / 2;
+        delay_bps = std::min(r, delay_bps);
+        if (acked_bps > 0) {
+            // 詰まった速さを覚えておき、近くでは慎重に上げる
+            double kbps = acked_bps / 1000.0;
+            avg_max_kbps = avg_max_kbps < 0 ? kbps : 0.95 * avg_max_kbps + 0.05 * kbps;
+            double norm = std::max(avg_max_kbps, 1.0);
+            var_max_kbps = 0.95 * var_max_kbps + 0.05 * (avg_max_kbps - kbps) * (avg_max_kbps - kbps) / norm;
+            var_max_kbps = std::min(std::max(var_max_kbps, 0.4), 2.5);
+        }
+    } else if (usage == CC_NORMAL) {
+        if (acked_bps > 0 && avg_max_kbps >= 0) {
+            double std_kbps = sqrt(var_max_kbps * avg_max_kbps);
+            if (acked_bps / 1000.0 > avg_max_kbps + 3 * std_kbps) avg_max_kbps = -1;   // もう別の経路
+        }
+        if (avg_max_kbps >= 0) {
+            int response_ms = rtt_ms + 100;
+            delay_bps += std::max<int64_t>(1000, (int64_t)(dt * PACKET_BITS * 1000 / response_ms));
+        } else {
+            delay_bps += std::max<int64_t>(1000, (int64_t)(delay_bps * (pow(1.08, dt) - 1)));
+        }
+        // 出ていない（エンコーダが使い切っていない）速さまでは上げない
+        if (acked_bps > 0) delay_bps = std::min(delay_bps, acked_bps * 3 / 2 + 10'000);
+    }
+    // CC_UNDERUSING: 溜まっていたキューが掃けているところなので据え置き
+    delay_bps = std::min(std::max(delay_bps, cfg.min_bitrate), cfg.max_bitrate);
+}
+
+void CongestionController::on_loss_report(double loss, int64_t now_us)
+{
+    std::lock_guard<std::mutex> g(lock);
+    if (loss > 0.10) {
+        if (last_loss_decrease_us < 0 || now_us - last_loss_decrease_us >= (300 + rtt_ms) * 1000LL) {
+            loss_bps = (int64_t)(target_bps * (1 - 0.5 * loss));
+            last_loss_decrease_us = now_us;
+        }
+    } else if (loss < 0.02) {
+        loss_bps = std::min<int64_t>(cfg.max_bitrate, (int64_t)(loss_bps * 1.08) + 1000);
+    }
+    // 2〜10 %: FEC と NACK で吸収できる範囲なので据え置き
+    update_target();
+}
+
+void CongestionController::update_target()
+{
+    target_bps = std::min(std::max(std::min(delay_bps, loss_bps), cfg.min_bitrate), cfg.max_bitrate);
+}
+
+int64_t CongestionController::target_bitrate() const
+{
+    std::lock_guard<std::mutex> g(lock);
+    return target_bps;
+}
+
+CcState CongestionController::state() const
+{
+    std::lock_guard<std::mutex> g(lock);
+    return CcState{target_bps, delay_bps, loss_bps, acked_bps, modified_trend, threshold, usage};
+}
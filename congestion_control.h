@@ -0,0 +1,142 @@
+// congestion_control.h
+// 遅延の傾きによる帯域推定（GCC: draft-ietf-rmcat-gcc と同じ組み立て）
+//   受信側 (ArrivalRecorder): 映像 RTP パケットの到着時刻を番号ごとに記録し、数十 ms ごとに
+//                             まとめて送り手へ返す（RTCP APP "ARRV"）
+//   送信側 (CongestionController):
+//     1. 送った時刻と届いた時刻を突き合わせ、送信間隔 5 ms 以内の塊ごとに遅延の変化を出す
+//     2. トレンドライン: 累積した遅延変化を平滑化し、直近 20 点の回帰の傾きを見る
+//     3. 過負荷検出: 傾きを適応しきい値と比べ、overuse / normal / underuse を決める
+//     4. AIMD: overuse で「実際に届いた速さ × 0.85」に下げ、normal で上げる
+//        （前に詰まった速さから遠ければ 8 %/秒、近ければ 1 パケット/応答時間）
+//     5. 損失: RR の損失率が 10 % を超えたら下げ、2 % 未満なら戻す。遅延側と小さい方を使う
+//   時刻はすべて呼び出し側が渡す（合成トレースで決定的に動かせる）。
+//   送信スレッドと受信スレッドの両方から呼んでよい（内部でロックする）
+#ifndef CONGESTION_CONTROL_H
+#define CONGESTION_CONTROL_H
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+#define CC_FEEDBACK_MAX_PKTS 256   // 1 つのフィードバックで報告する番号の数
+#define CC_FEEDBACK_MAX_SIZE (24 + 2 * CC_FEEDBACK_MAX_PKTS)
+
+// フィードバック（RTCP APP, name = "ARRV"）かどうか
+bool cc_is_feedback(const uint8_t *pkt, int len);
+
+class ArrivalRecorder {
+public:
+    ArrivalRecorder();
+
+    // 映像パケット（メディアのみ）が届いた。arrival_us は受信側の時計ならなんでもよい
+    void on_packet(uint16_t seq, int64_t arrival_us);
+    // 前回の報告より後の番号の到着時刻を buf に書いて長さを返す。報告することがなければ 0。
+    // 報告済みの番号が後から届いても使わない
+    int  write_feedback(uint8_t *buf, uint32_t sender_ssrc, uint32_t media_ssrc);
+
+private:
+    enum { SLOTS = 1024 };   // 2 の累乗
+    struct Slot {
+        uint16_t seq;
+        int64_t  arrival_us = -1;
+    };
+    Slot &slot(uint16_t s) { return slots[s & (SLOTS - 1)]; }
+
+    std::vector<Slot> slots;
+    bool     started = false;
+    uint16_t next = 0;      // まだ報告していない最初の番号
+    uint16_t highest = 0;
+};
+
+struct CcConfig {
+    int64_t start_bitrate = 800'000;     // bps（FEC などを含めた映像全体）
+    int64_t min_bitrate   = 150'000;
+    int64_t max_bitrate   = 2'500'000;
+};
+
+enum CcUsage { CC_NORMAL, CC_OVERUSING, CC_UNDERUSING };
+
+struct CcState {
+    int64_t target_bps;
+    int64_t delay_bps;     // 遅延ベースの値
+    int64_t loss_bps;      // 損失ベースの値
+    int64_t acked_bps;     // 実際に届いた速さ (-1 = まだ分からない)
+    double  trend;         // 補正した傾き
+    double  threshold;     // 適応しきい値
+    CcUsage usage;
+};
+
+class CongestionController {
+public:
+    explicit CongestionController(const CcConfig &cfg = CcConfig());
+
+    // 通話の始まりにやり直す
+    void reset(const CcConfig &cfg);
+
+    // メディアパケットを送った（時刻は送信側の時計, µs）
+    void on_packet_sent(uint16_t seq, int bytes, int64_t now_us);
+    // 送り直した番号の到着時刻は元と区別できないので使わない
+    void on_retransmit(uint16_t seq);
+    // 受信側からのフィードバック。扱ったら true
+    bool on_feedback(const uint8_t *pkt, int len, int64_t now_us);
+    // RR の損失率 (0..1)
+    void on_loss_report(double loss, int64_t now_us);
+    void set_rtt(int rtt_ms);
+
+    int64_t target_bitrate() const;
+    CcState state() const;
+
+private:
+    struct Sent {
+        uint16_t seq;
+        bool     used = false;
+        bool     ambiguous;   // 送り直した
+        int      bytes;
+        int64_t  send_us;
+    };
+    struct Group {            // 送信間隔が短い塊
+        int64_t first_send_us = -1;
+        int64_t last_send_us, last_arrival_us;
+        int     bytes;
+    };
+    void on_arrival(const Sent &s, int64_t arrival_us, int64_t now_us);
+    void update_trend(double delay_delta_ms, double ts_delta_ms, int64_t arrival_us, int64_t now_us);
+    void detect(double trend, double ts_delta_ms, int64_t now_us);
+    void update_delay_rate(int64_t now_us);
+    void update_target();
+
+    mutable std::mutex lock;
+    CcConfig cfg;
+    std::vector<Sent> sent;
+
+    // 塊と遅延の変化
+    int64_t last_ref_tick = -1;
+    Group   cur, prev;
+    // トレンドライン
+    double  accumulated = 0, smoothed = 0;
+    int64_t first_arrival_us = -1;
+    int     num_deltas = 0;
+    std::vector<double> win_x, win_y;   // 直近の (到着時刻 ms, 平滑化した累積遅延)
+    int     win_pos = 0, win_n = 0;
+    double  trend_ = 0;                 // 傾き (ms/ms)
+    double  modified_trend = 0;         // 点数と利得を掛けたもの（しきい値と比べる）
+    // 過負荷検出
+    double  threshold = 12.5;
+    int64_t last_threshold_us = -1;
+    double  time_over_ms = -1;
+    int     overuse_count = 0;
+    double  prev_trend = 0;
+    CcUsage usage = CC_NORMAL;
+    // 届いた速さ
+    int64_t acked_bps = -1;
+    int64_t acked_window_us = -1;
+    int64_t acked_bytes = 0;
+    // AIMD
+    int64_t delay_bps, loss_bps, target_bps;
+    int64_t last_rate_us = -1, last_decrease_us = -1;
+    double  avg_max_kbps = -1, var_max_kbps = 0.4;   // 前に詰まった速さの平均と分散
+    int64_t last_loss_decrease_us = -1;
+    int     rtt_ms = 100;
+};
+
+#endif
@@ -0,0 +1,208 @@
+// encoder_session.cpp
+// libx264 エンコーダセッションの実装
+#include "encoder_session.h"
+#include "yuv_convert.h"
+#include <chrono>
+#include <stdio.h>
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+AVPixelFormat capture_av_fmt(CapturePixFmt f)
+{
+    switch (f) {
+    case CAP_FMT_YUYV: return AV_PIX_FMT_YUYV422;
+    case CAP_FMT_NV12: return AV_PIX_FMT_NV12;
+    default:           return AV_PIX_FMT_BGR24;
+    }
+}
+
+// mmap バッファを包んだ AVBuffer 用。返却は CaptureSource::release で行う
+static void capture_buf_free(void *, uint8_t *) {}
+
+static int64_t now_ms()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+EncoderSession::EncoderSession()
+{
+    frame = av_frame_alloc();
+    pkt   = av_packet_alloc();
+}
+
+EncoderSession::~EncoderSession()
+{
+    close();
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+}
+
+bool EncoderSession::open(const EncoderConfig &c, int w, int h, CapturePixFmt fmt)
+{
+    cfg     = c;
+    src_w   = w;
+    src_h   = h;
+    src_fmt = fmt;
+    t0_ms   = -1;
+    last_pts = -1;
+    return open_codec();
+}
+
+void EncoderSession::close()
+{
+    avcodec_free_context(&ctx);
+    sws_freeContext(sws);
+    sws = nullptr;
+    av_frame_unref(frame);
+    av_packet_unref(pkt);
+}
+
+// コーデック・変換器・フレームを今の cfg で作り直す
+bool EncoderSession::open_codec()
+{
+    avcodec_free_context(&ctx);
+    av_frame_unref(frame);
+
+    const AVCodec *codec = avcodec_find_encoder_by_name("libx264");
+    if (!codec) { fprintf(stderr, "libx264 not found\n"); return false; }
+
+    // カメラが NV12 をそのままの大きさで出しているなら変換せず x264 へ
+    is_native = src_fmt == CAP_FMT_NV12 && src_w == cfg.width && src_h == cfg.height;
+
+    ctx = avcodec_alloc_context3(codec);
+    ctx->width          = cfg.width;
+    ctx->height         = cfg.height;
+    ctx->pix_fmt        = is_native ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P;
+    ctx->time_base      = {1, 1000};          // pts はミリ秒（fps を変えても開き直さない）
+    ctx->framerate      = {cfg.fps, 1};
+    ctx->bit_rate       = cfg.bitrate;
+    ctx->rc_max_rate    = cfg.bitrate;
+    ctx->rc_buffer_size = (int)(cfg.bitrate / 2);
+    // IDR は keyint に従って自前で入れる。intra-refresh では x264 の keyint が塗り直しの周期
+    ctx->gop_size       = cfg.intra_refresh ? cfg.keyint : 1 << 30;
+    ctx->max_b_frames   = 0;                  // 低遅延: B フレームは使わない
+    // 低遅延用オプション
+    av_opt_set(ctx->priv_data, "preset", "ultrafast", 0);
+    // zerolatency は sliced-threads も入れる（1 フレームをスライスに分けて並列に符号化し、
+    // フレーム並列のような遅延を出さない）。NAL は avcodec_receive_packet でフレームごとにまとめて出てくる
+    av_opt_set(ctx->priv_data, "tune",   "zerolatency", 0);
+    av_opt_set(ctx->priv_data, "forced-idr", "1", 0);   // pict_type = I を IDR にする
+    if (cfg.intra_refresh) av_opt_set(ctx->priv_data, "intra-refresh", "1", 0);
+
+    if (avcodec_open2(ctx, codec, nullptr) < 0) {
+        fprintf(stderr, "encoder: failed to open %dx%d\n", cfg.width, cfg.height);
+        avcodec_free_context(&ctx);
+        return false;
+    }
+
+    // カメラ形式 → YUV420P（そのまま使えない形式・大きさのときだけ使う）
+    sws = sws_getCachedContext(sws, src_w, src_h, capture_av_fmt(src_fmt),
+                               cfg.width, cfg.height, AV_PIX_FMT_YUV420P,
+                               SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+
+    frame->format = ctx->pix_fmt;
+    frame->width  = cfg.width;
+    frame->height = cfg.height;
+    if (!is_native && av_frame_get_buffer(frame, 32) < 0) return false;
+
+    since_idr = 0;   // 開き直した最初のフレームは IDR になる
+    fprintf(stderr, "encoder: %dx%d %s, %lld bps, %d fps, %s %d\n",
+            cfg.width, cfg.height, is_native ? "NV12 (camera)" : "YUV420P",
+            (long long)cfg.bitrate, cfg.fps,
+            cfg.intra_refresh ? "intra-refresh every" : "keyint", cfg.keyint);
+    return true;
+}
+
+void EncoderSession::apply_pending()
+{
+    int64_t br = want_bitrate.exchange(0);
+    if (br > 0 && br != cfg.bitrate) {
+        // libx264 ラッパーが次のフレームで値の変化を見て x264_encoder_reconfig する
+        cfg.bitrate         = br;
+        ctx->bit_rate       = br;
+        ctx->rc_max_rate    = br;
+        ctx->rc_buffer_size = (int)(br / 2);
+    }
+    int fps = want_fps.exchange(0);
+    if (fps > 0) cfg.fps = fps;
+    bool reopen = false;
+    int ki = want_keyint.exchange(0);
+    if (ki > 0 && ki != cfg.keyint) {
+        cfg.keyint = ki;
+        reopen = cfg.intra_refresh;   // x264 の keyint は reconfig で変えられない
+    }
+
+    uint64_t sz = want_size.exchange(0);
+    if (sz) {
+        int w = (int)(sz >> 32) & ~1, h = (int)(uint32_t)sz & ~1;   // 4:2:0 なので偶数に
+        if (w > 0 && h > 0 && (w != cfg.width || h != cfg.height)) {
+            cfg.width  = w;
+            cfg.height = h;
+            reopen = true;
+        }
+    }
+    if (reopen) open_codec();
+}
+
+bool EncoderSession::submit(const CaptureFrame &cf)
+{
+    if (ctx) apply_pending();
+    if (cf.width != src_w || cf.height != src_h || cf.fmt != src_fmt) {
+        // カメラ側が変わった（フォールバックでサイズが後から決まった等）
+        src_w = cf.width; src_h = cf.height; src_fmt = cf.fmt;
+        open_codec();
+    }
+    if (!ctx) return false;
+
+    if (is_native) {
+        // NV12 をそのまま渡す。x264 は encode 時に自分の内部バッファへ取り込む。
+        // refcounted にしておかないと avcodec_send_frame が丸ごとコピーする
+        frame->data[0]     = (uint8_t *)cf.data;
+        frame->linesize[0] = cf.stride;
+        frame->data[1]     = (uint8_t *)cf.data + (size_t)cf.stride * cf.height;
+        frame->linesize[1] = cf.stride;
+        frame->buf[0] = av_buffer_create((uint8_t *)cf.data, cf.size,
+                                         capture_buf_free, nullptr, 0);
+    } else {
+        if (av_frame_make_writable(frame) < 0) return false;
+        bool same_size = cf.width == cfg.width && cf.height == cfg.height;
+        if (cf.fmt == CAP_FMT_YUYV && same_size) {
+            yuyv_to_yuv420p(cf.data, cf.stride, cf.width, cf.height, frame->data, frame->linesize);
+        } else if (cf.fmt == CAP_FMT_BGR24 && same_size) {
+            // OpenCV フォールバック: 色変換とクロマ間引きを 1 パスで
+            packed_to_yuv420p(cf.data, cf.stride, cf.width, cf.height, PACKED_BGR,
+                              frame->data, frame->linesize);
+        } else {
+            const uint8_t *src_data[4];
+            int src_stride[4];
+            capture_planes(cf, src_data, src_stride);
+            sws_scale(sws, src_data, src_stride, 0, cf.height, frame->data, frame->linesize);
+        }
+    }
+
+    // pts はミリ秒。同じ値が続かないようにする
+    int64_t t = now_ms();
+    if (t0_ms < 0) t0_ms = t;
+    int64_t pts = t - t0_ms;
+    if (pts <= last_pts) pts = last_pts + 1;
+    frame->pts = last_pts = pts;
+
+    // キーフレーム: 要求があったとき / keyint に達したとき（intra-refresh では要求時だけ）
+    bool idr = want_idr.exchange(false) || (!cfg.intra_refresh && since_idr >= cfg.keyint);
+    frame->pict_type = idr ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    since_idr = idr ? 1 : since_idr + 1;
+
+    int ret = avcodec_send_frame(ctx, frame);
+    if (is_native) av_buffer_unref(&frame->buf[0]);
+    return ret >= 0;
+}
+
+AVPacket *EncoderSession::receive()
+{
+    av_packet_unref(pkt);
+    if (!ctx || avcodec_receive_packet(ctx, pkt) < 0) return nullptr;
+    return pkt;
+}
@@ -0,0 +1,89 @@
+// encoder_session.h
+// H.264 (libx264) エンコーダのセッション
+//   コーデック・変換器・再利用する AVFrame / AVPacket をまとめて持ち、
+//   通話中にビットレート / fps / 解像度 / キーフレーム間隔を変えられるようにする。
+//
+//   set_*() はどのスレッドからでも呼べる。実際の反映は次の submit() の中で行う:
+//     - ビットレート      : x264 の reconfig（開き直さない）
+//     - fps               : pts をミリ秒で打っているので設定値を変えるだけ
+//     - キーフレーム間隔  : 自前で IDR を強制するので設定値を変えるだけ
+//                           （intra_refresh のときはリフレッシュ周期なので開き直す）
+//     - 解像度            : コーデックと変換器だけ作り直す（カメラはそのまま）
+#ifndef ENCODER_SESSION_H
+#define ENCODER_SESSION_H
+
+#include <atomic>
+#include <stdint.h>
+#include "capture.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+// カメラのピクセル形式 → FFmpeg の形式
+AVPixelFormat capture_av_fmt(CapturePixFmt f);
+
+struct EncoderConfig {
+    int     width   = 640;
+    int     height  = 360;
+    int     fps     = 30;
+    int64_t bitrate = 800'000;   // bps
+    int     keyint  = 300;       // IDR 間隔（フレーム数）。intra_refresh のときはリフレッシュ周期
+    // 周期 IDR の代わりに、画面を縦の帯ごとに少しずつイントラで塗り直す（x264 intra-refresh）。
+    // IDR 1 枚分のビットレートの山がなくなる。request_keyframe() では従来どおり IDR を出す
+    bool    intra_refresh = false;
+};
+
+class EncoderSession {
+public:
+    EncoderSession();
+    ~EncoderSession();
+
+    // src_*: カメラが実際に出す大きさと形式
+    bool open(const EncoderConfig &cfg, int src_w, int src_h, CapturePixFmt src_fmt);
+    void close();
+
+    // カメラのフレームを変換してエンコーダへ渡す。
+    // native() のときは cf の画素を直接参照するので、receive() が nullptr を
+    // 返すまで cf を release しないこと
+    bool submit(const CaptureFrame &cf);
+    // 出来上がったパケット（次の receive() まで有効）。なければ nullptr
+    AVPacket *receive();
+
+    // ── 実行中の変更（次の submit() で反映） ──
+    void set_bitrate(int64_t bps)  { want_bitrate.store(bps); }
+    void set_fps(int fps)          { want_fps.store(fps); }
+    void set_resolution(int w, int h) { want_size.store(((uint64_t)w << 32) | (uint32_t)h); }
+    void set_keyint(int frames)    { want_keyint.store(frames); }
+    void request_keyframe()        { want_idr.store(true); }
+
+    // 現在の設定（エンコードスレッドから読む）
+    const EncoderConfig &config() const { return cfg; }
+    bool native() const { return is_native; }   // カメラの NV12 を直接渡している
+
+private:
+    bool open_codec();
+    void apply_pending();
+
+    EncoderConfig   cfg;
+    int             src_w = 0, src_h = 0;
+    CapturePixFmt   src_fmt = CAP_FMT_BGR24;
+    bool            is_native = false;
+
+    AVCodecContext *ctx   = nullptr;
+    SwsContext     *sws   = nullptr;
+    AVFrame        *frame = nullptr;
+    AVPacket       *pkt   = nullptr;
+    int64_t         t0_ms = -1;       // 最初のフレームの時刻（pts の基準）
+    int64_t         last_pts = -1;
+    int             since_idr = 0;
+
+    std::atomic<int64_t>  want_bitrate{0};
+    std::atomic<int>      want_fps{0};
+    std::atomic<uint64_t> want_size{0};
+    std::atomic<int>      want_keyint{0};
+    std::atomic<bool>     want_idr{false};
+};
+
+#endif
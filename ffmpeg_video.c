@@ -6,13 +6,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include "ffmpeg_video.h"
 
 // ──────────────────────────────────────────────────
 //   FFmpegでの映像圧縮
 // ──────────────────────────────────────────────────
-void encode_video_frame(AVCodecContext *codec_ctx, AVFrame *frame, int socket_fd) {
+void encode_video_frame(AVCodecContext *codec_ctx, AVFrame *frame, FramedWriter *out) {
     char err_buf[AV_ERROR_MAX_STRING_SIZE]; // エラー文字列用バッファ
     AVPacket *packet = av_packet_alloc();
     if (!packet) {
@@ -38,10 +42,9 @@ void encode_video_frame(AVCodecContext *codec_ctx, AVFrame *frame, int socket_fd
             break;
         }
 
-        // Send the encoded packet over the socket
-        int size = packet->size;
-        send(socket_fd, &size, sizeof(size), 0);
-        send(socket_fd, packet->data, size, 0);
+        // Send the encoded packet over the socket (length + payload in one sendmsg,
+        // large packets without a copy)
+        framed_writer_send_packet(out, packet);
 
         av_packet_unref(packet);
     }
@@ -52,6 +55,23 @@ void encode_video_frame(AVCodecContext *codec_ctx, AVFrame *frame, int socket_fd
 // ──────────────────────────────────────────────────
 //   FFmpegでの映像デコード
 // ──────────────────────────────────────────────────
+#define IDR_REQUEST_MIN_MS 100   // キーフレームを頼み直すまでの最短（RTT の 2 倍が長ければそちら）
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 頼んだキーフレームが届くまでの目安（要求が届いて IDR が返ってくる 1 往復 + 余裕）
+static int idr_wait_ms(int socket_fd) {
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+    int wait = 0;
+    if (getsockopt(socket_fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == 0) wait = 2 * (int)(ti.tcpi_rtt / 1000);
+    return wait > IDR_REQUEST_MIN_MS ? wait : IDR_REQUEST_MIN_MS;
+}
+
 void decode_video_frame(AVCodecContext *codec_ctx, int socket_fd) {
     char err_buf[AV_ERROR_MAX_STRING_SIZE]; // エラー文字列用バッファ
     AVPacket *packet = av_packet_alloc();
@@ -61,6 +81,9 @@ void decode_video_frame(AVCodecContext *codec_ctx, int socket_fd) {
         return;
     }
 
+    // 頼んだキーフレームが届く（か、届くはずの時間が過ぎる）までは頼み直さない
+    int64_t idr_requested_at = -1;   // -1 = 頼んでいない / もう届いた
+
     int size;
     while (recv(socket_fd, &size, sizeof(size), 0) > 0) {
         packet->size = size;
@@ -72,6 +95,14 @@ void decode_video_frame(AVCodecContext *codec_ctx, int socket_fd) {
             av_strerror(ret, err_buf, sizeof(err_buf)); // エラー文字列を取得
             fprintf(stderr, "Error sending packet to decoder: %s\n", err_buf);
             free(packet->data);
+            // 次の IDR まで待たずに送信側へキーフレームを頼む
+            int64_t now = now_ms();
+            if (idr_requested_at < 0 || now - idr_requested_at >= idr_wait_ms(socket_fd)) {
+                fprintf(stderr, "video: decode error, requesting keyframe\n");
+                int req = VIDEO_CTRL_REQUEST_IDR;
+                send(socket_fd, &req, sizeof(req), 0);
+                idr_requested_at = now;
+            }
             continue;
         }
 
@@ -85,6 +116,8 @@ void decode_video_frame(AVCodecContext *codec_ctx, int socket_fd) {
                 break;
             }
 
+            if (frame->pict_type == AV_PICTURE_TYPE_I) idr_requested_at = -1;   // 頼んだものが届いた
+
             // Display the decoded frame using OpenCV or GTK
             // (This part will depend on your display implementation)
         }
@@ -1,11 +1,23 @@
 #ifndef FFMPEG_VIDEO_H
 #define FFMPEG_VIDEO_H
 
+#ifdef __cplusplus
+extern "C" {   // newcamera.c は OpenCV を使うので g++ でビルドする
+#endif
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
+#include "framed_writer.h"
 
-void encode_video_frame(AVCodecContext *codec_ctx, AVFrame *frame, int socket_fd);
+// 受信側 → 送信側の制御メッセージ（長さ欄に負の値を入れて本体なしで送る）
+#define VIDEO_CTRL_REQUEST_IDR (-1)   // デコードに失敗したのでキーフレームがほしい
+
+// 長さ欄はホストの int（FramedWriter は FW_LEN_HOST_INT で作る）
+void encode_video_frame(AVCodecContext *codec_ctx, AVFrame *frame, FramedWriter *out);
 void decode_video_frame(AVCodecContext *codec_ctx, int socket_fd);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+// frame_mailbox.h
+// デコードスレッド → GTK の 1 枠メールボックス（最新フレーム優先）
+//   publish() は表示されていない古いフレームを捨てて差し替える。
+//   UI 側はフレームクロックのティックごとに take() で最新の 1 枚だけ取る。
+//   g_idle_add をフレームごとに積まないので、UI が詰まっても遅延は 1 vsync 以内。
+#ifndef FRAME_MAILBOX_H
+#define FRAME_MAILBOX_H
+
+#include <atomic>
+#include <stdint.h>
+
+template<typename T>
+class FrameMailbox{
+    std::atomic<T*> slot{nullptr};
+    std::atomic<uint64_t> n_published{0}, n_dropped{0}, n_shown{0};
+    void (*drop_fn)(T*);   // 表示されずに捨てられたフレームの解放
+public:
+    explicit FrameMailbox(void (*drop)(T*)):drop_fn(drop){}
+
+    // デコードスレッドから呼ぶ。所有権はメールボックスへ移る
+    void publish(T* f){
+        n_published.fetch_add(1,std::memory_order_relaxed);
+        T* old=slot.exchange(f,std::memory_order_acq_rel);
+        if(old){ n_dropped.fetch_add(1,std::memory_order_relaxed); drop_fn(old); }
+    }
+    // UI スレッドから呼ぶ。新しいフレームがなければ nullptr。所有権は呼び出し側へ
+    T* take(){
+        T* f=slot.exchange(nullptr,std::memory_order_acq_rel);
+        if(f) n_shown.fetch_add(1,std::memory_order_relaxed);
+        return f;
+    }
+    // 残っているフレームを捨てる（通話終了時）
+    void clear(){
+        T* f=slot.exchange(nullptr,std::memory_order_acq_rel);
+        if(f) drop_fn(f);
+    }
+
+    // 統計
+    uint64_t published() const{return n_published.load(std::memory_order_relaxed);}
+    uint64_t dropped()   const{return n_dropped.load(std::memory_order_relaxed);}  // 表示前に上書きされた数
+    uint64_t shown()     const{return n_shown.load(std::memory_order_relaxed);}
+    void reset_stats(){n_published=0;n_dropped=0;n_shown=0;}
+};
+
+#endif
@@ -0,0 +1,111 @@
+// frame_pool.c
+// ImageFrame プールの実装
+//   バッファは作成時にまとめて確保＆ゼロ埋めしてページフォルトを先に済ませる。
+//   以降の acquire / unref ではメモリ確保をしない。
+#include "frame_pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_ALIGN 64   // SIMD / キャッシュライン境界
+
+struct FramePool {
+    ImageFrame      *frames;     // capacity 個
+    ImageFrame     **free_list;  // 空きフレームのスタック
+    int              n_free;
+    int              capacity;
+    unsigned char   *mem;        // 全バッファをまとめた領域
+    int              destroyed;  // destroy 済み。最後のフレームが戻ったところで解放する
+    pthread_mutex_t  lock;
+};
+
+FramePool *frame_pool_create(int width, int height, int channels, int capacity) {
+    if (width <= 0 || height <= 0 || channels <= 0 || capacity <= 0) return NULL;
+
+    FramePool *pool = (FramePool *)calloc(1, sizeof(FramePool));
+    if (!pool) return NULL;
+
+    int    stride = (width * channels + FRAME_ALIGN - 1) & ~(FRAME_ALIGN - 1);
+    size_t frame_bytes = (size_t)stride * height;
+
+    pool->frames    = (ImageFrame *)calloc(capacity, sizeof(ImageFrame));
+    pool->free_list = (ImageFrame **)calloc(capacity, sizeof(ImageFrame *));
+    if (!pool->frames || !pool->free_list ||
+        posix_memalign((void **)&pool->mem, FRAME_ALIGN, frame_bytes * capacity) != 0) {
+        fprintf(stderr, "frame_pool: allocation failed\n");
+        free(pool->frames);
+        free(pool->free_list);
+        free(pool);
+        return NULL;
+    }
+    memset(pool->mem, 0, frame_bytes * capacity); // 先にページを確定させる
+
+    for (int i = 0; i < capacity; i++) {
+        ImageFrame *f = &pool->frames[i];
+        f->data     = pool->mem + frame_bytes * i;
+        f->width    = width;
+        f->height   = height;
+        f->channels = channels;
+        f->stride   = stride;
+        f->pool     = pool;
+        f->refcount = 0;
+        pool->free_list[i] = f;
+    }
+    pool->n_free   = capacity;
+    pool->capacity = capacity;
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+static void pool_free(FramePool *pool) {
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->mem);
+    free(pool->free_list);
+    free(pool->frames);
+    free(pool);
+}
+
+void frame_pool_destroy(FramePool *pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->destroyed = 1;
+    int idle = pool->n_free == pool->capacity;
+    pthread_mutex_unlock(&pool->lock);
+    // 貸し出し中のフレームがあれば、最後の image_frame_unref が解放する
+    if (idle) pool_free(pool);
+}
+
+ImageFrame *frame_pool_acquire(FramePool *pool) {
+    ImageFrame *f = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->n_free > 0 && !pool->destroyed) f = pool->free_list[--pool->n_free];
+    pthread_mutex_unlock(&pool->lock);
+    if (f) __atomic_store_n(&f->refcount, 1, __ATOMIC_RELAXED);
+    return f;
+}
+
+ImageFrame *image_frame_ref(ImageFrame *img) {
+    __atomic_fetch_add(&img->refcount, 1, __ATOMIC_RELAXED);
+    return img;
+}
+
+void image_frame_unref(ImageFrame *img) {
+    if (!img) return;
+    // 最後の参照を落としたスレッドだけがプールへ戻す
+    if (__atomic_sub_fetch(&img->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+    FramePool *pool = img->pool;
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->free_list[pool->n_free++] = img;
+    int last = pool->destroyed && pool->n_free == pool->capacity;
+    pthread_mutex_unlock(&pool->lock);
+    if (last) pool_free(pool);   // destroy 済みのプールの最後のフレーム
+}
+
+int frame_pool_available(FramePool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    int n = pool->n_free;
+    pthread_mutex_unlock(&pool->lock);
+    return n;
+}
@@ -0,0 +1,33 @@
+// frame_pool.h
+// 固定長の ImageFrame プール（参照カウント付き）
+//   capture → encoder → preview で 1 つのバッファをコピーせずに共有する
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include "image_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// width × height × channels のバッファを capacity 個まとめて確保する
+FramePool  *frame_pool_create(int width, int height, int channels, int capacity);
+// プールを手放す。貸し出し中のフレームが残っていれば、最後の image_frame_unref() まで
+// 解放を待つ（それまでのフレームは使える）。以後 acquire はしないこと（NULL が返る）
+void        frame_pool_destroy(FramePool *pool);
+
+// 空きバッファを 1 つ取り出す（refcount = 1）。空きがなければ NULL
+ImageFrame *frame_pool_acquire(FramePool *pool);
+// 参照を 1 つ増やして同じフレームを返す（別ステージへ渡すとき）
+ImageFrame *image_frame_ref(ImageFrame *img);
+// 参照を 1 つ減らす。0 になったらプールへ戻る
+void        image_frame_unref(ImageFrame *img);
+
+// 統計: 空きバッファ数
+int         frame_pool_available(FramePool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,270 @@
+// framed_writer.c
+// FramedWriter の実装
+//   組み立て中のバッチは 1 つだけ。ゼロコピーで送ったバッチは長さ欄と持ち主を
+//   完了待ちスロットへ移し、エラーキューの通知番号の範囲で完了を数える。
+//   スロットが埋まっているときはコピーで送る（待たない）
+#include "framed_writer.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __cplusplus
+extern "C" {   // g++ でまとめてビルドするとき
+#endif
+#include <libavcodec/avcodec.h>
+#ifdef __cplusplus
+}
+#endif
+
+#define FW_MAX_MSGS   32     // 1 バッチのメッセージ数（iovec はその 2 倍）
+#define FW_MAX_HOLDS  4
+#define FW_ZC_SLOTS   8      // 完了待ちにできるゼロコピーのバッチ数
+#define FW_DRAIN_MS   1000   // destroy で完了を待つ上限
+
+typedef struct {
+    uint32_t  hdr[FW_MAX_MSGS];        // カーネルが読み終えるまで残す長さ欄
+    FwRelease release[FW_MAX_HOLDS];
+    void     *opaque[FW_MAX_HOLDS];
+    int       n_holds;
+    uint32_t  zc_lo, zc_n, zc_done;    // 通知番号 [zc_lo, zc_lo + zc_n) と完了した数
+    int       busy;
+} FwZcSlot;
+
+struct FramedWriter {
+    int          sock;
+    FwLenFormat  fmt;
+    size_t       zc_threshold;
+    int          zc_on;
+    uint32_t     zc_seq;               // 次にゼロコピーで成功した sendmsg の通知番号
+
+    // 組み立て中のバッチ
+    struct iovec iov[FW_MAX_MSGS * 2];
+    uint32_t     hdr[FW_MAX_MSGS];
+    int          n_iov, n_msgs;
+    size_t       bytes;
+    FwRelease    release[FW_MAX_HOLDS];
+    void        *opaque[FW_MAX_HOLDS];
+    int          n_holds;
+
+    FwZcSlot     slots[FW_ZC_SLOTS];
+    FwStats      stats;
+};
+
+FramedWriter *framed_writer_create(int sock, FwLenFormat fmt, size_t zc_threshold) {
+    FramedWriter *w = (FramedWriter *)calloc(1, sizeof(FramedWriter));
+    if (!w) return NULL;
+    w->sock = sock;
+    w->fmt  = fmt;
+    w->zc_threshold = zc_threshold;
+    if (zc_threshold) {
+        int one = 1;
+        w->zc_on = setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+    }
+    return w;
+}
+
+static void release_holds(FwRelease *release, void **opaque, int *n_holds) {
+    for (int i = 0; i < *n_holds; i++) release[i](opaque[i]);
+    *n_holds = 0;
+}
+
+void framed_writer_destroy(FramedWriter *w) {
+    if (!w) return;
+    release_holds(w->release, w->opaque, &w->n_holds);
+
+    // 送りかけのページはカーネルが握っているので、待ちきれなくても解放はできる
+    for (int waited = 0; waited < FW_DRAIN_MS; waited += 10) {
+        int busy = 0;
+        for (int i = 0; i < FW_ZC_SLOTS; i++) busy |= w->slots[i].busy;
+        if (!busy) break;
+        struct pollfd pfd = {w->sock, 0, 0};   // エラーキューに通知が来ると POLLERR
+        poll(&pfd, 1, 10);
+        framed_writer_reap(w);
+    }
+    for (int i = 0; i < FW_ZC_SLOTS; i++) {
+        FwZcSlot *z = &w->slots[i];
+        if (z->busy) release_holds(z->release, z->opaque, &z->n_holds);
+    }
+    free(w);
+}
+
+static int push_msg(FramedWriter *w, uint32_t hdr, const void *data, uint32_t len) {
+    if (w->n_msgs == FW_MAX_MSGS && framed_writer_flush(w) < 0) return -1;
+    uint32_t *h = &w->hdr[w->n_msgs++];
+    *h = hdr;
+    w->iov[w->n_iov].iov_base = h;
+    w->iov[w->n_iov].iov_len  = sizeof(*h);
+    w->n_iov++;
+    if (len) {
+        w->iov[w->n_iov].iov_base = (void *)data;
+        w->iov[w->n_iov].iov_len  = len;
+        w->n_iov++;
+    }
+    w->bytes += sizeof(*h) + len;
+    return 0;
+}
+
+int framed_writer_add(FramedWriter *w, const void *data, uint32_t len) {
+    return push_msg(w, w->fmt == FW_LEN_BE32 ? htonl(len) : len, data, len);
+}
+
+int framed_writer_add_word(FramedWriter *w, uint32_t word) {
+    return push_msg(w, w->fmt == FW_LEN_BE32 ? htonl(word) : word, NULL, 0);
+}
+
+void framed_writer_hold(FramedWriter *w, FwRelease release, void *opaque) {
+    if (w->n_holds == FW_MAX_HOLDS) {
+        // 持ち主を覚えきれない: いま積んでいる分をコピーで送ってしまう
+        framed_writer_flush(w);
+        release(opaque);
+        return;
+    }
+    w->release[w->n_holds] = release;
+    w->opaque[w->n_holds]  = opaque;
+    w->n_holds++;
+}
+
+// ゼロコピーで送れるなら完了待ちスロットを取り、長さ欄をそこへ移す
+static FwZcSlot *claim_slot(FramedWriter *w) {
+    if (!w->zc_on || !w->n_holds || w->bytes < w->zc_threshold) return NULL;
+    framed_writer_reap(w);
+    FwZcSlot *z = NULL;
+    for (int i = 0; i < FW_ZC_SLOTS && !z; i++)
+        if (!w->slots[i].busy) z = &w->slots[i];
+    if (!z) return NULL;
+
+    memcpy(z->hdr, w->hdr, w->n_msgs * sizeof(uint32_t));
+    for (int i = 0; i < w->n_iov; i++) {
+        uint32_t *p = (uint32_t *)w->iov[i].iov_base;
+        if (p >= w->hdr && p < w->hdr + FW_MAX_MSGS) w->iov[i].iov_base = z->hdr + (p - w->hdr);
+    }
+    memcpy(z->release, w->release, w->n_holds * sizeof(FwRelease));
+    memcpy(z->opaque,  w->opaque,  w->n_holds * sizeof(void *));
+    z->n_holds = w->n_holds;
+    w->n_holds = 0;
+    z->zc_lo   = w->zc_seq;
+    z->zc_n    = 0;
+    z->zc_done = 0;
+    return z;
+}
+
+int framed_writer_flush(FramedWriter *w) {
+    FwZcSlot *z = claim_slot(w);
+    int zc_flag = z ? MSG_ZEROCOPY : 0;
+    int rc = 0;
+
+    struct iovec *iov = w->iov;
+    int n = w->n_iov;
+    while (n > 0) {
+        struct msghdr m;
+        memset(&m, 0, sizeof(m));
+        m.msg_iov    = iov;
+        m.msg_iovlen = n;
+        ssize_t r = sendmsg(w->sock, &m, MSG_NOSIGNAL | zc_flag);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ENOBUFS && zc_flag) { zc_flag = 0; continue; }   // optmem 不足: 残りはコピーで
+            rc = -1;
+            break;
+        }
+        w->stats.syscalls++;
+        if (zc_flag) z->zc_n++;
+        // 書けたところまで iovec を進める
+        while (n > 0 && (size_t)r >= iov->iov_len) { r -= iov->iov_len; iov++; n--; }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    if (rc == 0) w->stats.messages += w->n_msgs;
+
+    if (z && z->zc_n) {
+        z->busy = 1;
+        w->zc_seq += z->zc_n;
+        w->stats.zc_batches++;
+    } else if (z) {
+        release_holds(z->release, z->opaque, &z->n_holds);
+    }
+    release_holds(w->release, w->opaque, &w->n_holds);
+    w->n_iov = w->n_msgs = 0;
+    w->bytes = 0;
+    return rc;
+}
+
+int framed_writer_send(FramedWriter *w, const void *data, uint32_t len) {
+    if (framed_writer_add(w, data, len) < 0) return -1;
+    return framed_writer_flush(w);
+}
+
+static void release_packet(void *p) {
+    AVPacket *pkt = (AVPacket *)p;
+    av_packet_free(&pkt);
+}
+
+void framed_writer_hold_packet(FramedWriter *w, AVPacket *ref) {
+    framed_writer_hold(w, release_packet, ref);
+}
+
+int framed_writer_send_packet(FramedWriter *w, const AVPacket *pkt) {
+    // コピーで送るなら flush の間だけ pkt が生きていれば足りる
+    AVPacket *ref = w->zc_on && (size_t)pkt->size >= w->zc_threshold ? av_packet_clone(pkt) : NULL;
+    if (!ref) return framed_writer_send(w, pkt->data, pkt->size);
+    if (framed_writer_add(w, ref->data, ref->size) < 0) {
+        release_packet(ref);
+        return -1;
+    }
+    framed_writer_hold_packet(w, ref);
+    return framed_writer_flush(w);
+}
+
+// 通知番号 [lo, hi] の送信が終わった
+static void complete(FramedWriter *w, uint32_t lo, uint32_t hi, int copied) {
+    if (copied && w->zc_on) {
+        // ループバックや対応していない NIC ではカーネルがコピーしている。ピン留めの分だけ損なのでやめる
+        w->stats.zc_copied++;
+        w->zc_on = 0;
+        fprintf(stderr, "framed_writer: zerocopy fell back to copy, disabled\n");
+    }
+    for (int i = 0; i < FW_ZC_SLOTS; i++) {
+        FwZcSlot *z = &w->slots[i];
+        if (!z->busy) continue;
+        int32_t s = (int32_t)(lo - z->zc_lo);
+        int32_t e = (int32_t)(hi + 1 - z->zc_lo);
+        if (s < 0) s = 0;
+        if (e > (int32_t)z->zc_n) e = (int32_t)z->zc_n;
+        if (e <= s) continue;
+        z->zc_done += e - s;
+        if (z->zc_done >= z->zc_n) {
+            release_holds(z->release, z->opaque, &z->n_holds);
+            z->busy = 0;
+        }
+    }
+}
+
+void framed_writer_reap(FramedWriter *w) {
+    char control[128];
+    for (;;) {
+        struct msghdr m;
+        memset(&m, 0, sizeof(m));
+        m.msg_control    = control;
+        m.msg_controllen = sizeof(control);
+        if (recvmsg(w->sock, &m, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&m); c; c = CMSG_NXTHDR(&m, c)) {
+            if (!((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) ||
+                  (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR))) continue;
+            struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(c);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            complete(w, ee->ee_info, ee->ee_data, ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+        }
+    }
+}
+
+void framed_writer_stats(const FramedWriter *w, FwStats *out) {
+    *out = w->stats;
+}
@@ -0,0 +1,69 @@
+// framed_writer.h
+// [長さ][本体] 形式のメッセージを 1 回の sendmsg でまとめて書く（ブロッキングソケット用）
+//   - add() で積んだ長さ欄と本体を flush() で 1 つの iovec 列にして送る。
+//     1 フレーム分のスライスや、溜まった小さな音声パケットが 1 システムコールになる
+//   - hold() で本体の持ち主を渡したバッチが閾値以上の大きさなら MSG_ZEROCOPY で送り、
+//     カーネルが読み終えた（エラーキューに完了通知が来た）ところで release を呼ぶ。
+//     閾値未満・ゼロコピーが使えないときは普通に送って flush() の中で release する
+//   - FFmpeg のパケットは send_packet() / hold_packet() で送る（参照を持って送り終わりに手放す）
+#ifndef FRAMED_WRITER_H
+#define FRAMED_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    FW_LEN_BE32,      // 長さ欄はネットワークバイト順の 32 ビット
+    FW_LEN_HOST_INT,  // 長さ欄はホストの int そのまま（newcamera / ffmpeg_video の形式）
+} FwLenFormat;
+
+typedef void (*FwRelease)(void *opaque);
+
+struct AVPacket;
+
+typedef struct FramedWriter FramedWriter;
+
+// zc_threshold: この大きさ以上のバッチをゼロコピーで送る（0 = 使わない）
+FramedWriter *framed_writer_create(int sock, FwLenFormat fmt, size_t zc_threshold);
+// 完了待ちのゼロコピー送信を（しばらく）待ってから release して解放する
+void          framed_writer_destroy(FramedWriter *w);
+
+// 長さ欄 + 本体を積む。本体は flush() が返るまで（hold した場合は release まで）有効であること。
+// 積みきれなければ先に flush する。送信に失敗したら -1
+int  framed_writer_add(FramedWriter *w, const void *data, uint32_t len);
+// 本体のない長さ欄だけ（制御メッセージ）を積む
+int  framed_writer_add_word(FramedWriter *w, uint32_t word);
+// いま積んでいる本体の持ち主。送り終えたら release(opaque) が 1 回呼ばれる
+void framed_writer_hold(FramedWriter *w, FwRelease release, void *opaque);
+// 積んだものを書ききる。失敗したら -1（積んだものは捨てて hold は release する）
+int  framed_writer_flush(FramedWriter *w);
+// add + flush
+int  framed_writer_send(FramedWriter *w, const void *data, uint32_t len);
+
+// 本体の参照（av_packet_ref したもの）を持ち主として渡す。送り終えたら av_packet_free する
+void framed_writer_hold_packet(FramedWriter *w, struct AVPacket *ref);
+// パケット 1 つを 1 メッセージで送る。ゼロコピーになる大きさなら参照を取って hold するので、
+// 呼び出し側は返ってすぐ pkt を unref / 再利用してよい
+int  framed_writer_send_packet(FramedWriter *w, const struct AVPacket *pkt);
+
+// ゼロコピー送信の完了通知を読んで、終わったバッチを release する（待たない）
+void framed_writer_reap(FramedWriter *w);
+
+// 統計: sendmsg の回数 / ゼロコピーで送ったバッチ / カーネルがコピーに切り替えたバッチ
+typedef struct {
+    uint64_t syscalls;
+    uint64_t messages;
+    uint64_t zc_batches;
+    uint64_t zc_copied;
+} FwStats;
+void framed_writer_stats(const FramedWriter *w, FwStats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,11 +2,18 @@
 #ifndef IMAGE_FRAME_H
 #define IMAGE_FRAME_H
 
-typedef struct {
+typedef struct FramePool FramePool;
+
+typedef struct ImageFrame {
     unsigned char *data; // RGBデータへのポインタ
     int width;
     int height;
     int channels;
+    int stride;          // 1 行のバイト数（64 バイト境界に揃える）
+    // ── 所有権 ──
+    // pool が NULL でなければプールのバッファ。最後の image_frame_unref() で返却される
+    FramePool *pool;
+    int refcount;        // __atomic_* で操作する
 } ImageFrame;
 
 #endif
@@ -1,9 +1,9 @@
 // audio_video_chat_gui.cpp
 // Bidirectional **audio + webcam video** chat with GTK GUI (ring‑buffer + non‑block I/O 改良版)
 // -----------------------------------------------------------------------------
-// Build (GTK3, pthread, OpenCV, SoX, FFmpeg libjpeg, Linux epoll):
-//   g++ -std=c++17 audio_video_chat_gui.cpp -o av_chat_gui \
-//       $(pkg-config --cflags --libs gtk+-3.0 opencv4) -pthread
+// Build (GTK3, pthread, OpenCV, ALSA, FFmpeg libjpeg, Linux epoll):
+//   g++ -std=c++17 mottowakannai.cpp capture.cpp frame_pool.c video_view.cpp rate_adapter.cpp buf_pool.cpp net_reactor.cpp net_uring.cpp audio_engine.cpp -o av_chat_gui \
+//       $(pkg-config --cflags --libs gtk+-3.0 opencv4 alsa) -pthread
 //
 // 2025‑06‑23  fully‑integrated demo
 
@@ -13,6 +13,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sched.h>
+#include <time.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -24,6 +25,14 @@
 #include <opencv2/opencv.hpp>
 #include <netinet/tcp.h>   // <- add for TCP_NODELAY
 #include <errno.h>         // <- add for errno
+#include "capture.h"
+#include "frame_pool.h"
+#include "video_view.h"
+#include "rate_adapter.h"
+#include "net_reactor.h"
+#include "buf_pool.h"
+#include "ring_buf.h"
+#include "audio_engine.h"
 
 //───────────────────────
 // CONFIGURATION
@@ -31,63 +40,57 @@
 #define VIDEO_W           640
 #define VIDEO_H           360
 #define JPEG_QUALITY      50
+#define JPEG_QUALITY_MIN  15         // 詰まったときに下げる下限
+#define VIDEO_MAX_BPS     8000000    // 640x360 q50 30fps の JPEG がおよそこのくらい
 #define VIDEO_FPS         30
 #define AUDIO_RATE        44100
 #define AUDIO_FMT_BYTES   2          // 16‑bit
 #define AUDIO_CHANNELS    1
 #define AUDIO_PKT_NS      20         // 20ms per packet
 #define AUDIO_PKT_BYTES   (AUDIO_RATE/1000*AUDIO_PKT_NS*AUDIO_FMT_BYTES)
+#define AUDIO_PKT_FRAMES  (AUDIO_PKT_BYTES/AUDIO_FMT_BYTES/AUDIO_CHANNELS)
+// 音声の入出力（プロセス内。AUDIO_BACKEND_PULSE は -DAUDIO_WITH_PULSE -lpulse-simple でビルドしたとき）
+#define AUDIO_IO_BACKEND  AUDIO_BACKEND_ALSA
+#define AUDIO_DEVICE      "default"
+#define AUDIO_PERIOD_MS   5          // デバイスと読み書きする単位
+#define AUDIO_PERIODS     3          // デバイスのバッファ = period × これ
+#define AUDIO_FIFO_MS     (2*AUDIO_PKT_NS)   // 入出力スレッドとの間に溜める上限
+#define AUDIO_IO_PRIO     24         // 入出力スレッドの優先度（音声の他のスレッドより上）
 
 #define VB_SIZE  32     // video ring buffer (must be 2^n)
 #define AB_TX_SIZE 64   // audio TX buffer
 #define AB_RX_SIZE 64   // audio RX jitter buffer
 
+// 送信待ちの上限は数ではなく時間で決める。これより古いものは送らずに捨てる
+#define V_TX_MAX_AGE_MS   200
+#define A_TX_MAX_AGE_MS   100
+// カーネルの未送信分もアプリのキューの外に溜めない（溜まると古いものを捨てられない）
+#define V_NOTSENT_LOWAT   (16 * 1024)
+#define A_NOTSENT_LOWAT   (2 * AUDIO_PKT_BYTES)
+
+#define NET_BACKEND       NET_BACKEND_AUTO   // io_uring が使えなければ epoll
+#define CALL_RECORD_FILE  NULL               // 相手の音声 (raw s16le) を書き出すファイル。NULL で録音しない
+
 static void run_server(const char *port);
 static void run_client(const char *ip,const char *port);
 
-//───────────────────────
-// Generic single‑producer single‑consumer lock‑free ring buffer
-//───────────────────────
-
-template<size_t N>
-class RingBuf{
-    static_assert((N&(N-1))==0,"N must be power of 2");
-    char* buf[N];
-    uint32_t len[N];
-    std::atomic<uint32_t> head{0},tail{0};
-public:
-    bool push(char* p,uint32_t l){
-        uint32_t h=head.load(std::memory_order_relaxed);
-        uint32_t nt=(h+1)&(N-1);
-        if(nt==tail.load(std::memory_order_acquire)) return false; // full
-        buf[h]=p; len[h]=l;
-        head.store(nt,std::memory_order_release);
-        return true;
-    }
-    bool pop(char*& p,uint32_t &l){
-        uint32_t t=tail.load(std::memory_order_relaxed);
-        if(t==head.load(std::memory_order_acquire)) return false; // empty
-        p=buf[t]; l=len[t];
-        tail.store((t+1)&(N-1),std::memory_order_release);
-        return true;
-    }
-    size_t count() const{
-        int32_t h=head.load(std::memory_order_acquire);
-        int32_t t=tail.load(std::memory_order_acquire);
-        return (h - t + N) & (N-1);
-    }
-};
+// 通話中のメディアのバッファはすべてここから取る（malloc しない）
+static BufPool media_pool;
 
 static RingBuf<VB_SIZE>   rb_v_tx;   // encoded JPEG → sender
 static RingBuf<VB_SIZE>   rb_v_rx;   // received JPEG → viewer
 static RingBuf<AB_TX_SIZE> rb_a_tx;  // raw audio pkt → sender
 static RingBuf<AB_RX_SIZE> rb_a_rx;  // received audio pkt (jitter buf)
 
+// ソケットの送受信は reactor の 1 スレッドが受け持つ
+static AudioEngine*  audio=NULL;     // 通話の間だけ開く
+static NetReactor*   net=NULL;       // 生産者が積んだら kick する（受信側のリングは RingBuf::wait で待つ）
+
 //───────────────────────
 // GTK app struct
 //───────────────────────
 struct App{
-    GtkWidget *entry_ip,*entry_port,*radio_server,*label_status,*image_peer;
+    GtkWidget *entry_ip,*entry_port,*radio_server,*label_status,*video_view;
     pthread_t  worker; gboolean running;
 }app={0};
 
@@ -114,100 +117,123 @@ static void set_rt(int prio){
 //───────────────────────
 // VIDEO threads
 //───────────────────────
-static void* thread_v_cap(void*) {
-    set_rt(4);
-    cv::VideoCapture cap(0);
-    if (!cap.isOpened()) return NULL;
-
-    // 解像度を下げる
-    cap.set(cv::CAP_PROP_FRAME_WIDTH, 640);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, 360);
-
-    cv::Mat frame;
-    std::vector<uchar> buf;
-    auto period = std::chrono::milliseconds(1000 / 30); // 約30fps
-
-    while (app.running) {
-        auto t0 = std::chrono::steady_clock::now();
-        cap >> frame;
-        if (frame.empty()) continue;
-
-        // BGRからRGBに変換
-        cv::cvtColor(frame, frame, cv::COLOR_BGR2RGB);
-
-        // JPEG品質を下げる
-        cv::imencode(".jpg", frame, buf, {cv::IMWRITE_JPEG_QUALITY, 50});
-
-        char* p = (char*)malloc(buf.size());
-        memcpy(p, buf.data(), buf.size());
-        if (!rb_v_tx.push(p, buf.size())) free(p); // バッファがいっぱいの場合は破棄
-
-        std::this_thread::sleep_until(t0 + period); // 次のフレームまで待機
-    }
-    return NULL;
+// BGR Mat → プールの BGRx バッファ → ビュー。プールは最初のフレームの大きさで作る
+static void publish_bgr(FramePool*& pool,const cv::Mat& bgr,bool self){
+    if(!pool) pool=frame_pool_create(bgr.cols,bgr.rows,4,4);
+    ImageFrame* f=pool?frame_pool_acquire(pool):NULL; if(!f) return;   // 表示が追いつかなければ捨てる
+    cv::Mat dst(f->height,f->width,CV_8UC4,f->data,f->stride);
+    cv::cvtColor(bgr,dst,cv::COLOR_BGR2BGRA);
+    if(dst.data!=f->data){image_frame_unref(f);return;}               // 途中で解像度が変わった
+    if(self) video_view_publish_self(app.video_view,f); else video_view_publish_peer(app.video_view,f);
 }
+// スレッド終了時: ビューが握っているフレームを手放してからプールを消す (GTK スレッド)
+static gboolean release_pool(gpointer d){video_view_clear(app.video_view); frame_pool_destroy((FramePool*)d); return G_SOURCE_REMOVE;}
 
-static bool send_full(int sock,const char*data,size_t len){
-    size_t sent=0; while(sent<len){ssize_t n=send(sock,data+sent,len-sent,0); if(n<=0){if(errno==EAGAIN||errno==EWOULDBLOCK){std::this_thread::sleep_for(std::chrono::milliseconds(2));continue;} return false;} sent+=n;} return true;}
-
-
-static void* thread_v_tx(void* arg) {
+static void* thread_v_cap(void* arg) {
     int sock = *(int*)arg;
-    set_rt(3);
-
-    // Nagleアルゴリズムを無効化
-    int one = 1;
-    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
-
-    // TCPバッファサイズを縮小
-    int buf_size = 16 * 1024; // 16KB
-    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
-    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+    set_rt(4);
+    // カメラが MJPEG を出せるならその JPEG をそのまま送る（デコード・再圧縮なし）
+    static const CapturePixFmt prefer[] = {CAP_FMT_MJPEG, CAP_FMT_YUYV};
+    CaptureSource* cap = capture_open(0, VIDEO_W, VIDEO_H, VIDEO_FPS, prefer, 2);
+    if (!cap) return NULL;
+
+    // 送信待ち（ソケット + rb_v_tx）が溜まったら JPEG 品質 → 解像度の順に下げ、
+    // それでも遅れるフレームは捨てる。品質はビットレート目標に比例させる
+    RateAdapterConfig rcfg;
+    rcfg.max_bitrate = VIDEO_MAX_BPS;
+    rcfg.min_bitrate = VIDEO_MAX_BPS * JPEG_QUALITY_MIN / JPEG_QUALITY;
+    RateAdapter rate(rcfg);
+    SocketBacklog backlog;
+    size_t avg_jpg = 0;   // 1 フレームの平均サイズ（キューの量の見積もり用）
+
+    CaptureFrame cf;
+    cv::Mat frame, small;
+    std::vector<uchar> buf;
+    FramePool* self_pool=NULL;   // 自分の映像（1/4 サイズ）
+    auto period = std::chrono::milliseconds(1000 / VIDEO_FPS); // 約30fps
 
     while (app.running) {
-        char* p;
-        uint32_t l;
-        if (!rb_v_tx.pop(p, l)) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(2));
-            continue;
+        auto t0 = std::chrono::steady_clock::now();
+        if (!cap->grab(cf)) continue;
+
+        socket_backlog(sock, &backlog);
+        RateDecision rd = rate.update(backlog, (int64_t)(rb_v_tx.count() * avg_jpg));
+        int quality = (int)(JPEG_QUALITY * rd.bitrate / rate.ceiling(rd.level));
+        if (quality < JPEG_QUALITY_MIN) quality = JPEG_QUALITY_MIN;
+        bool reencode = rd.level > 0 || quality < JPEG_QUALITY;
+
+        const uchar* jpg = NULL; size_t jpg_len = 0;
+        if (cf.fmt == CAP_FMT_MJPEG) {
+            cv::Mat raw(1, (int)cf.size, CV_8UC1, (void*)cf.data);
+            if (reencode && !rd.skip) {
+                // 詰まっているときだけ展開して小さく・粗く圧縮し直す
+                frame = cv::imdecode(raw, rd.level >= 2 ? cv::IMREAD_REDUCED_COLOR_2 : cv::IMREAD_COLOR);
+                cv::resize(frame, small, cv::Size(VIDEO_W / 4, VIDEO_H / 4), 0, 0, cv::INTER_NEAREST);
+            } else {
+                jpg = cf.data; jpg_len = cf.size;
+                // 自分の映像は libjpeg の 1/4 縮小デコードで安く作る
+                small = cv::imdecode(raw, cv::IMREAD_REDUCED_COLOR_4);
+            }
+        } else {
+            if (cf.fmt == CAP_FMT_YUYV) {
+                cv::Mat yuyv(cf.height, cf.width, CV_8UC2, (void*)cf.data, cf.stride);
+                cv::cvtColor(yuyv, frame, cv::COLOR_YUV2BGR_YUYV);
+            } else {
+                frame = cv::Mat(cf.height, cf.width, CV_8UC3, (void*)cf.data, cf.stride);
+            }
+            cv::resize(frame, small, cv::Size(VIDEO_W / 4, VIDEO_H / 4), 0, 0, cv::INTER_NEAREST);
         }
-
-        uint32_t ln = htonl(l);
-        if (!send_full(sock, (char*)&ln, 4) || !send_full(sock, p, l)) {
-            free(p);
-            break;
+        if (!small.empty()) publish_bgr(self_pool, small, true);
+
+        if (!jpg && !rd.skip && !frame.empty()) {
+            int w, h;
+            RateAdapter::scaled_size(rd.level, VIDEO_W, VIDEO_H, &w, &h);
+            if (frame.cols != w || frame.rows != h)
+                cv::resize(frame, frame, cv::Size(w, h), 0, 0, cv::INTER_AREA);
+            // imencode は BGR 前提なので色変換はしない
+            cv::imencode(".jpg", frame, buf, {cv::IMWRITE_JPEG_QUALITY, quality});
+            jpg = buf.data(); jpg_len = buf.size();
         }
-        free(p);
-    }
-    return NULL;
-}
 
-static void* thread_v_rx(void*arg){int sock=*(int*)arg; set_rt(2); set_tcp_nodelay(sock);
-    uint32_t need_hdr=4; uint32_t pkt_len=0; std::vector<char> pkt;
-    char hdr_buf[4]; size_t hdr_pos=0;
-    while(app.running){
-        // read header
-        while(need_hdr){ssize_t n=recv(sock,hdr_buf+hdr_pos,need_hdr,0); if(n>0){need_hdr-=n;hdr_pos+=n;} else if(n==0){return NULL;} else if(errno==EAGAIN||errno==EWOULDBLOCK){std::this_thread::sleep_for(std::chrono::milliseconds(2));continue;} else return NULL;}
-        if(need_hdr==0){pkt_len=ntohl(*(uint32_t*)hdr_buf); pkt.resize(pkt_len); size_t pos=0; while(pos<pkt_len){ssize_t n=recv(sock,pkt.data()+pos,pkt_len-pos,0); if(n>0){pos+=n;} else if(n==0){return NULL;} else if(errno==EAGAIN||errno==EWOULDBLOCK){std::this_thread::sleep_for(std::chrono::milliseconds(2));continue;} else return NULL;}
-            char* p=(char*)malloc(pkt_len); memcpy(p,pkt.data(),pkt_len);
-            rb_v_rx.push(p,pkt_len);
-            need_hdr=4; hdr_pos=0;
+        if (jpg && !rd.skip) {
+            avg_jpg = avg_jpg ? (avg_jpg * 7 + jpg_len) / 8 : jpg_len;
+            PoolBuf b = media_pool.get(jpg_len);
+            if (b) {
+                memcpy(b.data(), jpg, jpg_len);   // カメラの mmap / imencode の出力は次のフレームで使い回される
+                b.set_size(jpg_len);
+                // いっぱいなら一番古いフレームを追い出す（JPEG はどのフレームからでも表示できる）
+                if (rb_v_tx.push_evict(std::move(b), mono_us(), true) && net) net->kick();
+            }
         }
+        cap->release(cf);
+
+        std::this_thread::sleep_until(t0 + period); // 次のフレームまで待機
     }
+    fprintf(stderr, "video: %llu frames skipped for backlog\n", (unsigned long long)rate.skipped());
+    delete cap;
+    if (self_pool) g_idle_add(release_pool, self_pool);
     return NULL;
 }
 
-static gboolean gui_set_peer(gpointer data){GdkPixbufLoader*ldr=(GdkPixbufLoader*)data;GdkPixbuf*px=gdk_pixbuf_loader_get_pixbuf(ldr); if(px) gtk_image_set_from_pixbuf(GTK_IMAGE(app.image_peer),px); g_object_unref(ldr); return G_SOURCE_REMOVE;}
-
 static void* thread_v_disp(void*){
     set_rt(1);
+    video_view_reset_stats(app.video_view);
+    FramePool* pool=NULL; cv::Mat bgr; uint64_t n_stale=0;
+    PoolBuf b[VB_SIZE];
     while(app.running){
-        char* p; uint32_t l;
-        if(!rb_v_rx.pop(p,l)){std::this_thread::sleep_for(std::chrono::milliseconds(10));continue;}
-        GdkPixbufLoader*ldr=gdk_pixbuf_loader_new(); gdk_pixbuf_loader_write(ldr,(const guchar*)p,l,NULL); gdk_pixbuf_loader_close(ldr,NULL);
-        g_idle_add(gui_set_peer,ldr);
-        free(p);
+        // 溜まっていれば一番新しいフレームだけ復号する（JPEG はどれも単独で表示できる）
+        size_t n=rb_v_rx.pop_n(b,VB_SIZE);
+        if(!n){rb_v_rx.wait(1,100);continue;}
+        n_stale+=n-1;
+        PoolBuf& last=b[n-1];
+        bgr=cv::imdecode(cv::Mat(1,(int)last.size(),CV_8UC1,last.data()),cv::IMREAD_COLOR);
+        for(size_t i=0;i<n;i++) b[i].reset();
+        if(!bgr.empty()) publish_bgr(pool,bgr,false);
     }
+    uint64_t n_pub,n_shown,n_drop; video_view_peer_stats(app.video_view,&n_pub,&n_shown,&n_drop);
+    fprintf(stderr,"video: decoded %llu, shown %llu, dropped before display %llu (%llu before decode)\n",
+            (unsigned long long)n_pub,(unsigned long long)n_shown,(unsigned long long)n_drop,(unsigned long long)n_stale);
+    if(pool) g_idle_add(release_pool,pool);
     return NULL;
 }
 
@@ -216,62 +242,102 @@ static void* thread_v_disp(void*){
 //───────────────────────
 static void* thread_a_cap(void*){
     set_rt(20);
-    FILE* rec=popen("rec -q -t raw -b 16 -c 1 -e s -r 44100 -","r");
-    if(!rec) return NULL;
-    char* buf=(char*)malloc(AUDIO_PKT_BYTES);
-    while(app.running){
-        size_t n=fread(buf,1,AUDIO_PKT_BYTES,rec);
-        if(n!=AUDIO_PKT_BYTES) break;
-        char* p=(char*)malloc(n); memcpy(p,buf,n);
-        if(!rb_a_tx.push(p,n)) free(p);
-    }
-    free(buf); pclose(rec); return NULL;
-}
-
-static void* thread_a_tx(void*arg){int sock=*(int*)arg; set_rt(18); set_tcp_nodelay(sock);
+    if(!audio) return NULL;
     while(app.running){
-        char* p; uint32_t l;
-        if(!rb_a_tx.pop(p,l)){std::this_thread::sleep_for(std::chrono::milliseconds(2));continue;}
-        if(!send_full(sock,p,l)){free(p);break;} free(p);
+        PoolBuf b=media_pool.get(AUDIO_PKT_BYTES); if(!b) break;   // プールのバッファへ直接読む
+        int n=audio->read((int16_t*)b.data(),AUDIO_PKT_FRAMES,100);
+        if(n<0) break; if(n==0) continue;
+        b.set_size(AUDIO_PKT_BYTES);
+        if(rb_a_tx.push_evict(std::move(b),mono_us(),true) && net) net->kick();
     }
     return NULL;
 }
 
-static void* thread_a_rx(void*arg){int sock=*(int*)arg; set_rt(18); set_tcp_nodelay(sock); char* buf=(char*)malloc(AUDIO_PKT_BYTES);
-    while(app.running){
-        ssize_t n=recv(sock,buf,AUDIO_PKT_BYTES,0);
-        if(n==AUDIO_PKT_BYTES){char* p=(char*)malloc(n); memcpy(p,buf,n); rb_a_rx.push(p,n);} else if(n==0){break;} else if(n<0 && (errno==EAGAIN||errno==EWOULDBLOCK)){std::this_thread::sleep_for(std::chrono::milliseconds(2));continue;} else break;
-    }
-    free(buf); return NULL;
-}
-
 static void* thread_a_play(void*){
     set_rt(22);
-    FILE* play=popen("play -q -t raw -b 16 -c 1 -e s -r 44100 -","w"); if(!play) return NULL;
+    if(!audio) return NULL;
     while(app.running){
-        if(rb_a_rx.count()<3){std::this_thread::sleep_for(std::chrono::milliseconds(AUDIO_PKT_NS));continue;}
-        char* p; uint32_t l; if(rb_a_rx.pop(p,l)){fwrite(p,1,l,play); free(p);} else std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        if(!rb_a_rx.wait(3,100)) continue;
+        // FIFO に入るまで待つ（デバイスの速さで進む）
+        PoolBuf b; if(rb_a_rx.pop(b) && audio->write((const int16_t*)b.data(),b.size()/AUDIO_FMT_BYTES/AUDIO_CHANNELS,100)<0) break;
     }
-    pclose(play); return NULL;
+    return NULL;
+}
+
+//───────────────────────
+// NETWORK (io_uring / epoll reactor)
+//───────────────────────
+// 書けるようになったときに取り出すので、待っている間に古くなったものはここで捨てる
+static bool pop_v_tx(void*,char*& p,uint32_t& l){PoolBuf b; if(!rb_v_tx.pop_fresh(b,mono_us(),V_TX_MAX_AGE_MS*1000)) return false; l=b.size(); p=b.detach(); return true;}
+static bool pop_a_tx(void*,char*& p,uint32_t& l){PoolBuf b; if(!rb_a_tx.pop_fresh(b,mono_us(),A_TX_MAX_AGE_MS*1000)) return false; l=b.size(); p=b.detach(); return true;}
+static void deliver_v_rx(void*,char* p,uint32_t){rb_v_rx.push(PoolBuf::adopt(p));}   // 積めなければ返る
+static void deliver_a_rx(void*,char* p,uint32_t){rb_a_rx.push(PoolBuf::adopt(p));}
+// reactor の受信バッファもプールから取り、送り終わったものはプールへ返す
+static char* net_buf_alloc(void*,uint32_t l){PoolBuf b=media_pool.get(l); if(!b) return NULL; b.set_size(l); return b.detach();}
+static void net_buf_free(void*,char* p){PoolBuf::adopt(p);}
+
+static void* thread_net(void* arg){
+    set_rt(18);   // 音声の送受信も担うので音声と同じ優先度
+    NetReactor* r=(NetReactor*)arg;
+    r->run();
+    fprintf(stderr,"net: reactor finished after %llu wakeups\n",(unsigned long long)r->wakeups());
+    return NULL;
 }
 
 //───────────────────────
 // server / client orchestration
 //───────────────────────
 static void run_common(int sockA,int sockV){
-    pthread_t vcap, vtx, vrx, vdisp, acap, atx, arx, aplay;
+    set_tcp_nodelay(sockA); set_tcp_nodelay(sockV);
+    // 映像は送受信バッファを小さくして古いフレームを溜めない
+    int buf_size = 16 * 1024; // 16KB
+    setsockopt(sockV, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+    setsockopt(sockV, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+    int lowat_v = V_NOTSENT_LOWAT, lowat_a = A_NOTSENT_LOWAT;
+    setsockopt(sockV, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat_v, sizeof(lowat_v));
+    setsockopt(sockA, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat_a, sizeof(lowat_a));
+
+    NetReactor reactor(NET_BACKEND);   // 先に登録した音声を優先して送る
+    NetConnSpec a={sockA, NET_FIXED,        AUDIO_PKT_BYTES, pop_a_tx, NULL, deliver_a_rx, NULL};
+    NetConnSpec v={sockV, NET_LEN_PREFIXED, 0,               pop_v_tx, NULL, deliver_v_rx, NULL};
+    const char* rec=CALL_RECORD_FILE;
+    if(rec && (a.record_fd=open(rec,O_WRONLY|O_CREAT|O_TRUNC|O_APPEND,0644))<0) perror(rec);
+    a.buf_alloc=v.buf_alloc=net_buf_alloc; a.buf_free=v.buf_free=net_buf_free;
+    v.max_len=media_pool.max_size();   // プールに入らない長さは相手の誤り
+    reactor.add(a); reactor.add(v);
+    net=&reactor;
+    AudioConfig ac; ac.backend=AUDIO_IO_BACKEND; ac.capture_dev=ac.playback_dev=AUDIO_DEVICE;
+    ac.rate=AUDIO_RATE; ac.channels=AUDIO_CHANNELS; ac.period_ms=AUDIO_PERIOD_MS; ac.periods=AUDIO_PERIODS;
+    ac.fifo_ms=AUDIO_FIFO_MS; ac.rt_priority=AUDIO_IO_PRIO;
+    if(!(audio=audio_open(ac))) set_status("no audio device");
+
+    pthread_t vcap, vdisp, acap, aplay, netio;
     app.running=true;
-    pthread_create(&vcap ,NULL,thread_v_cap ,NULL);
-    pthread_create(&vtx  ,NULL,thread_v_tx ,&sockV);
-    pthread_create(&vrx  ,NULL,thread_v_rx ,&sockV);
+    pthread_create(&netio,NULL,thread_net   ,&reactor);
+    pthread_create(&vcap ,NULL,thread_v_cap ,&sockV);
     pthread_create(&vdisp,NULL,thread_v_disp,NULL);
     pthread_create(&acap ,NULL,thread_a_cap ,NULL);
-    pthread_create(&atx  ,NULL,thread_a_tx ,&sockA);
-    pthread_create(&arx  ,NULL,thread_a_rx ,&sockA);
     pthread_create(&aplay,NULL,thread_a_play,NULL);
 
-    pthread_join(vcap ,NULL); pthread_join(vtx ,NULL); pthread_join(vrx ,NULL); pthread_join(vdisp,NULL);
-    pthread_join(acap ,NULL); pthread_join(atx ,NULL); pthread_join(arx ,NULL); pthread_join(aplay,NULL);
+    pthread_join(vcap ,NULL); pthread_join(vdisp,NULL); pthread_join(acap ,NULL); pthread_join(aplay,NULL);
+    reactor.stop(); pthread_join(netio,NULL);
+    net=NULL;
+    fprintf(stderr,"tx: dropped %llu video frames / %llu audio packets as too old or overflowing\n",
+            (unsigned long long)rb_v_tx.dropped(),(unsigned long long)rb_a_tx.dropped());
+    if(audio){
+        AudioStats as=audio->stats();
+        fprintf(stderr,"audio: xruns %llu capture / %llu playback, %llu frames dropped unread, %llu frames of silence\n",
+                (unsigned long long)as.capture_xruns,(unsigned long long)as.playback_xruns,
+                (unsigned long long)as.capture_dropped,(unsigned long long)as.playback_silence);
+        delete audio; audio=NULL;
+    }
+    BufPoolStats ps=media_pool.stats();
+    fprintf(stderr,"pool: %llu buffers, %llu fell back to malloc, %llu too large\n",
+            (unsigned long long)ps.gets,(unsigned long long)ps.fallback,(unsigned long long)ps.rejected);
+    if(a.record_fd>=0){
+        fprintf(stderr,"record: %llu messages not recorded\n",(unsigned long long)reactor.record_dropped());
+        close(a.record_fd);
+    }
 }
 
 static void run_server(const char*port){int p=atoi(port);
@@ -305,7 +371,7 @@ static GtkWidget* build_ui(){
     gtk_grid_attach(GTK_GRID(grid),lbl_port,0,2,1,1); gtk_grid_attach(GTK_GRID(grid),entry_port,1,2,2,1);
     GtkWidget*btn_start=gtk_button_new_with_label("Start"); GtkWidget*btn_stop=gtk_button_new_with_label("Stop"); gtk_grid_attach(GTK_GRID(grid),btn_start,0,3,1,1); gtk_grid_attach(GTK_GRID(grid),btn_stop,1,3,1,1);
     GtkWidget*lbl=gtk_label_new("idle"); app.label_status=lbl; gtk_grid_attach(GTK_GRID(grid),lbl,0,4,3,1);
-    GtkWidget*image_peer=gtk_image_new_from_icon_name("camera-web",GTK_ICON_SIZE_DIALOG); app.image_peer=image_peer; gtk_grid_attach(GTK_GRID(grid),gtk_label_new("Peer video:"),0,5,1,1); gtk_grid_attach(GTK_GRID(grid),image_peer,1,5,2,1);
+    GtkWidget*video=video_view_new(320,180); app.video_view=video; gtk_grid_attach(GTK_GRID(grid),gtk_label_new("Peer video:"),0,5,1,1); gtk_grid_attach(GTK_GRID(grid),video,1,5,2,1);
 
     g_signal_connect(btn_start,"clicked",G_CALLBACK(+[](GtkButton*,gpointer){ if(app.running)return; const char*port=gtk_entry_get_text(GTK_ENTRY(app.entry_port)); if(strlen(port)==0){set_status("port?");return;} app.running=TRUE; pthread_create(&app.worker,NULL,+[](void*)->void*{ gboolean is_srv=gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app.radio_server)); const char*ip=gtk_entry_get_text(GTK_ENTRY(app.entry_ip)); const char*port=gtk_entry_get_text(GTK_ENTRY(app.entry_port)); if(is_srv){run_server(port);} else {run_client(ip,port);} set_status("finished"); app.running=FALSE; return NULL;},NULL); }),NULL);
 
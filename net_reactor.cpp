@@ -0,0 +1,518 @@
+// net_reactor.cpp
+// ソケット送受信ループの実装（epoll / io_uring）
+#include "net_reactor.h"
+#include "net_uring.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define RX_CHUNK (64 * 1024)   // epoll: 長さ欄と小さなメッセージをまとめて読む量
+
+// 送信: 1 回の writev / SENDMSG にまとめるメッセージの数と、それ以上は足さない大きさ
+#define NET_TX_BATCH     16
+#define NET_TX_COALESCE  (64 * 1024)
+
+// io_uring: 受信バッファ（全接続で共有）とリングの大きさ
+#define URING_ENTRIES  64
+#define URING_BGID     0
+#define URING_BUFS     64      // 2 の累乗
+#define URING_BUF_SIZE (16 * 1024)
+
+// io_uring の user_data: 下位 4 ビットが種類、上位が接続番号か録音の枠の番号 (<< 8)
+enum { OP_WAKE = 1, OP_RECV, OP_SEND, OP_WRITE, OP_CANCEL };
+
+EventNotifier::EventNotifier()
+{
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+EventNotifier::~EventNotifier()
+{
+    if (efd >= 0) close(efd);
+}
+
+void EventNotifier::signal()
+{
+    uint64_t one = 1;
+    if (write(efd, &one, sizeof(one)) < 0) { /* カウンタが溢れるほど溜まっていれば十分 */ }
+}
+
+bool EventNotifier::wait(int timeout_ms)
+{
+    struct pollfd pfd = {efd, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0) return false;
+    uint64_t n;
+    return read(efd, &n, sizeof(n)) == sizeof(n);
+}
+
+// 接続ごとの送受信の途中経過
+struct NetConn {
+    NetConnSpec spec;
+    int      idx;
+    bool     open = true;
+
+    // 受信: ヘッダ → 本体 の順に埋める
+    uint8_t  hdr[4];
+    uint32_t hdr_pos = 0;
+    char    *msg = nullptr;     // 組み立て中のメッセージ
+    uint32_t msg_len = 0, msg_pos = 0;
+
+    // 送信: 送りかけのメッセージ（溜まっていれば何通かまとめて 1 回で書く）
+    struct TxMsg {
+        char    *p;
+        uint32_t len;
+        uint32_t hdr;           // 長さ欄（ネットワークバイト順）
+    } tx[NET_TX_BATCH];
+    int      n_tx = 0;
+    size_t   tx_sent = 0;       // tx[0] のうち長さ欄を含めて書けたバイト数
+    struct iovec  tx_iov[NET_TX_BATCH * 2];   // 残りの部分（io_uring では完了までカーネルが参照する）
+    struct msghdr tx_msg;
+    bool     tx_blocked = false;   // epoll: EAGAIN で EPOLLOUT 待ち
+    bool     tx_busy    = false;   // io_uring: SENDMSG が完了待ち
+
+    bool     multishot = true;     // io_uring: 古いカーネルでは 1 回ずつの recv に戻す
+};
+
+// メッセージのバッファ（接続に指定がなければ malloc / free）
+static char *buf_alloc(NetConn *c, uint32_t len)
+{
+    if (c->spec.buf_alloc) return c->spec.buf_alloc(c->spec.buf_ctx, len);
+    return (char *)malloc(len ? len : 1);
+}
+
+static void buf_free(NetConn *c, char *p)
+{
+    if (!p) return;
+    if (c->spec.buf_free) c->spec.buf_free(c->spec.buf_ctx, p);
+    else                  free(p);
+}
+
+NetReactor::NetReactor(NetBackend want)
+{
+    if (want != NET_BACKEND_EPOLL) {
+        ring = new Uring();
+        if (!ring->init(URING_ENTRIES) ||
+            !ring->setup_buffers(URING_BGID, URING_BUFS, URING_BUF_SIZE)) {
+            fprintf(stderr, "net: io_uring unavailable (%s), using epoll\n", strerror(errno));
+            delete ring;
+            ring = nullptr;
+        }
+    }
+    if (!ring) {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event ev = {};
+        ev.events   = EPOLLIN;
+        ev.data.ptr = nullptr;   // nullptr = wake
+        epoll_ctl(epfd, EPOLL_CTL_ADD, wake.fd(), &ev);
+    }
+}
+
+NetReactor::~NetReactor()
+{
+    delete ring;   // 先にリングを閉じてカーネル側の参照をなくす
+    for (int s = 0; s < REC_SLOTS; s++)
+        if (!(rec_free >> s & 1)) buf_free(rec[s].c, rec[s].p);
+    for (int i = 0; i < n_conns; i++) {
+        NetConn *c = conns[i];
+        if (c->open && epfd >= 0) epoll_ctl(epfd, EPOLL_CTL_DEL, c->spec.fd, nullptr);
+        buf_free(c, c->msg);
+        for (int k = 0; k < c->n_tx; k++) buf_free(c, c->tx[k].p);
+        delete c;
+    }
+    if (epfd >= 0) close(epfd);
+}
+
+bool NetReactor::add(const NetConnSpec &spec)
+{
+    if (n_conns == MAX_CONNS) return false;
+    // epoll はノンブロッキングで読み書きする。io_uring は待つ処理をカーネルに任せる
+    int fl = fcntl(spec.fd, F_GETFL, 0);
+    fcntl(spec.fd, F_SETFL, ring ? fl & ~O_NONBLOCK : fl | O_NONBLOCK);
+
+    NetConn *c = new NetConn();
+    c->spec = spec;
+    c->idx  = n_conns;
+    if (!ring) {
+        struct epoll_event ev = {};
+        ev.events   = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, spec.fd, &ev) < 0) {
+            delete c;
+            return false;
+        }
+    }
+    conns[n_conns++] = c;
+    n_open++;
+    return true;
+}
+
+void NetReactor::stop()
+{
+    stopping = true;
+    wake.signal();
+}
+
+void NetReactor::kick()
+{
+    wake.signal();
+}
+
+void NetReactor::run()
+{
+    fprintf(stderr, "net: %s reactor, %d connections\n", backend_name(), n_conns);
+    if (ring) run_uring();
+    else      run_epoll();
+}
+
+void NetReactor::close_conn(NetConn *c)
+{
+    if (!c->open) return;
+    c->open = false;
+    if (epfd >= 0) epoll_ctl(epfd, EPOLL_CTL_DEL, c->spec.fd, nullptr);
+    n_open--;
+}
+
+// ── 送受信の状態機械 ─────────────────────────────
+
+// 受け取ったバイト列をメッセージに切り出す
+void NetReactor::feed(NetConn *c, const char *p, size_t n)
+{
+    const char *end = p + n;
+    while (p < end && c->open) {
+        if (!c->msg) {
+            if (c->spec.framing == NET_LEN_PREFIXED) {
+                while (c->hdr_pos < 4 && p < end) c->hdr[c->hdr_pos++] = *p++;
+                if (c->hdr_pos < 4) break;
+                uint32_t len_n;
+                memcpy(&len_n, c->hdr, 4);
+                c->msg_len = ntohl(len_n);
+                c->hdr_pos = 0;
+            } else {
+                c->msg_len = c->spec.fixed_len;
+            }
+            // 長さは相手が決めるので、上限を超えるか確保できなければ接続ごと捨てる
+            if (c->msg_len > c->spec.max_len || !(c->msg = buf_alloc(c, c->msg_len))) {
+                fprintf(stderr, "net: fd %d: cannot take a %u-byte message (limit %u), closing\n",
+                        c->spec.fd, c->msg_len, c->spec.max_len);
+                shutdown(c->spec.fd, SHUT_RDWR);   // io_uring の multishot recv もこれで終わる
+                close_conn(c);
+                return;
+            }
+            c->msg_pos = 0;
+        }
+        size_t take = c->msg_len - c->msg_pos;
+        if (take > (size_t)(end - p)) take = end - p;
+        memcpy(c->msg + c->msg_pos, p, take);
+        c->msg_pos += take;
+        p += take;
+        if (c->msg_pos == c->msg_len) deliver(c);
+    }
+}
+
+// 組み上がったメッセージを録音して受け手に渡す
+void NetReactor::deliver(NetConn *c)
+{
+    record(c, c->msg, c->msg_len);
+    if (c->spec.rx) c->spec.rx(c->spec.rx_ctx, c->msg, c->msg_len);
+    else            buf_free(c, c->msg);
+    c->msg = nullptr;
+}
+
+// 次に書く部分を tx_iov に用意する。送るものがなければ 0
+int NetReactor::tx_prepare(NetConn *c)
+{
+    size_t hdr_len = c->spec.framing == NET_LEN_PREFIXED ? 4 : 0;
+    size_t pending = 0;
+    for (int i = 0; i < c->n_tx; i++) pending += hdr_len + c->tx[i].len;
+    pending -= c->tx_sent;
+    // 溜まっている分も後ろに足す（20ms ごとの小さな音声パケットが 1 回の書き込みになる）
+    while (c->n_tx < NET_TX_BATCH && pending < NET_TX_COALESCE && c->spec.tx_pop) {
+        NetConn::TxMsg &m = c->tx[c->n_tx];
+        if (!c->spec.tx_pop(c->spec.tx_ctx, m.p, m.len)) break;
+        if (hdr_len + m.len == 0) { buf_free(c, m.p); continue; }   // 書くものがない
+        m.hdr = htonl(m.len);
+        pending += hdr_len + m.len;
+        c->n_tx++;
+    }
+
+    // 長さ欄と本体を並べる。先頭は前回の続きから
+    int n_iov = 0;
+    for (int i = 0; i < c->n_tx; i++) {
+        NetConn::TxMsg &m = c->tx[i];
+        size_t skip = i == 0 ? c->tx_sent : 0;
+        if (skip < hdr_len)
+            c->tx_iov[n_iov++] = {(char *)&m.hdr + skip, hdr_len - skip};
+        size_t body_off = skip > hdr_len ? skip - hdr_len : 0;
+        if (body_off < m.len)
+            c->tx_iov[n_iov++] = {m.p + body_off, m.len - body_off};
+    }
+    return n_iov;
+}
+
+void NetReactor::tx_advance(NetConn *c, size_t n)
+{
+    size_t hdr_len = c->spec.framing == NET_LEN_PREFIXED ? 4 : 0;
+    c->tx_sent += n;
+    int done = 0;
+    while (done < c->n_tx && c->tx_sent >= hdr_len + c->tx[done].len) {
+        c->tx_sent -= hdr_len + c->tx[done].len;
+        buf_free(c, c->tx[done].p);
+        done++;
+    }
+    if (done) {
+        memmove(c->tx, c->tx + done, (c->n_tx - done) * sizeof(c->tx[0]));
+        c->n_tx -= done;
+    }
+}
+
+void NetReactor::record(NetConn *c, const char *p, size_t n)
+{
+    if (c->spec.record_fd < 0) return;
+    if (!ring) {
+        if (write(c->spec.record_fd, p, n) < 0) c->spec.record_fd = -1;
+        return;
+    }
+    // メッセージ本体は受け手に渡すので、写しを書いて完了で返す。
+    // 写しは受信と同じ buf_alloc から取る（アプリではプール。リアクタのスレッドで malloc しない）
+    char *copy = rec_free ? buf_alloc(c, (uint32_t)n) : nullptr;
+    io_uring_sqe *sqe = copy ? ring->get_sqe() : nullptr;
+    if (!sqe) {
+        // 後から同期で書くと先に積んだ書き込みと順番が入れ替わるので、このメッセージは録音しない
+        buf_free(c, copy);
+        if (n_rec_dropped++ == 0)
+            fprintf(stderr, "net: fd %d: no buffer or ring slot to record into, dropping messages\n", c->spec.fd);
+        return;
+    }
+    int s = __builtin_ctzll(rec_free);
+    rec_free &= ~(1ull << s);
+    rec[s] = {c, copy};
+    memcpy(copy, p, n);
+    sqe->opcode    = IORING_OP_WRITE;
+    sqe->fd        = c->spec.record_fd;
+    sqe->addr      = (uint64_t)(uintptr_t)copy;
+    sqe->len       = (uint32_t)n;
+    sqe->off       = (uint64_t)-1;   // ファイルの現在位置に追記
+    sqe->user_data = ((uint64_t)s << 8) | OP_WRITE;
+    in_flight++;
+}
+
+// ── epoll ───────────────────────────────────────
+
+// 書けなくなるか送るものがなくなるまで送る
+void NetReactor::flush(NetConn *c)
+{
+    while (c->open) {
+        int n_iov = tx_prepare(c);
+        if (!n_iov) return;
+        ssize_t n = writev(c->spec.fd, c->tx_iov, n_iov);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { c->tx_blocked = true; return; }
+            if (errno == EINTR) continue;
+            close_conn(c);
+            return;
+        }
+        tx_advance(c, n);
+    }
+}
+
+// 読めるだけ読む。本体の途中ならメッセージのバッファへ直接読み（写さない）、
+// 長さ欄と小さなメッセージは buf にまとめて読んでから切り出す
+void NetReactor::drain(NetConn *c)
+{
+    static thread_local char buf[RX_CHUNK];
+    while (c->open) {
+        char   *dst  = c->msg ? c->msg + c->msg_pos : buf;
+        size_t  want = c->msg ? c->msg_len - c->msg_pos : sizeof(buf);
+        ssize_t n = recv(c->spec.fd, dst, want, 0);
+        if (n == 0) { close_conn(c); return; }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if (errno == EINTR) continue;
+            close_conn(c);
+            return;
+        }
+        if (!c->msg) {
+            feed(c, buf, n);
+        } else if ((c->msg_pos += n) == c->msg_len) {
+            deliver(c);
+        }
+    }
+}
+
+void NetReactor::run_epoll()
+{
+    struct epoll_event evs[MAX_CONNS + 1];
+    // 登録前に届いていた分・積まれていた分を先に片付ける（エッジトリガなので）
+    for (int i = 0; i < n_conns; i++) { drain(conns[i]); flush(conns[i]); }
+
+    while (!stopping && n_open > 0) {
+        int n = epoll_wait(epfd, evs, MAX_CONNS + 1, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        n_wakeups++;
+        bool kicked = false;
+        for (int i = 0; i < n; i++) {
+            NetConn *c = (NetConn *)evs[i].data.ptr;
+            if (!c) { wake.wait(0); kicked = true; continue; }
+            if (evs[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) drain(c);
+            if (evs[i].events & EPOLLOUT) { c->tx_blocked = false; flush(c); }
+        }
+        // 新しく積まれたものを登録順（= 優先順）に送る
+        if (kicked)
+            for (int i = 0; i < n_conns; i++)
+                if (!conns[i]->tx_blocked) flush(conns[i]);
+    }
+}
+
+// ── io_uring ────────────────────────────────────
+
+// 受信を 1 回積む。multishot なら接続が閉じるまで完了が届き続ける
+void NetReactor::uring_recv(NetConn *c)
+{
+    io_uring_sqe *sqe = ring->get_sqe();
+    if (!sqe) { close_conn(c); return; }
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = c->spec.fd;
+    sqe->ioprio    = c->multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = ((uint64_t)c->idx << 8) | OP_RECV;
+    in_flight++;
+}
+
+// 送りかけがなければ次のメッセージの SENDMSG を積む
+void NetReactor::uring_send(NetConn *c)
+{
+    if (!c->open || c->tx_busy || stopping) return;
+    int n_iov = tx_prepare(c);
+    if (!n_iov) return;
+    io_uring_sqe *sqe = ring->get_sqe();
+    if (!sqe) return;   // 次の完了で積み直す
+    memset(&c->tx_msg, 0, sizeof(c->tx_msg));
+    c->tx_msg.msg_iov    = c->tx_iov;
+    c->tx_msg.msg_iovlen = n_iov;
+    sqe->opcode    = IORING_OP_SENDMSG;
+    sqe->fd        = c->spec.fd;
+    sqe->addr      = (uint64_t)(uintptr_t)&c->tx_msg;
+    sqe->len       = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = ((uint64_t)c->idx << 8) | OP_SEND;
+    c->tx_busy = true;
+    in_flight++;
+}
+
+// kick() の eventfd を見張る（multishot poll）
+void NetReactor::uring_wake()
+{
+    io_uring_sqe *sqe = ring->get_sqe();
+    if (!sqe) return;
+    sqe->opcode       = IORING_OP_POLL_ADD;
+    sqe->fd           = wake.fd();
+    sqe->poll32_events = POLLIN;
+    sqe->len          = IORING_POLL_ADD_MULTI;
+    sqe->user_data    = OP_WAKE;
+    in_flight++;
+}
+
+void NetReactor::uring_cqe(uint64_t data, int res, unsigned flags)
+{
+    int  op   = data & 0xf;
+    bool more = flags & IORING_CQE_F_MORE;
+    if (!more) in_flight--;
+
+    if (op == OP_WRITE) {
+        int s = data >> 8;
+        buf_free(rec[s].c, rec[s].p);
+        rec_free |= 1ull << s;
+        return;
+    }
+    if (op == OP_CANCEL) return;
+    if (op == OP_WAKE) {
+        wake.wait(0);
+        if (!more && !stopping) uring_wake();
+        for (int i = 0; i < n_conns; i++) uring_send(conns[i]);   // 登録順 = 優先順
+        return;
+    }
+
+    NetConn *c = conns[data >> 8];
+    if (op == OP_RECV) {
+        if (res > 0) {
+            unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            feed(c, ring->buffer(bid), res);
+            ring->recycle(bid);
+        } else if (res == -EINVAL && c->multishot) {
+            c->multishot = false;             // multishot recv のない古いカーネル
+        } else if (res != -ENOBUFS) {
+            if (res != -ECANCELED) close_conn(c);
+            return;
+        }
+        if (!more && c->open && !stopping) uring_recv(c);
+        return;
+    }
+    if (op == OP_SEND) {
+        c->tx_busy = false;
+        if (res < 0) {
+            if (res != -ECANCELED) close_conn(c);
+            return;
+        }
+        tx_advance(c, res);
+        uring_send(c);
+    }
+}
+
+void NetReactor::run_uring()
+{
+    uring_wake();
+    for (int i = 0; i < n_conns; i++) {
+        uring_recv(conns[i]);
+        uring_send(conns[i]);
+    }
+
+    while (!stopping && n_open > 0) {
+        int r = ring->submit(1);   // 積んだ要求を出して完了を 1 つ以上待つ
+        if (r < 0) {
+            fprintf(stderr, "net: io_uring_enter: %s\n", strerror(-r));
+            break;
+        }
+        n_wakeups++;
+        while (io_uring_cqe *cqe = ring->peek_cqe()) {
+            uint64_t data = cqe->user_data;
+            int      res  = cqe->res;
+            unsigned fl   = cqe->flags;
+            ring->cqe_seen();
+            uring_cqe(data, res, fl);
+        }
+    }
+
+    // 残っている要求を取り消し、完了を待ってからバッファを手放す
+    stopping = true;
+    if (io_uring_sqe *sqe = ring->get_sqe()) {
+        sqe->opcode       = IORING_OP_ASYNC_CANCEL;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        sqe->fd           = -1;
+        sqe->user_data    = OP_CANCEL;
+        in_flight++;
+    }
+    while (in_flight > 0) {
+        if (ring->submit(1) < 0) break;
+        while (io_uring_cqe *cqe = ring->peek_cqe()) {
+            uint64_t data = cqe->user_data;
+            int      res  = cqe->res;
+            unsigned fl   = cqe->flags;
+            ring->cqe_seen();
+            uring_cqe(data, res, fl);
+        }
+    }
+}
@@ -0,0 +1,129 @@
+// net_reactor.h
+// 複数の TCP ソケットの送受信を 1 本のスレッドで回すイベントループ
+//   バックエンドは io_uring（multishot recv + 登録済み受信バッファ）か epoll（エッジトリガ）。
+//   NET_BACKEND_AUTO では io_uring を試し、使えないカーネルでは epoll に落ちる
+//   - 受信: 届いた分だけ読み、[長さ 4 バイト][本体] または固定長でメッセージに切り出す。
+//           途中までのメッセージは接続ごとに持ち越す。epoll では長さが分かった後の本体の残りを
+//           メッセージのバッファ（buf_alloc）へ直接 recv する
+//   - 送信: 送るものはコールバックで取り出し、溜まっていれば何通かを長さ欄ごと
+//           1 回の writev / SENDMSG にまとめる。書けたところまで覚えておいて
+//           続きを書く（epoll: EPOLLOUT で / io_uring: SENDMSG の完了で）
+//   - 録音: record_fd を指定すると受け取ったメッセージをそのファイルにも書く
+//           （io_uring では buf_alloc で取った写しを同じリングで非同期に書き、完了で返す。
+//           写しか書き込みの枠が取れなければそのメッセージは録音せず、record_dropped() に数える）
+//   - 生産者は kick()、消費者は EventNotifier（eventfd）で起こすので、
+//     EAGAIN のたびに眠って待つポーリングはしない
+#ifndef NET_REACTOR_H
+#define NET_REACTOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// スレッド間の「何か来た」通知（eventfd）
+class EventNotifier {
+public:
+    EventNotifier();
+    ~EventNotifier();
+    void signal();                 // どのスレッドからでも
+    bool wait(int timeout_ms);     // 通知があれば true（溜まった通知はまとめて消す）
+    int  fd() const { return efd; }
+private:
+    int efd;
+};
+
+// 送るものを 1 つ取り出す。p は buf_alloc（既定では malloc）で取ったもので、送り終わったら reactor が返す
+typedef bool (*NetTxPop)(void *ctx, char *&p, uint32_t &len);
+// 受け取ったメッセージ 1 つ（buf_alloc で取ったもの。所有権ごと渡す）
+typedef void (*NetRxDeliver)(void *ctx, char *p, uint32_t len);
+// メッセージのバッファの取り方 / 返し方（指定しなければ malloc / free）
+typedef char *(*NetBufAlloc)(void *ctx, uint32_t len);
+typedef void  (*NetBufFree)(void *ctx, char *p);
+
+#define NET_MAX_MSG (16u << 20)   // 受け取るメッセージの長さの既定の上限
+
+enum NetBackend {
+    NET_BACKEND_AUTO,
+    NET_BACKEND_EPOLL,
+    NET_BACKEND_URING,
+};
+
+enum NetFraming {
+    NET_LEN_PREFIXED,   // [長さ (ネットワークバイト順) 4 バイト][本体]
+    NET_FIXED,          // fixed_len バイトずつ（長さ欄なし）
+};
+
+struct NetConnSpec {
+    int          fd;
+    NetFraming   framing;
+    uint32_t     fixed_len;     // NET_FIXED のときの 1 メッセージの長さ
+    NetTxPop     tx_pop;   void *tx_ctx;
+    NetRxDeliver rx;       void *rx_ctx;
+    int          record_fd = -1;   // 受信したメッセージの書き出し先（-1 = しない）
+    uint32_t     max_len   = NET_MAX_MSG;   // これより長いメッセージが届いたら接続を閉じる
+    NetBufAlloc  buf_alloc = nullptr;
+    NetBufFree   buf_free  = nullptr;
+    void        *buf_ctx   = nullptr;
+};
+
+struct NetConn;
+class Uring;
+
+class NetReactor {
+public:
+    explicit NetReactor(NetBackend want = NET_BACKEND_AUTO);
+    ~NetReactor();
+
+    NetBackend  backend() const { return ring ? NET_BACKEND_URING : NET_BACKEND_EPOLL; }
+    const char *backend_name() const { return ring ? "io_uring" : "epoll"; }
+
+    // run() の前に登録する。先に登録した接続ほど先に送る
+    bool add(const NetConnSpec &spec);
+    // stop() が呼ばれるか、すべての接続が閉じるまで回る
+    void run();
+    void stop();
+    // 送るものが増えた（生産者がキューに積んだ後に呼ぶ）
+    void kick();
+
+    uint64_t wakeups() const { return n_wakeups; }
+    uint64_t record_dropped() const { return n_rec_dropped; }
+
+private:
+    // 送受信の状態機械（バックエンド共通）
+    void feed(NetConn *c, const char *p, size_t n);
+    void deliver(NetConn *c);
+    int  tx_prepare(NetConn *c);
+    void tx_advance(NetConn *c, size_t n);
+    void record(NetConn *c, const char *p, size_t n);
+    void close_conn(NetConn *c);
+
+    // epoll
+    void run_epoll();
+    void flush(NetConn *c);
+    void drain(NetConn *c);
+
+    // io_uring
+    void run_uring();
+    void uring_recv(NetConn *c);
+    void uring_send(NetConn *c);
+    void uring_wake();
+    void uring_cqe(uint64_t data, int res, unsigned flags);
+
+    enum { MAX_CONNS = 4, REC_SLOTS = 64 };
+    int           epfd = -1;
+    Uring        *ring = nullptr;
+    unsigned      in_flight = 0;      // 完了待ちの io_uring 要求
+    // io_uring: 書き込み中の録音の写し（完了でその接続の buf_free に返す）
+    struct RecWrite { NetConn *c; char *p; };
+    RecWrite      rec[REC_SLOTS];
+    uint64_t      rec_free = ~0ull;   // 空いている枠のビット
+    uint64_t      n_rec_dropped = 0;
+    EventNotifier wake;
+    NetConn      *conns[MAX_CONNS] = {};
+    int           n_conns = 0;
+    int           n_open  = 0;
+    std::atomic<bool> stopping{false};
+    uint64_t      n_wakeups = 0;
+};
+
+#endif
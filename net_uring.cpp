@@ -0,0 +1,153 @@
+// net_uring.cpp
+// io_uring ラッパーの実装
+#include "net_uring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int uring_setup(unsigned entries, io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int uring_register(int fd, unsigned op, void *arg, unsigned nr)
+{
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+Uring::~Uring()
+{
+    // リングを閉じればバッファの登録も外れる
+    if (br) munmap(br, br_sz);
+    free(buf_base);
+    if (sqes) munmap(sqes, sqes_sz);
+    if (cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_map_sz);
+    if (sq_ptr) munmap(sq_ptr, sq_map_sz);
+    if (ring_fd >= 0) close(ring_fd);
+}
+
+bool Uring::init(unsigned entries)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring_fd = uring_setup(entries, &p);
+    if (ring_fd < 0) return false;
+
+    sq_map_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_map_sz = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_map_sz = cq_map_sz = sq_map_sz > cq_map_sz ? sq_map_sz : cq_map_sz;
+
+    sq_ptr = mmap(nullptr, sq_map_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) { sq_ptr = nullptr; goto fail; }
+    cq_ptr = single ? sq_ptr
+                    : mmap(nullptr, cq_map_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) { cq_ptr = nullptr; goto fail; }
+    sqes_sz = p.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *)mmap(nullptr, sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) { sqes = nullptr; goto fail; }
+
+    sq_head    = (unsigned *)((char *)sq_ptr + p.sq_off.head);
+    sq_tail    = (unsigned *)((char *)sq_ptr + p.sq_off.tail);
+    sq_mask    = (unsigned *)((char *)sq_ptr + p.sq_off.ring_mask);
+    sq_array   = (unsigned *)((char *)sq_ptr + p.sq_off.array);
+    sq_entries = p.sq_entries;
+    sqe_tail   = *sq_tail;
+    cq_head    = (unsigned *)((char *)cq_ptr + p.cq_off.head);
+    cq_tail    = (unsigned *)((char *)cq_ptr + p.cq_off.tail);
+    cq_mask    = (unsigned *)((char *)cq_ptr + p.cq_off.ring_mask);
+    cqes       = (io_uring_cqe *)((char *)cq_ptr + p.cq_off.cqes);
+    return true;
+
+fail:
+    close(ring_fd);
+    ring_fd = -1;
+    return false;
+}
+
+io_uring_sqe *Uring::get_sqe()
+{
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (sqe_tail - head >= sq_entries) {
+        submit(0);
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (sqe_tail - head >= sq_entries) return nullptr;
+    }
+    unsigned idx = sqe_tail & *sq_mask;
+    io_uring_sqe *sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[idx] = idx;
+    sqe_tail++;
+    return sqe;
+}
+
+int Uring::submit(unsigned wait_nr)
+{
+    unsigned n = sqe_tail - *sq_tail;
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    if (n == 0 && wait_nr == 0) return 0;
+    int r = uring_enter(ring_fd, n, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    if (r < 0) return errno == EINTR ? 0 : -errno;
+    return r;
+}
+
+io_uring_cqe *Uring::peek_cqe()
+{
+    unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return nullptr;
+    return &cqes[head & *cq_mask];
+}
+
+void Uring::cqe_seen()
+{
+    __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool Uring::setup_buffers(uint16_t bgid, unsigned count, unsigned size)
+{
+    br_sz = count * sizeof(io_uring_buf);
+    void *ring = mmap(nullptr, br_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) return false;
+    br = (io_uring_buf_ring *)ring;
+    memset(br, 0, br_sz);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)br;
+    reg.ring_entries = count;
+    reg.bgid         = bgid;
+    if (uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(br, br_sz);
+        br = nullptr;
+        return false;
+    }
+
+    buf_base  = (char *)aligned_alloc(4096, (size_t)count * size);
+    buf_count = count;
+    buf_size  = size;
+    for (unsigned i = 0; i < count; i++) recycle(i);
+    return true;
+}
+
+void Uring::recycle(unsigned bid)
+{
+    // C++ では __DECLARE_FLEX_ARRAY の空構造体が 1 バイトを取り bufs がずれるので、
+    // 先頭から io_uring_buf の配列として数える（tail は bufs[0] の resv と重なっている）
+    io_uring_buf *b = (io_uring_buf *)br + (br_tail & (buf_count - 1));
+    b->addr = (uint64_t)(uintptr_t)buffer(bid);
+    b->len  = buf_size;
+    b->bid  = (uint16_t)bid;
+    br_tail++;
+    __atomic_store_n(&br->tail, br_tail, __ATOMIC_RELEASE);
+}
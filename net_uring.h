@@ -0,0 +1,52 @@
+// net_uring.h
+// io_uring の最小限のラッパー（liburing は使わずシステムコールを直接呼ぶ）
+//   - SQ/CQ リングの mmap、SQE の積み込みと submit、完了の取り出し
+//   - 受信用の provided buffer ring: 登録したバッファの中からカーネルが空きを選んで
+//     書き込むので、multishot recv を 1 回積めば受信のたびにシステムコールはいらない
+#ifndef NET_URING_H
+#define NET_URING_H
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stddef.h>
+
+class Uring {
+public:
+    Uring() {}
+    ~Uring();
+
+    // 古いカーネルや seccomp で禁止されている環境では false
+    bool init(unsigned entries);
+    bool ok() const { return ring_fd >= 0; }
+
+    io_uring_sqe *get_sqe();          // 空きがなければ一度 submit してから取る
+    int  submit(unsigned wait_nr);    // 積んだ SQE を出し、wait_nr 個の完了まで待つ
+    io_uring_cqe *peek_cqe();         // 完了がなければ nullptr
+    void cqe_seen();                  // peek_cqe() で見たものを消費する
+
+    // 受信バッファ: count 個 (2 の累乗) x size バイトをグループ bgid として登録する
+    bool setup_buffers(uint16_t bgid, unsigned count, unsigned size);
+    char *buffer(unsigned bid) const { return buf_base + (size_t)bid * buf_size; }
+    unsigned buffer_size() const { return buf_size; }
+    void recycle(unsigned bid);       // 読み終えたバッファをカーネルへ返す
+
+private:
+    int       ring_fd = -1;
+    void     *sq_ptr = nullptr, *cq_ptr = nullptr;
+    size_t    sq_map_sz = 0, cq_map_sz = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t    sqes_sz = 0;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned  sq_entries = 0;
+    unsigned  sqe_tail = 0;           // 積んだがまだ公開していない位置
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe *cqes;
+
+    io_uring_buf_ring *br = nullptr;
+    size_t    br_sz = 0;
+    char     *buf_base = nullptr;
+    unsigned  buf_count = 0, buf_size = 0;
+    uint16_t  br_tail = 0;
+};
+
+#endif
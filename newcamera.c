@@ -9,6 +9,11 @@
 #include <libavcodec/avcodec.h>
 #include <libavutil/imgutils.h>
 #include <libswscale/swscale.h>
+#include <libavutil/opt.h>
+#include "ffmpeg_video.h"
+#include "framed_writer.h"
+
+#define ZEROCOPY_MIN (32 * 1024)   // これ以上のパケットは MSG_ZEROCOPY で送る（FramedWriter の閾値）
 
 // FFmpeg エンコーダ初期化関数
 AVCodecContext *init_ffmpeg_encoder() {
@@ -29,9 +34,14 @@ AVCodecContext *init_ffmpeg_encoder() {
     codec_ctx->height = 480; // 映像の高さ
     codec_ctx->time_base = (AVRational){1, 30}; // フレームレート
     codec_ctx->framerate = (AVRational){30, 1};
-    codec_ctx->gop_size = 10; // GOPサイズ
-    codec_ctx->max_b_frames = 1;
+    // 低遅延: B フレームなし。10 フレームごとの IDR の代わりに intra-refresh で
+    // 2 秒かけて画面を塗り直し、壊れたときは受信側の要求で IDR を出す
+    codec_ctx->gop_size = 60;
+    codec_ctx->max_b_frames = 0;
     codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    av_opt_set(codec_ctx->priv_data, "tune", "zerolatency", 0);
+    av_opt_set(codec_ctx->priv_data, "intra-refresh", "1", 0);
+    av_opt_set(codec_ctx->priv_data, "forced-idr", "1", 0);
 
     if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
         fprintf(stderr, "Error: Failed to open codec.\n");
@@ -68,41 +78,6 @@ AVFrame *convert_to_avframe(const cv::Mat &frame, AVCodecContext *codec_ctx) {
     return av_frame;
 }
 
-// 映像を圧縮して送信する関数
-void encode_and_send_frame(AVCodecContext *codec_ctx, AVFrame *frame, int socket_fd) {
-    AVPacket *packet = av_packet_alloc();
-    if (!packet) {
-        fprintf(stderr, "Error: Failed to allocate AVPacket.\n");
-        return;
-    }
-
-    int ret = avcodec_send_frame(codec_ctx, frame);
-    if (ret < 0) {
-        fprintf(stderr, "Error: Failed to send frame to encoder.\n");
-        av_packet_free(&packet);
-        return;
-    }
-
-    while (ret >= 0) {
-        ret = avcodec_receive_packet(codec_ctx, packet);
-        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-            break;
-        } else if (ret < 0) {
-            fprintf(stderr, "Error: Failed to receive packet from encoder.\n");
-            break;
-        }
-
-        // 圧縮されたデータを送信
-        int size = packet->size;
-        send(socket_fd, &size, sizeof(size), 0);
-        send(socket_fd, packet->data, size, 0);
-
-        av_packet_unref(packet);
-    }
-
-    av_packet_free(&packet);
-}
-
 int main() {
     cv::VideoCapture cap(0); // カメラ0番（通常はデフォルトカメラ）
 
@@ -138,6 +113,8 @@ int main() {
         return 1;
     }
 
+    FramedWriter *out = framed_writer_create(socket_fd, FW_LEN_HOST_INT, ZEROCOPY_MIN);
+
     while (true) {
         cap >> frame; // フレームを取得
         if (frame.empty()) break;
@@ -145,8 +122,13 @@ int main() {
         // OpenCVのフレームをAVFrameに変換
         AVFrame *av_frame = convert_to_avframe(frame, codec_ctx);
 
+        // 受信側からキーフレームの要求が来ていればこのフレームを IDR にする
+        int req;
+        while (recv(socket_fd, &req, sizeof(req), MSG_DONTWAIT) == sizeof(req))
+            if (req == VIDEO_CTRL_REQUEST_IDR) av_frame->pict_type = AV_PICTURE_TYPE_I;
+
         // FFmpegで映像を圧縮して送信
-        encode_and_send_frame(codec_ctx, av_frame, socket_fd);
+        encode_video_frame(codec_ctx, av_frame, out);
 
         av_frame_free(&av_frame);
 
@@ -156,6 +138,7 @@ int main() {
     cap.release();
     cv::destroyAllWindows();
     avcodec_free_context(&codec_ctx);
+    framed_writer_destroy(out);
     close(socket_fd);
 
     return 0;
@@ -0,0 +1,170 @@
+// pacer.cpp
+// トークンバケツと優先度つきキュー
+#include "pacer.h"
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#define AUDIO_WINDOW_US 1000000   // 音声の速さを測る窓
+
+Pacer::Pacer(const PacerConfig &c) : cfg(c)
+{
+    if (cfg.queue_packets < 1) cfg.queue_packets = 1;
+    if (cfg.max_queue_ms < 1)  cfg.max_queue_ms = 1;
+    for (Queue &qq : q) qq.ring.resize(cfg.queue_packets);
+}
+
+void Pacer::reset(int64_t target_bps)
+{
+    std::lock_guard<std::mutex> g(lock);
+    for (Queue &qq : q) qq.head = qq.count = 0;
+    bytes_queued = 0;
+    target  = target_bps;
+    budget  = 0;
+    last_us = -1;
+    audio_bps = 0;
+    audio_window_us = -1;
+    audio_window_bytes = 0;
+    st = PacerStats();
+    delay_sum_ms = 0;
+    delay_n = 0;
+    wake = false;
+}
+
+void Pacer::set_target(int64_t target_bps)
+{
+    std::lock_guard<std::mutex> g(lock);
+    target = target_bps;
+}
+
+int64_t Pacer::rate_bps() const
+{
+    int64_t base  = (int64_t)(target * cfg.multiplier) + audio_bps;
+    int64_t drain = bytes_queued * 8 * 1000 / cfg.max_queue_ms;
+    return std::max(base, drain);
+}
+
+void Pacer::refill(int64_t now_us)
+{
+    // 音声の速さ（止まったら次の窓で 0 に戻る）
+    if (audio_window_us < 0) audio_window_us = now_us;
+    if (now_us - audio_window_us >= AUDIO_WINDOW_US) {
+        audio_bps = audio_window_bytes * 8 * 1000000 / (now_us - audio_window_us);
+        audio_window_us = now_us;
+        audio_window_bytes = 0;
+    }
+
+    double rate  = rate_bps() / 8.0;   // バイト/秒
+    double burst = std::max(rate * cfg.burst_ms / 1000.0, (double)PACER_MAX_PACKET);
+    if (last_us < 0) {
+        budget  = burst;
+        last_us = now_us;
+        return;
+    }
+    if (now_us > last_us) budget += rate * (now_us - last_us) / 1e6;
+    last_us = now_us;
+    if (budget > burst) budget = burst;   // 空いていた間の分をまとめて出さない
+}
+
+bool Pacer::push(PacerClass cls, const uint8_t *pkt, int len, int64_t now_us)
+{
+    std::lock_guard<std::mutex> g(lock);
+    Queue &qq = q[cls];
+    if (len <= 0 || len > PACER_MAX_PACKET || qq.count == (int)qq.ring.size()) {
+        st.dropped++;
+        return false;
+    }
+    PacerPacket &p = qq.ring[(qq.head + qq.count) % qq.ring.size()];
+    p.len       = (uint16_t)len;
+    p.cls       = (uint8_t)cls;
+    p.queued_us = now_us;
+    memcpy(p.data, pkt, len);
+    qq.count++;
+    // 空だったなら出すスレッドは積まれるのを待っている
+    if (bytes_queued == 0) {
+        wake = true;
+        pushed.notify_one();
+    }
+    bytes_queued += len;
+    return true;
+}
+
+void Pacer::on_audio_sent(int bytes, int64_t now_us)
+{
+    std::lock_guard<std::mutex> g(lock);
+    refill(now_us);
+    budget -= bytes;
+    audio_window_bytes += bytes;
+    st.audio_bytes += bytes;
+}
+
+int Pacer::pop(int64_t now_us, PacerPacket *out, int max, int64_t *next_us)
+{
+    std::lock_guard<std::mutex> g(lock);
+    refill(now_us);
+    wake = false;
+
+    int n = 0;
+    // 残りが 1 バイトでもあれば 1 パケット出す（その分は次の補充で返す）
+    while (n < max && budget > 0 && bytes_queued > 0) {
+        Queue *qq = q;
+        while (qq->count == 0) qq++;
+        PacerPacket &p = qq->ring[qq->head];
+        out[n].len       = p.len;
+        out[n].cls       = p.cls;
+        out[n].queued_us = p.queued_us;
+        memcpy(out[n].data, p.data, p.len);
+        qq->head = (qq->head + 1) % qq->ring.size();
+        qq->count--;
+        bytes_queued -= p.len;
+        budget -= p.len;
+
+        int delay_ms = (int)((now_us - p.queued_us) / 1000);
+        delay_sum_ms += delay_ms;
+        delay_n++;
+        st.max_delay_ms = std::max(st.max_delay_ms, delay_ms);
+        st.sent[p.cls]++;
+        n++;
+    }
+
+    if (bytes_queued == 0)  *next_us = -1;
+    else if (budget > 0)    *next_us = now_us;
+    else                    *next_us = now_us + (int64_t)(-budget * 8e6 / rate_bps()) + 1;
+    return n;
+}
+
+void Pacer::wait(int64_t timeout_us)
+{
+    std::unique_lock<std::mutex> g(lock);
+    if (timeout_us > 0) pushed.wait_for(g, std::chrono::microseconds(timeout_us), [this] { return wake; });
+    wake = false;
+}
+
+int64_t Pacer::pacing_bps() const
+{
+    std::lock_guard<std::mutex> g(lock);
+    return rate_bps();
+}
+
+int64_t Pacer::queued_bytes() const
+{
+    std::lock_guard<std::mutex> g(lock);
+    return bytes_queued;
+}
+
+int Pacer::queue_delay_ms(int64_t now_us) const
+{
+    std::lock_guard<std::mutex> g(lock);
+    int64_t oldest = now_us;
+    for (const Queue &qq : q)
+        if (qq.count > 0) oldest = std::min(oldest, qq.ring[qq.head].queued_us);
+    return (int)((now_us - oldest) / 1000);
+}
+
+PacerStats Pacer::stats() const
+{
+    std::lock_guard<std::mutex> g(lock);
+    PacerStats s = st;
+    s.avg_delay_ms = delay_n ? delay_sum_ms / delay_n : 0;
+    return s;
+}
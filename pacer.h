@@ -0,0 +1,96 @@
+// pacer.h
+// 送信ペーサ（トークンバケツ）
+//   エンコーダが 1 フレームを一度に出しても、目標ビットレート × multiplier の速さでしか送らない。
+//   キーフレームの塊が浅いルータのバッファをあふれさせ、音声まで巻き込んで落とすのを防ぐ
+//   優先順: 音声 > 送り直し > 新しい映像（FEC を含む）
+//     音声はペーサに積まずにすぐ送り、使った分をバケツから引く（直後の映像がその分だけ待つ）。
+//     音声の平均の速さは出す速さに足すので、映像の取り分は減らない
+//     送り直しと映像はそれぞれの FIFO に積み、送り直しを先に出す
+//   積んでから出すまでの時間（キューの遅延）を測る。溜まった量を max_queue_ms で出し切れない
+//   速さなら、その間だけ速さを上げる（キーフレームのあとに遅れを引きずらない）
+//   時刻はすべて呼び出し側が渡す。積むスレッド（複数）と出すスレッドの間は内部でロックする
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#define PACER_MAX_PACKET 1280   // RTP も FEC も IPv6 の最小 MTU に収まる
+
+enum PacerClass { PACE_RETRANSMIT, PACE_VIDEO, PACE_CLASSES };   // 前ほど先に出す
+
+struct PacerConfig {
+    double multiplier    = 2.5;    // 目標ビットレートの何倍で出すか
+    int    burst_ms      = 5;      // バケツの深さ（この時間分は続けて出してよい）
+    int    max_queue_ms  = 500;    // 溜まった分をこの時間で出し切れる速さまでは上げる
+    int    queue_packets = 1024;   // クラスごとに積めるパケット数
+};
+
+struct PacerPacket {
+    uint16_t len;
+    uint8_t  cls;
+    int64_t  queued_us;
+    uint8_t  data[PACER_MAX_PACKET];
+};
+
+struct PacerStats {
+    uint64_t sent[PACE_CLASSES] = {};
+    uint64_t dropped     = 0;   // キューがいっぱいで積めなかった
+    uint64_t audio_bytes = 0;   // 先に通した音声
+    double   avg_delay_ms = 0;  // 積んでから出すまで（出したパケットの平均）
+    int      max_delay_ms = 0;
+};
+
+class Pacer {
+public:
+    explicit Pacer(const PacerConfig &cfg = PacerConfig());
+
+    // 通話の始まりにやり直す（積んだものは捨てる）
+    void reset(int64_t target_bps);
+    // 帯域推定の目標（FEC を含めた映像全体）
+    void set_target(int64_t target_bps);
+
+    // コピーして積む。いっぱいなら false（捨てたものは受信側が NACK で頼み直す）
+    bool push(PacerClass cls, const uint8_t *pkt, int len, int64_t now_us);
+    // ペーサを通さずに音声を bytes だけ送った
+    void on_audio_sent(int bytes, int64_t now_us);
+    // 今出してよい分を優先順に out へ取り出して数を返す（max 個まで）。
+    // *next_us には次に出せる時刻（何も積んでいなければ -1）
+    int  pop(int64_t now_us, PacerPacket *out, int max, int64_t *next_us);
+    // push されるか timeout_us 経つまで待つ（出すスレッド用）
+    void wait(int64_t timeout_us);
+
+    int64_t pacing_bps() const;                // 今の出す速さ
+    int64_t queued_bytes() const;
+    int     queue_delay_ms(int64_t now_us) const;   // 一番古いパケットの待ち時間
+    PacerStats stats() const;
+
+private:
+    struct Queue {
+        std::vector<PacerPacket> ring;
+        int head = 0, count = 0;
+    };
+    void    refill(int64_t now_us);
+    int64_t rate_bps() const;
+
+    mutable std::mutex lock;
+    std::condition_variable pushed;
+    bool    wake = false;          // 空のキューに積まれた
+    PacerConfig cfg;
+    Queue   q[PACE_CLASSES];
+    int64_t bytes_queued = 0;
+    int64_t target = 0;
+    double  budget = 0;            // 出してよいバイト（音声の分で負になる）
+    int64_t last_us = -1;
+    // 音声の平均の速さ
+    int64_t audio_bps = 0;
+    int64_t audio_window_us = -1;
+    int64_t audio_window_bytes = 0;
+    PacerStats st;
+    double  delay_sum_ms = 0;
+    uint64_t delay_n = 0;
+};
+
+#endif
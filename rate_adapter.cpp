@@ -0,0 +1,129 @@
+// rate_adapter.cpp
+// 送信待ちに応じたレート制御の実装
+#include "rate_adapter.h"
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/sockios.h>
+#include <linux/tcp.h>      // tcpi_notsent_bytes / tcpi_delivery_rate を含む版
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <chrono>
+
+static const int LEVEL_NUM[] = {4, 3, 2};   // 解像度の倍率 (÷4)
+#define MAX_LEVEL ((int)(sizeof(LEVEL_NUM) / sizeof(LEVEL_NUM[0])) - 1)
+
+static int64_t now_ms()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+bool socket_backlog(int sock, SocketBacklog *out)
+{
+    *out = SocketBacklog();
+    struct tcp_info ti;
+    memset(&ti, 0, sizeof(ti));
+    socklen_t len = sizeof(ti);
+    if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &ti, &len) == 0) {
+        out->rtt_ms = (int)(ti.tcpi_rtt / 1000);
+        if (len >= offsetof(struct tcp_info, tcpi_delivery_rate) + sizeof(ti.tcpi_delivery_rate))
+            out->delivery_bps = (int64_t)ti.tcpi_delivery_rate * 8;
+        if (len >= offsetof(struct tcp_info, tcpi_notsent_bytes) + sizeof(ti.tcpi_notsent_bytes)) {
+            out->unsent = ti.tcpi_notsent_bytes;
+            return true;
+        }
+    }
+    // 古いカーネル: 未送信だけ（なければ ACK 待ちも含めた量）
+    int n = 0;
+    if (ioctl(sock, SIOCOUTQNSD, &n) == 0 || ioctl(sock, SIOCOUTQ, &n) == 0) {
+        out->unsent = n;
+        return true;
+    }
+    return false;
+}
+
+RateAdapter::RateAdapter(const RateAdapterConfig &c) : cfg(c)
+{
+    if (cfg.max_level > MAX_LEVEL) cfg.max_level = MAX_LEVEL;
+    if (cfg.max_level < 0)         cfg.max_level = 0;
+    cur_bitrate = cfg.max_bitrate;
+}
+
+int64_t RateAdapter::ceiling(int level) const
+{
+    return cfg.max_bitrate * LEVEL_NUM[level] * LEVEL_NUM[level] / 16;
+}
+
+int64_t RateAdapter::floor(int level) const
+{
+    return cfg.min_bitrate * LEVEL_NUM[level] * LEVEL_NUM[level] / 16;
+}
+
+void RateAdapter::scaled_size(int level, int w, int h, int *sw, int *sh)
+{
+    if (level < 0) level = 0;
+    if (level > MAX_LEVEL) level = MAX_LEVEL;
+    *sw = (w * LEVEL_NUM[level] / 4) & ~1;
+    *sh = (h * LEVEL_NUM[level] / 4) & ~1;
+}
+
+RateDecision RateAdapter::update(const SocketBacklog &b, int64_t queued_bytes)
+{
+    int64_t now = now_ms();
+    int64_t prev_bitrate = cur_bitrate;
+    int     prev_level   = cur_level;
+
+    // 溜まっている量を今出ている速さで割って遅延にする。速さが分からなければ目標値で
+    int64_t rate  = b.delivery_bps > 0 ? b.delivery_bps : cur_bitrate;
+    double  delay = (double)(b.unsent + queued_bytes) * 8000.0 / rate;
+    // キーフレーム 1 枚の山で反応しないよう平均を取る（下がるときは早く追う）
+    avg_delay += (delay - avg_delay) * (delay > avg_delay ? 0.25 : 0.5);
+
+    if (avg_delay > cfg.high_ms) {
+        calm_since = -1;
+        if (now - last_down >= cfg.down_interval_ms) {
+            last_down = now;
+            if (cur_bitrate > floor(cur_level)) {
+                cur_bitrate = cur_bitrate * 7 / 10;
+                if (cur_bitrate < floor(cur_level)) cur_bitrate = floor(cur_level);
+            } else if (cur_level < cfg.max_level) {
+                cur_level++;
+                if (cur_bitrate > ceiling(cur_level)) cur_bitrate = ceiling(cur_level);
+            }
+        }
+    } else if (avg_delay < cfg.low_ms) {
+        if (calm_since < 0) calm_since = now;
+        if (now - calm_since >= cfg.up_hold_ms && now - last_up >= cfg.up_interval_ms) {
+            last_up = now;
+            if (cur_bitrate < ceiling(cur_level)) {
+                cur_bitrate = cur_bitrate * 11 / 10 + 10'000;
+                if (cur_bitrate > ceiling(cur_level)) cur_bitrate = ceiling(cur_level);
+            } else if (cur_level > 0) {
+                cur_level--;
+            }
+        }
+    } else {
+        calm_since = -1;   // 中間の帯では何もしない
+    }
+
+    bool skip = delay > cfg.skip_ms;
+    if (skip) { n_skipped++; skip_run++; }
+    if (skip != skipping) {
+        if (skip) fprintf(stderr, "rate: backlog %.0f ms, skipping frames\n", delay);
+        else      fprintf(stderr, "rate: backlog %.0f ms, resumed after %llu skipped frames\n",
+                          delay, (unsigned long long)skip_run);
+        skipping = skip;
+        skip_run = skip ? 1 : 0;
+    }
+
+    bool changed = cur_bitrate != prev_bitrate || cur_level != prev_level;
+    if (changed)
+        fprintf(stderr, "rate: delay %.0f ms (unsent %lld B, queued %lld B, %lld bps out, rtt %d ms)"
+                        " -> bitrate %lld, level %d\n",
+                avg_delay, (long long)b.unsent, (long long)queued_bytes,
+                (long long)b.delivery_bps, b.rtt_ms, (long long)cur_bitrate, cur_level);
+
+    return RateDecision{cur_bitrate, cur_level, skip, changed};
+}
@@ -0,0 +1,72 @@
+// rate_adapter.h
+// 送信待ちの量からビットレート / フレーム間引き / 解像度を決める
+//   遅延の見積もり = (カーネルの未送信バイト + アプリのキュー) ÷ 実際に出ている速さ
+//   詰まったとき: ビットレートを下げる → 下限に来たら解像度を 1 段下げる。
+//                 遅延が大きすぎるフレームは送らずに捨てる
+//   空いたとき:   しばらく落ち着いているのを確かめてから少しずつ戻す（ヒステリシス）
+//   判断はすべて stderr に出す。update() は 1 つのスレッドからだけ呼ぶこと
+#ifndef RATE_ADAPTER_H
+#define RATE_ADAPTER_H
+
+#include <stdint.h>
+
+// TCP ソケットの送信側の状態
+struct SocketBacklog {
+    int64_t unsent       = 0;   // まだ送り出していないバイト
+    int64_t delivery_bps = 0;   // 最近の実効送信レート (0 = 不明)
+    int     rtt_ms       = 0;
+};
+// TCP_INFO（古いカーネルでは SIOCOUTQNSD / SIOCOUTQ）で調べる
+bool socket_backlog(int sock, SocketBacklog *out);
+
+struct RateAdapterConfig {
+    int64_t max_bitrate = 800'000;   // 元の解像度での上限 (bps)
+    int64_t min_bitrate = 150'000;   // 元の解像度での下限。これ以下は解像度を下げる
+    int     high_ms     = 150;       // 平均遅延がこれを超えたら下げる
+    int     skip_ms     = 400;       // 今の遅延がこれを超えたらフレームを捨てる
+    int     low_ms      = 40;        // 平均遅延がこれ未満なら空いているとみなす
+    int     down_interval_ms = 500;  // 続けて下げるときの間隔
+    int     up_hold_ms  = 3000;      // 空いた状態がこれだけ続いたら上げ始める
+    int     up_interval_ms   = 1000; // 続けて上げるときの間隔
+    int     max_level   = 2;         // 解像度を下げる段数（1 段 = 3/4, 2 段 = 1/2）
+};
+
+struct RateDecision {
+    int64_t bitrate;   // 目標ビットレート
+    int     level;     // 0 = 元の解像度
+    bool    skip;      // このフレームは送らない
+    bool    changed;   // bitrate か level が前回から変わった
+};
+
+class RateAdapter {
+public:
+    explicit RateAdapter(const RateAdapterConfig &c = RateAdapterConfig());
+
+    // フレームごとに呼ぶ。queued_bytes はアプリ側のキューに溜まっているバイト
+    RateDecision update(const SocketBacklog &b, int64_t queued_bytes);
+
+    int64_t bitrate() const { return cur_bitrate; }
+    int     level()   const { return cur_level; }
+    int     delay_ms() const { return (int)avg_delay; }
+    uint64_t skipped() const { return n_skipped; }
+
+    // level 段目のビットレートの上限 / 下限（面積に比例させる）
+    int64_t ceiling(int level) const;
+    int64_t floor(int level) const;
+    // level 段目の大きさ（4:2:0 なので偶数に丸める）
+    static void scaled_size(int level, int w, int h, int *sw, int *sh);
+
+private:
+    RateAdapterConfig cfg;
+    int64_t  cur_bitrate;
+    int      cur_level = 0;
+    double   avg_delay = 0;      // 平滑化した遅延 (ms)
+    int64_t  last_down = 0;
+    int64_t  last_up   = 0;
+    int64_t  calm_since = -1;    // 空いた状態になった時刻 (-1 = 空いていない)
+    bool     skipping  = false;
+    uint64_t n_skipped = 0;
+    uint64_t skip_run  = 0;
+};
+
+#endif
@@ -0,0 +1,164 @@
+// ring_buf.h
+// 単一生産者・単一消費者のロックなしリング（中身はプールのバッファ）
+//   中身はプールのバッファ（PoolBuf を本体のポインタにして持つ）。積んだ時刻と、
+//   そこから復号を始められるか (key) を一緒に持つ
+//   - push_evict: いっぱいなら古いほうを追い出して積む（生産者側）
+//   - pop_fresh : max_age より古い先頭を捨てながら取り出す（消費者側）
+//   - push_n / pop_n: まとめて積む / 取り出す（head / tail の更新と相手を起こすのは 1 回）
+//   - wait: 溜まるまで futex で眠る（消費者側）。生産者は相手が眠っているときだけ起こす
+//   捨てるのは先頭から次の key の手前まで（H.264 の GOP の途中からは捨てない）。JPEG は全部 key
+//   生産者も先頭を捨てられるので、tail は両側から CAS で進める。勝ったほうがその要素を持つ
+//   （負けた側が読んだ中身は上書き中かもしれないので使わない。そのため各欄は relaxed の atomic）
+//   head / tail / 中身は別々のキャッシュラインに置き、相手の番号は前に読んだ値を覚えておいて
+//   足りなくなったときだけ読み直す（1 要素ごとに相手の書いた行を取りに行かない）
+//   速さと起こすまでの遅れは tests/ringbuf_bench で測る
+#ifndef RING_BUF_H
+#define RING_BUF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
+#include <chrono>
+#include "buf_pool.h"
+
+static inline int64_t mono_us(){
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+template<size_t N>
+class RingBuf{
+    static_assert((N&(N-1))==0,"N must be power of 2");
+    static_assert(sizeof(std::atomic<uint32_t>)==sizeof(uint32_t),"futex needs a plain 32-bit word");
+    struct Slot{ std::atomic<char*> p; std::atomic<int64_t> t_us; std::atomic<bool> key; };   // 長さは PoolBuf が持つ
+    static constexpr std::memory_order rx=std::memory_order_relaxed;
+    // 生産者が書く行
+    alignas(64) std::atomic<uint32_t> head{0};   // 通し番号（添字は & (N-1)）。wait はこの語で眠る
+    uint32_t tail_seen=0;                        // 生産者が前に読んだ tail（本物はこれより前に戻らない）
+    // 消費者が書く行
+    alignas(64) std::atomic<uint32_t> tail{0};
+    uint32_t head_seen=0;                        // 消費者が前に読んだ head
+    // 消費者が眠るときだけ書く行（生産者は積むたびに読む）
+    alignas(64) std::atomic<uint32_t> sleeping{0};
+    alignas(64) Slot s[N];
+    std::atomic<uint64_t> n_drop{0};
+
+    void put(uint32_t h,PoolBuf&& b,int64_t t_us,bool key){
+        Slot& e=s[h&(N-1)]; e.p.store(b.detach(),rx); e.t_us.store(t_us,rx); e.key.store(key,rx);
+    }
+    // 生産者: h に積めるか（覚えた tail で足りなければ読み直す）
+    bool room(uint32_t h){
+        if(h-tail_seen<N) return true;
+        tail_seen=tail.load(std::memory_order_acquire);
+        return h-tail_seen<N;
+    }
+    // 生産者: 積んだ分を見せて、眠っている消費者を起こす
+    void publish(uint32_t h){
+        head.store(h,std::memory_order_seq_cst);   // sleeping を読む前に見えていること（wait と対）
+        if(sleeping.load(std::memory_order_seq_cst))
+            syscall(SYS_futex,(uint32_t*)&head,FUTEX_WAKE_PRIVATE,1,nullptr,nullptr,0);
+    }
+    // 消費者: t から取り出せる数（覚えた head で足りなければ読み直す）。
+    // 生産者が捨てて t が覚えた head を追い越していることもある
+    uint32_t avail(uint32_t t){
+        if((int32_t)(head_seen-t)<=0) head_seen=head.load(std::memory_order_acquire);
+        return head_seen-t;
+    }
+    // 先頭 t の次にある key の番号（なければ t = 先頭からは捨てられない）
+    uint32_t next_key(uint32_t t,uint32_t h) const{
+        for(uint32_t i=t+1;i!=h;i++) if(s[i&(N-1)].key.load(rx)) return i;
+        return t;
+    }
+    // [t, to) を捨てる。相手が先に tail を動かしていたら何もしない
+    void drop(uint32_t t,uint32_t to){
+        char* p[N]; uint32_t n=to-t;
+        for(uint32_t i=0;i<n;i++) p[i]=s[(t+i)&(N-1)].p.load(rx);   // CAS の後は生産者が上書きしうる
+        if(!tail.compare_exchange_strong(t,to,std::memory_order_acq_rel)) return;
+        for(uint32_t i=0;i<n;i++) PoolBuf::adopt(p[i]);   // 持ち主に戻して返す
+        n_drop.fetch_add(n,std::memory_order_relaxed);
+    }
+public:
+    // 積めなければ b はそのまま（呼び出し側のスコープを出るときに返る）
+    bool push(PoolBuf&& b,int64_t t_us=0,bool key=true){return push_n(&b,1,t_us,key)==1;}
+    // 前から入るだけ積んで数を返す。積めなかった b[k..] はそのまま
+    size_t push_n(PoolBuf* b,size_t n,int64_t t_us=0,bool key=true){
+        uint32_t h=head.load(rx);
+        size_t k=0;
+        for(;k<n && room(h+k);k++) put(h+k,std::move(b[k]),t_us,key);
+        if(k) publish(h+k);
+        return k;
+    }
+    // いっぱいなら先頭から次の key の手前まで追い出す。key がなく、新しいものが key なら全部。
+    // どちらでもなければ（GOP の途中しかない）新しいものを積まずに false
+    bool push_evict(PoolBuf&& b,int64_t t_us,bool key){
+        uint32_t h=head.load(rx);
+        while(!room(h)){
+            uint32_t t=tail_seen;
+            uint32_t k=next_key(t,h);
+            if(k==t){ if(!key){n_drop.fetch_add(1,std::memory_order_relaxed); return false;} k=h; }
+            drop(t,k);
+        }
+        put(h,std::move(b),t_us,key);
+        publish(h+1);
+        return true;
+    }
+    bool pop(PoolBuf& b){return pop_n(&b,1)==1;}
+    // あるだけ（max まで）古い順に out へ取り出して数を返す
+    size_t pop_n(PoolBuf* out,size_t max){
+        for(;;){
+            uint32_t t=tail.load(std::memory_order_acquire);
+            uint32_t n=avail(t);
+            if(!n) return 0; // empty
+            if(n>max) n=(uint32_t)max;
+            char* ep[N];
+            for(uint32_t i=0;i<n;i++) ep[i]=s[(t+i)&(N-1)].p.load(rx);
+            if(tail.compare_exchange_strong(t,t+n,std::memory_order_acq_rel)){
+                for(uint32_t i=0;i<n;i++) out[i]=PoolBuf::adopt(ep[i]);
+                return n;
+            }
+        }
+    }
+    // 古すぎる先頭を捨ててから取り出す（捨てられるのは key の手前まで）
+    bool pop_fresh(PoolBuf& b,int64_t now_us,int64_t max_age_us){
+        for(;;){
+            uint32_t t=tail.load(std::memory_order_acquire);
+            if(!avail(t)) return false; // empty
+            const Slot& e=s[t&(N-1)];
+            if(now_us-e.t_us.load(rx)>max_age_us){
+                uint32_t k=next_key(t,head_seen);
+                if(k!=t){drop(t,k); continue;}
+            }
+            char* ep=e.p.load(rx);
+            if(tail.compare_exchange_strong(t,t+1,std::memory_order_acq_rel)){b=PoolBuf::adopt(ep); return true;}
+        }
+    }
+    // n 個以上溜まるか timeout_ms 経つまで眠る。溜まっていれば true（消費者用）
+    bool wait(size_t n,int timeout_ms){
+        int64_t end=mono_us()+(int64_t)timeout_ms*1000;
+        for(;;){
+            uint32_t t=tail.load(std::memory_order_acquire);
+            uint32_t h=head.load(std::memory_order_acquire);
+            if(h-t>=n) return true;
+            int64_t left=end-mono_us();
+            if(left<=0) return false;
+            sleeping.store(1,std::memory_order_seq_cst);
+            if(head.load(std::memory_order_seq_cst)==h){   // 起こされ損ねないよう、眠ると言ってから見直す
+                struct timespec ts={(time_t)(left/1000000),(long)(left%1000000)*1000};
+                syscall(SYS_futex,(uint32_t*)&head,FUTEX_WAIT_PRIVATE,h,&ts,nullptr,0);
+            }
+            sleeping.store(0,rx);
+        }
+    }
+    size_t count() const{
+        uint32_t t=tail.load(std::memory_order_acquire);   // 先に tail（後から読む head はこれより後ろ）
+        uint32_t h=head.load(std::memory_order_acquire);
+        return h-t;
+    }
+    uint64_t dropped() const{return n_drop.load(std::memory_order_relaxed);}
+};
+
+#endif
@@ -0,0 +1,476 @@
+// rtp_fec.cpp
+// XOR / Reed–Solomon の冗長パケットの作成と復元
+//
+//   GF(2^8) は x^8 + x^4 + x^3 + x^2 + 1 (0x11d)。RS の係数は Cauchy 行列
+//     c(i, j) = 1 / (x_i + y_j),  x_i = k + i（冗長 i）, y_j = j（メディア j）
+//   なので、欠けた列と届いた冗長の行から取ったどの正方小行列も正則になる。
+//   XOR は係数がすべて 1 の場合で、同じ復元手順で扱える
+//
+//   積和 dst ^= c·src は 4 ビットずつの表引き（c·lo と c·(hi << 4)）を PSHUFB で 16 / 32 バイトずつ行う
+#include "rtp_fec.h"
+#include <immintrin.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static void put32(uint8_t *p, uint32_t v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+static uint16_t get16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static uint32_t get32(const uint8_t *p) { return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+// ──────────────────────────────────────────────────
+//   GF(2^8)
+// ──────────────────────────────────────────────────
+static uint8_t gf_exp[512], gf_log[256];
+static uint8_t gf_mul_tab[256][256];
+
+static void gf_init()
+{
+    int x = 1;
+    for (int i = 0; i < 255; i++) {
+        gf_exp[i] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100) x ^= 0x11d;
+    }
+    for (int i = 255; i < 512; i++) gf_exp[i] = gf_exp[i - 255];
+    for (int a = 1; a < 256; a++)
+        for (int b = 1; b < 256; b++) gf_mul_tab[a][b] = gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static inline uint8_t gf_mul(uint8_t a, uint8_t b) { return gf_mul_tab[a][b]; }
+static inline uint8_t gf_inv(uint8_t a) { return gf_exp[255 - gf_log[a]]; }
+
+// 冗長 row がメディア col に掛ける係数
+static uint8_t fec_coef(int scheme, int k, int row, int col)
+{
+    return scheme == FEC_XOR ? 1 : gf_inv((uint8_t)((k + row) ^ col));
+}
+
+// ──────────────────────────────────────────────────
+//   カーネル: dst ^= src / dst ^= c·src
+// ──────────────────────────────────────────────────
+typedef void (*XorFn)(uint8_t *dst, const uint8_t *src, int n);
+typedef void (*MulAddFn)(uint8_t *dst, const uint8_t *src, uint8_t c, int n);
+
+static void xor_scalar(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < n; i++) dst[i] ^= src[i];
+}
+
+static void mul_add_scalar(uint8_t *dst, const uint8_t *src, uint8_t c, int n)
+{
+    const uint8_t *t = gf_mul_tab[c];
+    for (int i = 0; i < n; i++) dst[i] ^= t[src[i]];
+}
+
+// c·x = c·(x & 15) ^ c·(x & 0xf0) の 2 つの 16 要素表
+static void nibble_tables(uint8_t c, uint8_t lo[16], uint8_t hi[16])
+{
+    for (int x = 0; x < 16; x++) {
+        lo[x] = gf_mul(c, x);
+        hi[x] = gf_mul(c, x << 4);
+    }
+}
+
+// SSE2 は x86-64 の基本命令なので属性は要らない
+static void xor_sse2(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, s));
+    }
+    xor_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("ssse3")))
+static void mul_add_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, int n)
+{
+    uint8_t lo[16], hi[16];
+    nibble_tables(c, lo, hi);
+    const __m128i tlo  = _mm_loadu_si128((const __m128i *)lo);
+    const __m128i thi  = _mm_loadu_si128((const __m128i *)hi);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i l = _mm_and_si128(s, mask);
+        __m128i h = _mm_and_si128(_mm_srli_epi16(s, 4), mask);
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, l), _mm_shuffle_epi8(thi, h));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, p));
+    }
+    mul_add_scalar(dst + i, src + i, c, n - i);
+}
+
+__attribute__((target("avx2")))
+static void xor_avx2(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, s));
+    }
+    xor_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void mul_add_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, int n)
+{
+    uint8_t lo[16], hi[16];
+    nibble_tables(c, lo, hi);
+    // PSHUFB は 128 ビットの半分ごとに引くので、表を両方の半分に置く
+    const __m256i tlo  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+    const __m256i thi  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i l = _mm256_and_si256(s, mask);
+        __m256i h = _mm256_and_si256(_mm256_srli_epi16(s, 4), mask);
+        __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, l), _mm256_shuffle_epi8(thi, h));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, p));
+    }
+    mul_add_scalar(dst + i, src + i, c, n - i);
+}
+
+// ──────────────────────────────────────────────────
+//   実行時ディスパッチ
+// ──────────────────────────────────────────────────
+struct GfKernels {
+    XorFn       xor_into;
+    MulAddFn    mul_add;
+    const char *name;
+};
+
+static GfKernels pick_impl()
+{
+    gf_init();   // 表も同じ静的初期化で作る
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))  return {xor_avx2, mul_add_avx2, "avx2"};
+    if (__builtin_cpu_supports("ssse3")) return {xor_sse2, mul_add_ssse3, "ssse3"};
+    return {xor_scalar, mul_add_scalar, "scalar"};
+}
+
+static const GfKernels kern = pick_impl();
+
+const char *rtp_fec_impl_name() { return kern.name; }
+
+static void gf_mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, int n)
+{
+    if (c == 0) return;
+    if (c == 1) kern.xor_into(dst, src, n);
+    else        kern.mul_add(dst, src, c, n);
+}
+
+// シンボルの頭 FEC_SYMBOL_HEAD バイト: マーカーとペイロード長、ts
+static void symbol_head(uint8_t h[FEC_SYMBOL_HEAD], const uint8_t *pkt, int len)
+{
+    int plen = len - RTP_HEADER_SIZE;
+    h[0] = (pkt[1] & 0x80) | plen >> 8;
+    h[1] = plen;
+    memcpy(h + 2, pkt + 4, 4);
+}
+
+// sym ^= c·(RTP パケットのシンボル)。0 埋めの部分は何も変えないので触らない
+static void add_symbol(uint8_t *sym, const uint8_t *pkt, int len, uint8_t c)
+{
+    uint8_t h[FEC_SYMBOL_HEAD];
+    symbol_head(h, pkt, len);
+    for (int i = 0; i < FEC_SYMBOL_HEAD; i++) sym[i] ^= gf_mul(c, h[i]);
+    gf_mul_add(sym + FEC_SYMBOL_HEAD, pkt + RTP_HEADER_SIZE, c, len - RTP_HEADER_SIZE);
+}
+
+// n×n 行列 a の逆を inv に（a は壊す）。Gauss–Jordan
+static bool gf_invert(uint8_t a[FEC_MAX_M][FEC_MAX_M], uint8_t inv[FEC_MAX_M][FEC_MAX_M], int n)
+{
+    for (int r = 0; r < n; r++)
+        for (int c = 0; c < n; c++) inv[r][c] = r == c;
+    for (int col = 0; col < n; col++) {
+        int piv = col;
+        while (piv < n && !a[piv][col]) piv++;
+        if (piv == n) return false;
+        if (piv != col) {
+            std::swap(a[piv], a[col]);
+            std::swap(inv[piv], inv[col]);
+        }
+        uint8_t p = gf_inv(a[col][col]);
+        for (int c = 0; c < n; c++) {
+            a[col][c]   = gf_mul(p, a[col][c]);
+            inv[col][c] = gf_mul(p, inv[col][c]);
+        }
+        for (int r = 0; r < n; r++) {
+            uint8_t f = a[r][col];
+            if (r == col || !f) continue;
+            for (int c = 0; c < n; c++) {
+                a[r][c]   ^= gf_mul(f, a[col][c]);
+                inv[r][c] ^= gf_mul(f, inv[col][c]);
+            }
+        }
+    }
+    return true;
+}
+
+bool fec_is_fec(const uint8_t *pkt, int len)
+{
+    return len >= RTP_HEADER_SIZE && (pkt[0] >> 6) == 2 && (pkt[1] & 0x7F) == RTP_PT_FEC;
+}
+
+// ── 送信 ────────────────────────────────────────
+
+FecEncoder::FecEncoder(const FecConfig &cfg)
+    : cfg(cfg), ratio_(cfg.min_ratio), overhead_(cfg.scheme == FEC_NONE ? 0 : cfg.min_ratio),
+      group(cfg.scheme == FEC_NONE ? 0 : FEC_MAX_K)
+{
+}
+
+void FecEncoder::set_loss(double loss)
+{
+    // 損失率そのものより多めに: 同じグループで 2 つ落ちる分もたいてい直せる
+    ratio_ = std::min(std::max(cfg.min_ratio + 4 * loss, cfg.min_ratio), cfg.max_ratio);
+}
+
+int FecEncoder::protect(const RtpPacket *pkts, int n, FecPacket *out, int max_out)
+{
+    n_media += n;
+    if (cfg.scheme == FEC_NONE || n <= 0) return 0;
+    int media_bytes = 0;
+    for (int j = 0; j < n; j++) media_bytes += pkts[j].len;
+    n_media_bytes += media_bytes;
+
+    // XOR は 1 グループに冗長 1 つなので、割合からグループの大きさが決まる
+    int max_k = cfg.scheme == FEC_XOR ? (int)lround(1 / ratio_) : cfg.max_group;
+    max_k = std::min(std::max(max_k, 1), FEC_MAX_K);
+
+    int n_out = 0;
+    for (int j = 0; j < n; j++) {
+        RtpPacket &p = group[n_group++];
+        p.len = pkts[j].len;
+        memcpy(p.data, pkts[j].data, p.len);
+        if (n_group >= max_k) n_out += close_group(out + n_out, max_out - n_out);
+    }
+    // 次のアクセスユニットまで待つと max_delay_ms を過ぎるなら、ここで閉じる
+    uint32_t ts = get32(pkts[n - 1].data + 4);
+    if (n_group > 0 && cfg.max_delay_ms > 0) {
+        uint32_t waited = ts - get32(group[0].data + 4), step = ts - last_ts;
+        if ((int64_t)waited + step >= (int64_t)cfg.max_delay_ms * RTP_CLOCK_RATE / 1000)
+            n_out += close_group(out + n_out, max_out - n_out);
+    }
+    last_ts = ts;
+
+    int fec_bytes = 0;
+    for (int i = 0; i < n_out; i++) fec_bytes += out[i].len;
+    n_fec += n_out;
+    n_fec_bytes += fec_bytes;
+    return n_out;
+}
+
+int FecEncoder::close_group(FecPacket *out, int max_out)
+{
+    int k = n_group;
+    n_group = 0;
+    int m = cfg.scheme == FEC_XOR ? 1 : std::min(std::max((int)ceil(k * ratio_), 1), FEC_MAX_M);
+    int sym = 0, media_bytes = 0;
+    for (int j = 0; j < k; j++) {
+        sym = std::max(sym, group[j].len - RTP_HEADER_SIZE);
+        media_bytes += group[j].len;
+    }
+    sym += FEC_SYMBOL_HEAD;
+    if (m > max_out) m = 0;   // 守らない
+    overhead_ += ((double)m * (RTP_HEADER_SIZE + FEC_HEADER_SIZE + sym) / media_bytes - overhead_) / 8;
+    if (m == 0) return 0;
+
+    for (int i = 0; i < m; i++) {
+        FecPacket &f = out[i];
+        uint8_t *p = f.data;
+        p[0] = 0x80;
+        p[1] = RTP_PT_FEC;
+        put16(p + 2, seq++);
+        memcpy(p + 4, group[k - 1].data + 4, 8);   // ts は守る中で一番新しいもの、SSRC はメディアと同じ
+        uint8_t *h = p + RTP_HEADER_SIZE;
+        put16(h, get16(group[0].data + 2));
+        h[2] = k;
+        h[3] = m;
+        h[4] = i;
+        h[5] = cfg.scheme;
+        put16(h + 6, sym);
+        uint8_t *s = h + FEC_HEADER_SIZE;
+        memset(s, 0, sym);
+        for (int j = 0; j < k; j++) add_symbol(s, group[j].data, group[j].len, fec_coef(cfg.scheme, k, i, j));
+        f.len = RTP_HEADER_SIZE + FEC_HEADER_SIZE + sym;
+    }
+    return m;
+}
+
+// ── 受信 ────────────────────────────────────────
+
+FecDecoder::FecDecoder()
+    : medias(MEDIA_SLOTS), groups(GROUPS), scratch(2 * FEC_MAX_M * FEC_MAX_SYMBOL)
+{
+}
+
+FecDecoder::Group *FecDecoder::find_group(uint16_t base_seq)
+{
+    for (Group &g : groups)
+        if (g.used && g.base_seq == base_seq) return &g;
+    return nullptr;
+}
+
+FecDecoder::Group *FecDecoder::group_of(uint16_t media_seq)
+{
+    for (Group &g : groups)
+        if (g.used && !g.done && (uint16_t)(media_seq - g.base_seq) < g.k) return &g;
+    return nullptr;
+}
+
+void FecDecoder::count_media(uint16_t seq)
+{
+    if (!started) {
+        started = true;
+        base = highest = seq;
+    } else if ((int16_t)(seq - highest) > 0) {
+        if (seq < highest) cycles += 65536;   // 一周した
+        highest = seq;
+    }
+    n_received++;
+}
+
+uint8_t FecDecoder::take_fraction_lost()
+{
+    if (!started) return 0;
+    uint32_t expected = ext_highest_seq() - base + 1;
+    uint32_t exp_int  = expected - expected_prior;
+    uint32_t rec_int  = n_received - received_prior;
+    expected_prior = expected;
+    received_prior = n_received;
+    if (exp_int == 0 || rec_int >= exp_int) return 0;
+    return (uint8_t)std::min<uint32_t>(255, ((exp_int - rec_int) << 8) / exp_int);
+}
+
+int32_t FecDecoder::cumulative_lost() const
+{
+    if (!started) return 0;
+    return (int32_t)(ext_highest_seq() - base + 1 - n_received);
+}
+
+int FecDecoder::push(const uint8_t *pkt, int len, RtpPacket *recovered)
+{
+    if (len < RTP_HEADER_SIZE || (pkt[0] >> 6) != 2) return 0;
+
+    if (!fec_is_fec(pkt, len)) {
+        uint16_t seq = get16(pkt + 2);
+        count_media(seq);
+        // パディング・拡張・CSRC 付きは守られていない形。相手が FEC を送ってこないうちは残さない
+        if (!seen_fec || (pkt[0] & 0x3F) || len > RTP_MAX_PACKET || len == RTP_HEADER_SIZE) return 0;
+        Media &md = media(seq);
+        md.used = true;
+        md.seq  = seq;
+        md.len  = len;
+        memcpy(md.data, pkt, len);
+        Group *g = group_of(seq);
+        return g ? try_recover(*g, recovered) : 0;
+    }
+
+    if (len < RTP_HEADER_SIZE + FEC_HEADER_SIZE + FEC_SYMBOL_HEAD) return 0;
+    const uint8_t *h = pkt + RTP_HEADER_SIZE;
+    uint16_t base_seq = get16(h);
+    int k = h[2], m = h[3], idx = h[4], scheme = h[5], sym = get16(h + 6);
+    if (k < 1 || k > FEC_MAX_K || m < 1 || m > FEC_MAX_M || idx >= m) return 0;
+    if (!(scheme == FEC_RS || (scheme == FEC_XOR && m == 1))) return 0;
+    if (sym < FEC_SYMBOL_HEAD || sym > FEC_MAX_SYMBOL || len != RTP_HEADER_SIZE + FEC_HEADER_SIZE + sym) return 0;
+    n_fec++;
+    seen_fec = true;
+
+    Group *g = find_group(base_seq);
+    if (!g) {
+        g = &groups[next_group];   // 一番古いグループを使い回す
+        next_group = (next_group + 1) % GROUPS;
+        g->used        = true;
+        g->done        = false;
+        g->base_seq    = base_seq;
+        g->k           = k;
+        g->m           = m;
+        g->scheme      = scheme;
+        g->symbol_len  = sym;
+        g->ssrc        = get32(pkt + 8);
+        g->have_parity = 0;
+        if (g->parity.empty()) g->parity.resize(FEC_MAX_M * FEC_MAX_SYMBOL);
+    } else if (g->done || g->k != k || g->m != m || g->scheme != scheme || g->symbol_len != sym) {
+        return 0;
+    }
+    if (g->have_parity & 1u << idx) return 0;   // 重複
+    memcpy(&g->parity[(size_t)idx * FEC_MAX_SYMBOL], h + FEC_HEADER_SIZE, sym);
+    g->have_parity |= 1u << idx;
+    return try_recover(*g, recovered);
+}
+
+// 欠けた e 個と届いた冗長 e 個で連立方程式を解く
+//   s_a = p_{row_a} - Σ_{届いた j} c(row_a, j)·d_j = Σ_b c(row_a, lost_b)·x_b
+int FecDecoder::try_recover(Group &g, RtpPacket *recovered)
+{
+    int lost[FEC_MAX_M], e = 0;
+    for (int j = 0; j < g.k; j++) {
+        if (have_media(g.base_seq + j)) continue;
+        if (e == g.m) return 0;   // 冗長が全部来ても足りない
+        lost[e++] = j;
+    }
+    if (e == 0) {
+        g.done = true;
+        return 0;
+    }
+    int rows[FEC_MAX_M], n_rows = 0;
+    for (int i = 0; i < g.m && n_rows < e; i++)
+        if (g.have_parity & 1u << i) rows[n_rows++] = i;
+    if (n_rows < e) return 0;   // 冗長かメディアがもう少し来るのを待つ
+
+    int L = g.symbol_len;
+    uint8_t *s = scratch.data(), *x = s + FEC_MAX_M * FEC_MAX_SYMBOL;
+    for (int a = 0; a < e; a++) {
+        uint8_t *sa = s + a * FEC_MAX_SYMBOL;
+        memcpy(sa, &g.parity[(size_t)rows[a] * FEC_MAX_SYMBOL], L);
+        for (int j = 0, b = 0; j < g.k; j++) {
+            if (b < e && lost[b] == j) { b++; continue; }
+            const Media &md = media(g.base_seq + j);
+            if (md.len - RTP_HEADER_SIZE + FEC_SYMBOL_HEAD > L) { g.done = true; return 0; }   // グループと合わない
+            add_symbol(sa, md.data, md.len, fec_coef(g.scheme, g.k, rows[a], j));
+        }
+    }
+
+    uint8_t mat[FEC_MAX_M][FEC_MAX_M], inv[FEC_MAX_M][FEC_MAX_M];
+    for (int a = 0; a < e; a++)
+        for (int b = 0; b < e; b++) mat[a][b] = fec_coef(g.scheme, g.k, rows[a], lost[b]);
+    g.done = true;
+    if (!gf_invert(mat, inv, e)) return 0;
+
+    int n = 0;
+    for (int a = 0; a < e; a++) {
+        uint8_t *xa = x + a * FEC_MAX_SYMBOL;
+        memset(xa, 0, L);
+        for (int b = 0; b < e; b++) gf_mul_add(xa, s + b * FEC_MAX_SYMBOL, inv[a][b], L);
+        int plen = (xa[0] & 0x7F) << 8 | xa[1];
+        if (plen == 0 || plen > L - FEC_SYMBOL_HEAD) continue;   // 壊れた冗長
+
+        RtpPacket &p = recovered[n++];
+        p.data[0] = 0x80;
+        p.data[1] = (xa[0] & 0x80) | RTP_PT_H264;
+        put16(p.data + 2, g.base_seq + lost[a]);
+        memcpy(p.data + 4, xa + 2, 4);   // ts
+        put32(p.data + 8, g.ssrc);
+        memcpy(p.data + RTP_HEADER_SIZE, xa + FEC_SYMBOL_HEAD, plen);
+        p.len = RTP_HEADER_SIZE + plen;
+    }
+    n_recovered += n;
+    return n;
+}
@@ -0,0 +1,157 @@
+// rtp_fec.h
+// RTP 映像パケットの前方誤り訂正 (FEC)
+//   送信: 送る RTP パケットを順にグループへ入れ、グループが埋まるたびに冗長パケットを作る
+//         FEC_XOR: グループ全体の XOR を 1 つ（ULPFEC と同じ考え方。1 グループで 1 つまで直せる）
+//         FEC_RS : GF(2^8) 上の Cauchy 行列による Reed–Solomon。m 個の冗長で m 個まで直せる
+//         冗長の割合は相手が RTCP RR で報告する損失率に合わせて増減する
+//         グループはアクセスユニットをまたぐ（ts もシンボルで守る）ので、パケットの少ないフレームが
+//         続いても割合は ratio() のまま。ただし max_delay_ms を決めたときは、最初のパケットから
+//         それを過ぎる前にグループを閉じる（受信側が穴を諦める前に冗長が届くように）。
+//         帯域の見積もりには実際に付いた分の overhead() を使う
+//   受信: 届いたメディアパケットを手元に残し、冗長パケットと合わせて欠けた RTP パケットを作り直す。
+//         作り直したパケットは RtpDepacketizer へ入れる（並べ直しの待ち時間のうちに穴が埋まる）
+//   XOR / GF 積和は AVX2 / SSSE3 / スカラーを CPU に合わせて実行時に選ぶ
+//
+// 冗長パケット: RTP ヘッダ (PT = RTP_PT_FEC, SSRC は守るメディアと同じ, ts はその中で一番新しいもの,
+//   番号は FEC 専用)
+//   + FEC ヘッダ 8 バイト + シンボル
+//     base_seq(16) k(8) m(8) index(8) scheme(8) symbol_len(16)
+//   シンボル = [マーカー(1) | ペイロード長(15)] + ts(32) + ペイロード。グループの最大長まで 0 で埋めて
+//   演算する（ts は ULPFEC の TS recovery と同じ扱い）。番号と SSRC はグループから分かるので守らない
+//   → RtpPacketizer の出力（CSRC・拡張なし、1 つの SSRC）が前提
+#ifndef RTP_FEC_H
+#define RTP_FEC_H
+
+#include <stdint.h>
+#include <vector>
+#include "rtp_h264.h"
+
+#define RTP_PT_FEC       97
+#define FEC_HEADER_SIZE  8
+#define FEC_MAX_K        64     // 1 グループのメディアパケット数の上限
+#define FEC_MAX_M        16     // 1 グループの冗長パケット数の上限
+#define FEC_SYMBOL_HEAD  6      // マーカー・ペイロード長・ts
+#define FEC_MAX_SYMBOL   (FEC_SYMBOL_HEAD + RTP_MAX_PAYLOAD)
+#define FEC_MAX_PACKET   (RTP_HEADER_SIZE + FEC_HEADER_SIZE + FEC_MAX_SYMBOL)   // IPv6 の最小 MTU に収まる
+
+enum FecScheme {
+    FEC_NONE,
+    FEC_XOR,
+    FEC_RS,
+};
+
+struct FecConfig {
+    FecScheme scheme    = FEC_XOR;
+    double    min_ratio = 0.05;   // 冗長パケット数 / メディアパケット数（損失がないとき）
+    double    max_ratio = 0.5;
+    int       max_group = 24;     // 1 グループのメディアパケット数（FEC_XOR では 1 / 割合 から決まる）
+    int       max_delay_ms = 0;   // グループの最初のパケットから冗長を出すまでの上限（0 = 埋まるまで待つ）
+};
+
+struct FecPacket {
+    uint16_t len;
+    uint8_t  data[FEC_MAX_PACKET];
+};
+
+class FecEncoder {
+public:
+    explicit FecEncoder(const FecConfig &cfg = FecConfig());
+
+    // 相手が報告した FEC 前の損失率 (0..1) から冗長の割合を決め直す
+    void   set_loss(double loss);
+    // 狙いの割合（グループの大きさを決める）
+    double ratio() const { return ratio_; }
+    // 実際に付いた冗長のバイト数 / メディアのバイト数（閉じたグループごとの指数移動平均）。
+    // max_delay_ms でグループを早く閉じた分だけ ratio() より大きくなる
+    double overhead() const { return overhead_; }
+
+    // 1 アクセスユニット分のパケット列 (RtpPacketizer の出力) をグループに入れ、
+    // この呼び出しで閉じたグループの冗長パケットを out に書いて数を返す。
+    // 閉じていないグループのパケットは次の呼び出しまで手元に写しておく。
+    // max_out に入りきらないグループは守らない
+    int protect(const RtpPacket *pkts, int n, FecPacket *out, int max_out);
+
+    uint64_t media_packets() const { return n_media; }
+    uint64_t fec_packets()   const { return n_fec; }
+    uint64_t media_bytes()   const { return n_media_bytes; }
+    uint64_t fec_bytes()     const { return n_fec_bytes; }
+
+private:
+    // 溜めているグループの冗長を out に書いて数を返す（入りきらなければ 0）。グループは空になる
+    int close_group(FecPacket *out, int max_out);
+
+    FecConfig cfg;
+    double    ratio_;
+    double    overhead_;
+    std::vector<RtpPacket> group;   // 冗長をまだ出していないパケット（FEC_MAX_K 個分）
+    int       n_group = 0;
+    uint32_t  last_ts = 0;          // 前のアクセスユニットの ts（フレーム間隔の見積もり）
+    uint16_t  seq = 0;
+    uint64_t  n_media = 0, n_fec = 0;
+    uint64_t  n_media_bytes = 0, n_fec_bytes = 0;
+};
+
+class FecDecoder {
+public:
+    FecDecoder();
+
+    // 届いたパケット（メディアでも冗長でもよい）を 1 つ入れる。
+    // 欠けていたメディアパケットを作り直せたら recovered に書いて数を返す（最大 FEC_MAX_M）
+    int push(const uint8_t *pkt, int len, RtpPacket *recovered);
+
+    // 前回からの FEC 前の損失率 (RFC 3550 の fraction lost, 1/256 単位) を返して区間を切る
+    uint8_t  take_fraction_lost();
+    int32_t  cumulative_lost() const;
+    uint32_t ext_highest_seq() const { return cycles | highest; }
+
+    uint64_t recovered()   const { return n_recovered; }
+    uint64_t fec_received() const { return n_fec; }
+
+private:
+    enum { MEDIA_SLOTS = 1024, GROUPS = 32 };   // 2 の累乗。キーフレーム 2 枚分より多く
+    struct Media {
+        bool     used = false;
+        uint16_t seq;
+        uint16_t len;
+        uint8_t  data[RTP_MAX_PACKET];
+    };
+    struct Group {
+        bool     used = false;
+        bool     done;              // 揃った / 直した。後から来た冗長は捨てる
+        uint16_t base_seq;
+        uint8_t  k, m, scheme;
+        uint16_t symbol_len;
+        uint32_t ssrc;
+        uint32_t have_parity;       // 届いた冗長のビット
+        std::vector<uint8_t> parity;   // FEC_MAX_M × FEC_MAX_SYMBOL
+    };
+    Media &media(uint16_t s) { return medias[s & (MEDIA_SLOTS - 1)]; }
+    bool   have_media(uint16_t s) { const Media &md = media(s); return md.used && md.seq == s; }
+    Group *find_group(uint16_t base_seq);
+    Group *group_of(uint16_t media_seq);
+    void   count_media(uint16_t seq);
+    int    try_recover(Group &g, RtpPacket *recovered);
+
+    std::vector<Media> medias;
+    std::vector<Group> groups;
+    int      next_group = 0;
+    bool     seen_fec = false;      // 相手が FEC を送ってこないうちは手元に残さない
+    std::vector<uint8_t> scratch;   // 復元の作業場所
+
+    // 損失率（RFC 3550 A.3 と同じ数え方）
+    bool     started = false;
+    uint16_t base = 0, highest = 0;
+    uint32_t cycles = 0;
+    uint32_t n_received = 0;
+    uint32_t expected_prior = 0, received_prior = 0;
+
+    uint64_t n_recovered = 0, n_fec = 0;
+};
+
+// 冗長パケットかどうか（メディアと同じポートに来る）
+bool fec_is_fec(const uint8_t *pkt, int len);
+
+// 選ばれた実装名 ("avx2" / "ssse3" / "scalar")
+const char *rtp_fec_impl_name();
+
+#endif
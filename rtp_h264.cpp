@@ -0,0 +1,400 @@
+// rtp_h264.cpp
+// RFC 6184 のパケット化 / 並べ直し・復元の実装
+#include "rtp_h264.h"
+#include <string.h>
+#include <algorithm>
+
+#define NAL_STAP_A   24
+#define NAL_FU_A     28
+#define MAX_NALS     128   // 1 アクセスユニットの NAL 数（SEI + SPS + PPS + スライス数）
+
+static const uint8_t START_CODE[4] = {0, 0, 0, 1};
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static void put32(uint8_t *p, uint32_t v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+static uint16_t get16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static uint32_t get32(const uint8_t *p) { return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+struct NalSpan {
+    const uint8_t *p;
+    int            n;
+};
+
+// Annex B を NAL ごとに切る（開始コードは含めない）
+static int split_nals(const uint8_t *p, int size, NalSpan *out, int max_out)
+{
+    int n = 0, nal = -1;
+    for (int i = 0; i + 3 <= size;) {
+        if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1) {
+            if (nal >= 0) {
+                int e = i;
+                while (e > nal && p[e - 1] == 0) e--;   // 4 バイトの開始コードの 0 を落とす
+                if (e > nal) {
+                    if (n == max_out) return -1;
+                    out[n++] = {p + nal, e - nal};
+                }
+            }
+            i += 3;
+            nal = i;
+        } else {
+            i++;
+        }
+    }
+    if (nal < 0) nal = 0;   // 開始コードがなければ全体で 1 つ
+    if (nal < size) {
+        if (n == max_out) return -1;
+        out[n++] = {p + nal, size - nal};
+    }
+    return n;
+}
+
+// ── 送信 ────────────────────────────────────────
+
+RtpPacketizer::RtpPacketizer(uint32_t ssrc, int payload_size)
+    : ssrc_(ssrc),
+      payload_size(std::min(payload_size, RTP_MAX_PAYLOAD)),
+      seq((uint16_t)(ssrc * 2654435761u >> 16))   // 初期値は推測されにくい値から
+{
+}
+
+// RTP ヘッダを書いてペイロードの先頭を返す
+uint8_t *RtpPacketizer::start(RtpPacket &p, uint32_t ts)
+{
+    p.data[0] = 0x80;          // V=2
+    p.data[1] = RTP_PT_H264;
+    put16(p.data + 2, seq++);
+    put32(p.data + 4, ts);
+    put32(p.data + 8, ssrc_);
+    return p.data + RTP_HEADER_SIZE;
+}
+
+int RtpPacketizer::packetize(const uint8_t *au, int size, uint32_t ts90k, RtpPacket *out, int max_out)
+{
+    NalSpan nals[MAX_NALS];
+    int n_nals = split_nals(au, size, nals, MAX_NALS);
+    if (n_nals <= 0) return n_nals;
+
+    uint16_t seq0 = seq;
+    int n = 0;
+    for (int i = 0; i < n_nals;) {
+        const NalSpan &s = nals[i];
+        if (s.n > payload_size) {
+            // FU-A: NAL ヘッダの代わりに indicator + FU ヘッダを付けて分ける
+            const uint8_t *q = s.p + 1;
+            int left  = s.n - 1;
+            int chunk = payload_size - 2;
+            for (bool first = true; left > 0; first = false) {
+                if (n == max_out) { seq = seq0; return -1; }
+                int take = std::min(left, chunk);
+                uint8_t *pl = start(out[n], ts90k);
+                pl[0] = (s.p[0] & 0xE0) | NAL_FU_A;
+                pl[1] = (s.p[0] & 0x1F) | (first ? 0x80 : 0) | (take == left ? 0x40 : 0);
+                memcpy(pl + 2, q, take);
+                out[n++].len = RTP_HEADER_SIZE + 2 + take;
+                q += take;
+                left -= take;
+            }
+            i++;
+            continue;
+        }
+
+        // 後ろの小さな NAL を 1 パケットに入るだけまとめる
+        int j = i + 1, agg = 1 + 2 + s.n;
+        while (j < n_nals && agg + 2 + nals[j].n <= payload_size) agg += 2 + nals[j++].n;
+        if (n == max_out) { seq = seq0; return -1; }
+        uint8_t *pl = start(out[n], ts90k);
+        if (j - i == 1) {
+            memcpy(pl, s.p, s.n);   // single NAL unit
+            out[n++].len = RTP_HEADER_SIZE + s.n;
+        } else {
+            uint8_t f = 0, nri = 0;   // STAP-A の F は OR、NRI は最大
+            int pos = 1;
+            for (int k = i; k < j; k++) {
+                f  |= nals[k].p[0] & 0x80;
+                nri = std::max<uint8_t>(nri, nals[k].p[0] & 0x60);
+                put16(pl + pos, nals[k].n);
+                memcpy(pl + pos + 2, nals[k].p, nals[k].n);
+                pos += 2 + nals[k].n;
+            }
+            pl[0] = f | nri | NAL_STAP_A;
+            out[n++].len = RTP_HEADER_SIZE + pos;
+        }
+        i = j;
+    }
+    out[n - 1].data[1] |= 0x80;   // アクセスユニットの最後
+    return n;
+}
+
+// ── 受信 ────────────────────────────────────────
+
+RtpDepacketizer::RtpDepacketizer(int max_delay_ms)
+    : slots(SLOTS), max_delay_ms(max_delay_ms)
+{
+}
+
+bool RtpDepacketizer::push(const uint8_t *pkt, int len, int64_t now_ms)
+{
+    if (len < RTP_HEADER_SIZE || (pkt[0] >> 6) != 2) return false;
+    int off = RTP_HEADER_SIZE + 4 * (pkt[0] & 0x0F);   // CSRC
+    if (pkt[0] & 0x10) {                               // 拡張ヘッダ
+        if (len < off + 4) return false;
+        off += 4 + 4 * get16(pkt + off + 2);
+    }
+    int end = len;
+    if (pkt[0] & 0x20) end -= pkt[len - 1];            // パディング
+    if (off >= end || end - off > RTP_MAX_PAYLOAD) return false;
+
+    uint16_t seq = get16(pkt + 2);
+    n_received++;
+    if (!started) {
+        started = true;
+        next = highest = seq;
+    }
+    int16_t d = (int16_t)(seq - next);
+    if (d < 0) {
+        // 窓より後ろの番号が続けて届く: 相手が作り直されて番号が戻った。溜めていた分を捨ててそこから始める
+        // （諦めた後に届いた再送は窓の中なので数えない）
+        late_run  = d > -SLOTS ? 0 : late_run && seq == (uint16_t)(last_late + 1) ? late_run + 1 : 1;
+        last_late = seq;
+        if (late_run < RESYNC_LATE) { n_late++; return false; }
+        for (Slot &sl : slots) sl.used = false;
+        n_lost  += buffered;
+        buffered = 0;
+        next = highest = seq;
+        pending_loss = true;
+    }
+    late_run = 0;
+    if (d >= SLOTS) {
+        // 窓に入らないほど先まで飛んだ: 溜めていた分を捨ててそこから始める
+        for (Slot &sl : slots) sl.used = false;
+        n_lost  += d - buffered;
+        buffered = 0;
+        next = highest = seq;
+        pending_loss = true;
+    }
+    if ((int16_t)(seq - highest) > 0) highest = seq;
+    else if (seq != highest) n_reordered++;
+
+    Slot &sl = slot(seq);
+    if (sl.used) return false;   // 重複
+    sl.used       = true;
+    sl.marker     = pkt[1] & 0x80;
+    sl.ts         = get32(pkt + 4);
+    sl.arrival_ms = now_ms;
+    sl.len        = end - off;
+    memcpy(sl.payload, pkt + off, sl.len);
+    buffered++;
+    return true;
+}
+
+// 番号 hole のパケットを諦めてよいか: それより後ろのパケットが届いてから
+// max_delay_ms 経っても来ない（並べ替えでは説明できない）か、窓が溢れそう
+bool RtpDepacketizer::hole_expired(uint16_t hole, int64_t now_ms)
+{
+    if (buffered >= SLOTS / 2) return true;
+    for (uint16_t s = hole + 1; (int16_t)(s - highest) <= 0; s++) {
+        const Slot &sl = slot(s);
+        if (sl.used) return now_ms - sl.arrival_ms > max_delay_ms;
+    }
+    return false;   // 後ろがまだ何も来ていない
+}
+
+// next から始まる穴を飛ばして、次に届いているパケットへ進む
+void RtpDepacketizer::skip_hole()
+{
+    while (!slot(next).used && (int16_t)(next - highest) <= 0) {
+        next++;
+        n_lost++;
+    }
+    pending_loss = true;
+}
+
+static bool fu_continuation(const uint8_t *pl, int len)
+{
+    return len >= 2 && (pl[0] & 0x1F) == NAL_FU_A && !(pl[1] & 0x80);
+}
+
+void RtpDepacketizer::append(std::vector<uint8_t> &au, const Slot &sl)
+{
+    const uint8_t *pl = sl.payload;
+    int type = pl[0] & 0x1F;
+    if (type >= 1 && type <= 23) {
+        au.insert(au.end(), START_CODE, START_CODE + 4);
+        au.insert(au.end(), pl, pl + sl.len);
+    } else if (type == NAL_STAP_A) {
+        for (int pos = 1; pos + 2 <= sl.len;) {
+            int n = get16(pl + pos);
+            pos += 2;
+            if (n == 0 || pos + n > sl.len) break;
+            au.insert(au.end(), START_CODE, START_CODE + 4);
+            au.insert(au.end(), pl + pos, pl + pos + n);
+            pos += n;
+        }
+    } else if (type == NAL_FU_A && sl.len > 2) {
+        if (pl[1] & 0x80) {   // 先頭の断片: NAL ヘッダを組み立て直す
+            au.insert(au.end(), START_CODE, START_CODE + 4);
+            au.push_back((pl[0] & 0xE0) | (pl[1] & 0x1F));
+        }
+        au.insert(au.end(), pl + 2, pl + sl.len);
+    }
+}
+
+bool RtpDepacketizer::pop(std::vector<uint8_t> &au, uint32_t *ts, bool *lost, int64_t now_ms)
+{
+    while (buffered > 0) {
+        Slot &head = slot(next);
+        if (!head.used) {
+            if (!hole_expired(next, now_ms)) return false;
+            skip_hole();
+            continue;
+        }
+        if (pending_loss && fu_continuation(head.payload, head.len)) {
+            head.used = false;   // 頭の欠けた NAL の続きは復号できない
+            buffered--;
+            next++;
+            continue;
+        }
+
+        // マーカー（またはタイムスタンプの変わり目）まで揃っているか
+        uint16_t end = next;
+        bool complete = false;
+        for (int k = 0; k < SLOTS; k++) {
+            const Slot &c = slot(end);
+            if (!c.used) break;
+            if (c.ts != head.ts) { complete = true; break; }   // マーカーが立たないまま次のフレーム
+            end++;
+            if (c.marker) { complete = true; break; }
+        }
+        // 途中に穴があるフレームは、穴が期限切れになったら揃っている分だけ渡す
+        bool partial = !complete && !slot(end).used && hole_expired(end, now_ms);
+        if (!complete && !partial) return false;
+
+        *ts   = head.ts;
+        *lost = pending_loss || partial;
+        au.clear();
+        for (; next != end; next++) {
+            append(au, slot(next));
+            slot(next).used = false;
+            buffered--;
+        }
+        pending_loss = partial;
+        if (!au.empty()) return true;
+    }
+    return false;
+}
+
+int RtpDepacketizer::nack_list(uint16_t *out, int max_out, int64_t now_ms, int retry_ms, int max_tries)
+{
+    int n = 0;
+    if (!started) return 0;
+    for (uint16_t s = next; (int16_t)(s - highest) < 0 && n < max_out; s++) {
+        Slot &sl = slot(s);
+        if (sl.used) continue;
+        if (sl.nack_seq != s) {   // 初めて見る穴
+            sl.nack_seq   = s;
+            sl.nack_tries = 0;
+        }
+        if (sl.nack_tries >= max_tries || (sl.nack_tries && now_ms - sl.nack_ms < retry_ms)) continue;
+        sl.nack_tries++;
+        sl.nack_ms = now_ms;
+        out[n++]   = s;
+    }
+    n_nacked += n;
+    return n;
+}
+
+// ── RTCP ───────────────────────────────────────
+
+bool rtcp_is_rtcp(const uint8_t *pkt, int len)
+{
+    return len >= 8 && (pkt[0] >> 6) == 2 && pkt[1] >= 192 && pkt[1] <= 223;
+}
+
+int rtcp_write_pli(uint8_t *buf, uint32_t sender_ssrc, uint32_t media_ssrc)
+{
+    buf[0] = 0x80 | 1;   // FMT=1 (PLI)
+    buf[1] = 206;        // PSFB
+    put16(buf + 2, 2);   // 長さ (32 ビット語数 - 1)
+    put32(buf + 4, sender_ssrc);
+    put32(buf + 8, media_ssrc);
+    return 12;
+}
+
+bool rtcp_is_pli(const uint8_t *pkt, int len)
+{
+    // 複合パケットのどこかに PLI があればよい
+    for (int off = 0; off + 4 <= len;) {
+        if (pkt[off + 1] == 206 && (pkt[off] & 0x1F) == 1) return true;
+        off += 4 * (get16(pkt + off + 2) + 1);
+    }
+    return false;
+}
+
+int rtcp_write_rr(uint8_t *buf, uint32_t sender_ssrc, uint32_t media_ssrc,
+                  uint8_t fraction_lost, int32_t cumulative_lost, uint32_t ext_highest_seq)
+{
+    // 累積損失は符号付き 24 ビットに丸める
+    int32_t cum = std::min(std::max(cumulative_lost, -0x800000), 0x7FFFFF);
+    buf[0] = 0x80 | 1;   // RC=1
+    buf[1] = 201;        // RR
+    put16(buf + 2, 7);
+    put32(buf + 4, sender_ssrc);
+    put32(buf + 8, media_ssrc);
+    put32(buf + 12, (uint32_t)fraction_lost << 24 | ((uint32_t)cum & 0xFFFFFF));
+    put32(buf + 16, ext_highest_seq);
+    memset(buf + 20, 0, 12);   // jitter, LSR, DLSR（SR を送らないので使わない）
+    return 32;
+}
+
+int rtcp_rr_fraction_lost(const uint8_t *pkt, int len)
+{
+    for (int off = 0; off + 4 <= len;) {
+        if (pkt[off + 1] == 201 && (pkt[off] & 0x1F) >= 1 && off + 13 <= len) return pkt[off + 12];
+        off += 4 * (get16(pkt + off + 2) + 1);
+    }
+    return -1;
+}
+
+int rtcp_write_nack(uint8_t *buf, uint32_t sender_ssrc, uint32_t media_ssrc, const uint16_t *seqs, int n)
+{
+    // FCI 1 つ = PID と、それに続く 16 個の有無 (BLP)
+    int pos = 12;
+    uint16_t pid = 0, blp = 0;
+    for (int i = 0; i < n; i++) {
+        uint16_t d = seqs[i] - pid;
+        if (pos > 12 && d >= 1 && d <= 16) {
+            blp |= 1 << (d - 1);
+            put16(buf + pos - 2, blp);
+            continue;
+        }
+        pid = seqs[i];
+        blp = 0;
+        put16(buf + pos, pid);
+        put16(buf + pos + 2, 0);
+        pos += 4;
+    }
+    buf[0] = 0x80 | 1;   // FMT=1 (Generic NACK)
+    buf[1] = 205;        // RTPFB
+    put16(buf + 2, pos / 4 - 1);
+    put32(buf + 4, sender_ssrc);
+    put32(buf + 8, media_ssrc);
+    return pos;
+}
+
+int rtcp_parse_nack(const uint8_t *pkt, int len, uint16_t *out, int max_out)
+{
+    int n = 0;
+    for (int off = 0; off + 4 <= len;) {
+        int end = std::min(len, off + 4 * (get16(pkt + off + 2) + 1));
+        if (pkt[off + 1] == 205 && (pkt[off] & 0x1F) == 1) {
+            for (int f = off + 12; f + 4 <= end; f += 4) {
+                uint16_t pid = get16(pkt + f), blp = get16(pkt + f + 2);
+                if (n < max_out) out[n++] = pid;
+                for (int b = 0; b < 16; b++)
+                    if ((blp >> b & 1) && n < max_out) out[n++] = pid + b + 1;
+            }
+        }
+        off += 4 * (get16(pkt + off + 2) + 1);
+    }
+    return n;
+}
@@ -0,0 +1,110 @@
+// rtp_h264.h
+// H.264 の RTP パケット化と復元（RFC 6184, packetization-mode=1）
+//   送信: Annex B のアクセスユニット 1 つ → RTP パケット列
+//         小さな NAL（SPS / PPS / 短いスライス）は STAP-A にまとめ、
+//         1 パケットに入らない NAL は FU-A に分ける。最後のパケットにマーカーを立てる
+//   受信: シーケンス番号で並べ直し、マーカーまで揃ったアクセスユニットを Annex B で返す。
+//         穴が埋まらないまま max_delay_ms 過ぎたら諦めて先へ進み、欠落を知らせる
+//   キーフレームの要求は RTCP PLI（RFC 4585）、再送の要求は Generic NACK、損失率の報告は RTCP RR を
+//   同じポートで送る（RFC 5761 の多重化）
+#ifndef RTP_H264_H
+#define RTP_H264_H
+
+#include <stdint.h>
+#include <vector>
+
+#define RTP_HEADER_SIZE  12
+#define RTP_MAX_PAYLOAD  1200   // IP + UDP + RTP ヘッダを足しても IPv6 の最小 MTU (1280) に収まる
+#define RTP_MAX_PACKET   (RTP_HEADER_SIZE + RTP_MAX_PAYLOAD)
+#define RTP_PT_H264      96     // 動的ペイロードタイプ
+#define RTP_CLOCK_RATE   90000
+
+struct RtpPacket {
+    uint16_t len;
+    uint8_t  data[RTP_MAX_PACKET];
+};
+
+class RtpPacketizer {
+public:
+    explicit RtpPacketizer(uint32_t ssrc, int payload_size = RTP_MAX_PAYLOAD);
+
+    // 1 アクセスユニットを out に並べ、パケット数を返す。
+    // max_out に収まらなければ -1（シーケンス番号は進めない）
+    int packetize(const uint8_t *au, int size, uint32_t ts90k, RtpPacket *out, int max_out);
+
+    uint32_t ssrc() const { return ssrc_; }
+    uint16_t next_seq() const { return seq; }
+
+private:
+    uint8_t *start(RtpPacket &p, uint32_t ts);
+
+    uint32_t ssrc_;
+    int      payload_size;
+    uint16_t seq;
+};
+
+class RtpDepacketizer {
+public:
+    explicit RtpDepacketizer(int max_delay_ms = 50);
+
+    // 届いた RTP パケットを 1 つ入れる。壊れている / もう取り出した番号なら false
+    bool push(const uint8_t *pkt, int len, int64_t now_ms);
+    // 揃ったアクセスユニットを 1 つ Annex B で取り出す。lost: この前で欠落があった
+    bool pop(std::vector<uint8_t> &au, uint32_t *ts, bool *lost, int64_t now_ms);
+    // まだ諦めていない穴のうち、再送を頼む番号を out に並べて数を返す。
+    // 1 つの番号は retry_ms おきに max_tries 回まで
+    int  nack_list(uint16_t *out, int max_out, int64_t now_ms, int retry_ms, int max_tries);
+
+    uint64_t received()  const { return n_received; }
+    uint64_t lost()      const { return n_lost; }       // 諦めたパケット数
+    uint64_t reordered() const { return n_reordered; }  // 追い越して届いたパケット数
+    uint64_t late()      const { return n_late; }       // 諦めた後に届いたパケット数
+    uint64_t nacked()    const { return n_nacked; }     // 再送を頼んだ回数（番号ごと）
+
+private:
+    enum { SLOTS = 512 };   // 並べ直しの窓（2 の累乗）。キーフレーム数枚分
+    enum { RESYNC_LATE = 8 };   // 窓より後ろの番号がこれだけ続けて届いたら、相手が番号を振り直したとみる
+    struct Slot {
+        bool     used = false;
+        bool     marker;
+        uint32_t ts;
+        int64_t  arrival_ms;
+        uint16_t len;
+        uint16_t nack_seq = 0;   // 空きのとき: この番号を頼んだ回数と時刻
+        uint8_t  nack_tries = 0;
+        int64_t  nack_ms;
+        uint8_t  payload[RTP_MAX_PAYLOAD];
+    };
+    Slot &slot(uint16_t s) { return slots[s & (SLOTS - 1)]; }
+    bool hole_expired(uint16_t hole, int64_t now_ms);
+    void skip_hole();
+    void append(std::vector<uint8_t> &au, const Slot &sl);
+
+    std::vector<Slot> slots;
+    int      max_delay_ms;
+    bool     started = false;
+    uint16_t next = 0;        // 次に取り出すシーケンス番号
+    uint16_t highest = 0;     // 届いた中で一番新しい番号
+    int      buffered = 0;
+    bool     pending_loss = false;
+    int      late_run = 0;    // 窓より後ろに続けて届いた数（間に受け取ったパケットがない）
+    uint16_t last_late = 0;
+    uint64_t n_received = 0, n_lost = 0, n_reordered = 0, n_late = 0, n_nacked = 0;
+};
+
+// RTCP（RTP と同じポートに来る）かどうか。PT 192..223 は RTP では使わない
+bool rtcp_is_rtcp(const uint8_t *pkt, int len);
+// PLI (Picture Loss Indication) を buf に書いて長さを返す
+int  rtcp_write_pli(uint8_t *buf, uint32_t sender_ssrc, uint32_t media_ssrc);
+bool rtcp_is_pli(const uint8_t *pkt, int len);
+// RR (Receiver Report, RFC 3550) を報告ブロック 1 つで書いて長さを返す。fraction_lost は 1/256 単位
+int  rtcp_write_rr(uint8_t *buf, uint32_t sender_ssrc, uint32_t media_ssrc,
+                   uint8_t fraction_lost, int32_t cumulative_lost, uint32_t ext_highest_seq);
+// 複合パケットの中の RR の最初の報告ブロックの fraction lost。RR がなければ -1
+int  rtcp_rr_fraction_lost(const uint8_t *pkt, int len);
+// Generic NACK（RFC 4585）。seqs は古い順。buf は 12 + 4 * n バイトあればよい
+int  rtcp_write_nack(uint8_t *buf, uint32_t sender_ssrc, uint32_t media_ssrc, const uint16_t *seqs, int n);
+// 複合パケットの中の NACK が頼んでいる番号を out に並べて数を返す
+int  rtcp_parse_nack(const uint8_t *pkt, int len, uint16_t *out, int max_out);
+
+#endif
@@ -0,0 +1,85 @@
+// rtp_history.cpp
+// 送信履歴のリングと送り直しの判断
+#include "rtp_history.h"
+#include <string.h>
+#include <algorithm>
+
+#define RTT_WINDOW_MS 5000   // RTT の最小値を取る窓。経路が変わったら 2 窓で忘れる
+
+RtpHistory::RtpHistory(int slots)
+    : ring(slots), mask(slots - 1)
+{
+}
+
+void RtpHistory::clear()
+{
+    std::lock_guard<std::mutex> g(lock);
+    for (Entry &e : ring) e.used = false;
+    rtt_cur = rtt_prev = -1;
+    rtt_window_ms = 0;
+    st = RtpHistoryStats();
+}
+
+void RtpHistory::put(const uint8_t *pkt, int len, int64_t now_ms, int64_t deadline_ms)
+{
+    if (len < RTP_HEADER_SIZE || len > RTP_MAX_PACKET) return;
+    uint16_t seq = (uint16_t)(pkt[2] << 8 | pkt[3]);
+    std::lock_guard<std::mutex> g(lock);
+    Entry &e = ring[seq & mask];   // 一番古いものを上書きする
+    e.used        = true;
+    e.seq         = seq;
+    e.sent_ms     = now_ms;
+    e.deadline_ms = deadline_ms;
+    e.resent_ms   = -1;
+    e.pkt.len     = len;
+    memcpy(e.pkt.data, pkt, len);
+}
+
+static int min_known(int a, int b)
+{
+    if (a < 0) return b;
+    if (b < 0) return a;
+    return std::min(a, b);
+}
+
+int RtpHistory::resend(const uint16_t *seqs, int n, int64_t now_ms, RtpPacket *out)
+{
+    std::lock_guard<std::mutex> g(lock);
+    if (now_ms - rtt_window_ms > RTT_WINDOW_MS) {
+        rtt_prev = rtt_cur;
+        rtt_cur  = -1;
+        rtt_window_ms = now_ms;
+    }
+
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        st.requested++;
+        Entry &e = ring[seqs[i] & mask];
+        if (!e.used || e.seq != seqs[i]) { st.missing++; continue; }
+        // 最初の NACK までの時間は RTT + 受信側が穴に気づくまで。その最小を RTT とみなす
+        if (e.resent_ms < 0) rtt_cur = min_known(rtt_cur, (int)(now_ms - e.sent_ms));
+        if (now_ms > e.deadline_ms) { st.too_late++; continue; }
+        // 送り直したものがまだ届いていないだけ（受信側の頼み直し）
+        int rtt = min_known(rtt_cur, rtt_prev);
+        if (e.resent_ms >= 0 && now_ms - e.resent_ms < rtt) { st.in_flight++; continue; }
+
+        e.resent_ms = now_ms;
+        out[m].len = e.pkt.len;
+        memcpy(out[m].data, e.pkt.data, e.pkt.len);
+        m++;
+        st.resent++;
+    }
+    return m;
+}
+
+int RtpHistory::rtt_ms() const
+{
+    std::lock_guard<std::mutex> g(lock);
+    return min_known(rtt_cur, rtt_prev);
+}
+
+RtpHistoryStats RtpHistory::stats() const
+{
+    std::lock_guard<std::mutex> g(lock);
+    return st;
+}
@@ -0,0 +1,58 @@
+// rtp_history.h
+// 送った RTP パケットの履歴（NACK で頼まれたら送り直す）
+//   シーケンス番号の下位ビットで引く固定長のリング。作るときに確保したきり、
+//   put / 引き当てともに O(1) で、通話中にメモリを確保しない
+//   送り直しても受信側の並べ直しの待ちに間に合わないパケットは送らない:
+//     穴は後ろのパケットが届いてから max_delay_ms で諦められる。送り直しも元のパケットも
+//     同じ片道遅延で届くので、「元を送ってから max_delay_ms 以内に送り直せるか」で決まる
+//   送信スレッドが put し、NACK を受けたスレッドが resend する（内部でロックする）
+#ifndef RTP_HISTORY_H
+#define RTP_HISTORY_H
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include "rtp_h264.h"
+
+struct RtpHistoryStats {
+    uint64_t requested = 0;   // NACK で頼まれた番号の数
+    uint64_t resent    = 0;
+    uint64_t too_late  = 0;   // 間に合わないので送らなかった
+    uint64_t in_flight = 0;   // 少し前に送り直したばかり（NACK の重複）
+    uint64_t missing   = 0;   // もう履歴にない（上書きされた / 送っていない）
+};
+
+class RtpHistory {
+public:
+    explicit RtpHistory(int slots = 1024);   // 2 の累乗
+
+    // 送り始める（前の通話の履歴を捨てる）
+    void clear();
+    // 送った RTP パケットを残す。deadline_ms を過ぎたら送り直さない
+    void put(const uint8_t *pkt, int len, int64_t now_ms, int64_t deadline_ms);
+    // NACK で頼まれた番号のうち送り直すものを out にコピーして数を返す（out は n 個分）
+    int  resend(const uint16_t *seqs, int n, int64_t now_ms, RtpPacket *out);
+
+    // NACK が返ってくるまでの時間の最小値（≒ RTT）。まだなければ -1
+    int rtt_ms() const;
+    RtpHistoryStats stats() const;
+
+private:
+    struct Entry {
+        bool      used = false;
+        uint16_t  seq;
+        int64_t   sent_ms;
+        int64_t   deadline_ms;
+        int64_t   resent_ms;   // 最後に送り直した時刻（-1 = まだ）
+        RtpPacket pkt;
+    };
+
+    mutable std::mutex lock;
+    std::vector<Entry> ring;
+    int      mask;
+    int      rtt_cur = -1, rtt_prev = -1;   // 窓ごとの最小（古い値に引きずられないよう 2 つ）
+    int64_t  rtt_window_ms = 0;
+    RtpHistoryStats st;
+};
+
+#endif
@@ -0,0 +1,184 @@
+// audio_test.cpp
+// audio_engine を ALSA の null デバイス（既定）か snd-aloop のループバックで動かして確かめる
+//   AUDIO_TEST_LOOPBACK=1 なら hw:Loopback,0 に書いたものを hw:Loopback,1 から読み戻す
+//   （modprobe snd-aloop が要る）。null では再生は捨てられ、録音は無音になる
+//   xrun は snd_pcm_readi / snd_pcm_writei を -Wl,--wrap で包んで起こす:
+//   1 period 分止めてから読み書きし、デバイスが xrun を返さなければ（null）-EPIPE を返す
+#include "../audio_engine.h"
+#include "check.h"
+#include <alsa/asoundlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// ── 読み書きの差し込み ───────────────────────────
+
+enum { PASS, XRUN_ONCE, STALL };
+static std::atomic<int>  cap_mode{PASS}, play_mode{PASS};
+static std::atomic<bool> cap_stalled{false};
+
+extern "C" snd_pcm_sframes_t __real_snd_pcm_readi(snd_pcm_t *pcm, void *buf, snd_pcm_uframes_t n);
+extern "C" snd_pcm_sframes_t __real_snd_pcm_writei(snd_pcm_t *pcm, const void *buf, snd_pcm_uframes_t n);
+
+extern "C" snd_pcm_sframes_t __wrap_snd_pcm_readi(snd_pcm_t *pcm, void *buf, snd_pcm_uframes_t n)
+{
+    int m = cap_mode.load();
+    if (m == XRUN_ONCE) {
+        cap_mode = PASS;
+        usleep(200 * 1000);   // デバイスのバッファ（15 ms）を何倍もあふれさせる
+        snd_pcm_sframes_t r = __real_snd_pcm_readi(pcm, buf, n);
+        return r < 0 ? r : -EPIPE;
+    }
+    if (m == STALL) {
+        cap_stalled = true;
+        while (cap_mode.load() == STALL) usleep(1000);
+        cap_stalled = false;
+    }
+    return __real_snd_pcm_readi(pcm, buf, n);
+}
+
+extern "C" snd_pcm_sframes_t __wrap_snd_pcm_writei(snd_pcm_t *pcm, const void *buf, snd_pcm_uframes_t n)
+{
+    if (play_mode.load() == XRUN_ONCE) {
+        play_mode = PASS;
+        usleep(200 * 1000);
+        snd_pcm_sframes_t r = __real_snd_pcm_writei(pcm, buf, n);
+        return r < 0 ? r : -EPIPE;
+    }
+    return __real_snd_pcm_writei(pcm, buf, n);
+}
+
+// ── テスト ──────────────────────────────────────
+
+static bool loopback = false;
+static const int RATE = 44100, PKT = RATE / 100;   // 10 ms
+
+static AudioEngine *open_engine()
+{
+    AudioConfig c;
+    c.rate        = RATE;
+    c.channels    = 1;
+    c.rt_priority = 0;
+    c.capture_dev  = loopback ? "hw:Loopback,1,0" : "null";
+    c.playback_dev = loopback ? "hw:Loopback,0,0" : "null";
+    return audio_open(c);
+}
+
+template <class Pred>
+static bool wait_until(Pred p, int timeout_ms)
+{
+    for (int i = 0; i < timeout_ms && !p(); i++) usleep(1000);
+    return p();
+}
+
+// 読み書きが 1 パケットずつ通る。ループバックなら書いた並びが読み戻せる
+static void test_round_trip(AudioEngine *a)
+{
+    std::vector<int16_t> out(PKT), in(PKT);
+    int16_t v = 1;
+    int best_run = 0;
+    for (int i = 0; i < 200; i++) {
+        for (int16_t &s : out) { s = v; v = v == 30000 ? 1 : v + 1; }
+        int w = a->write(out.data(), PKT, 1000);
+        CHECK(w == PKT, "write returned %d", w);
+        int r = a->read(in.data(), PKT, 1000);
+        CHECK(r == PKT, "read returned %d", r);
+        if (!loopback) {
+            bool silent = true;
+            for (int16_t s : in) silent &= s == 0;
+            CHECK(silent, "null capture was not silent");
+            continue;
+        }
+        int run = 0;   // 書いたランプ (+1 ずつ) が続いている長さ
+        for (int k = 1; k < PKT; k++) {
+            run = in[k] != 0 && (in[k] == in[k - 1] + 1 || (in[k - 1] == 30000 && in[k] == 1)) ? run + 1 : 0;
+            if (run > best_run) best_run = run;
+        }
+    }
+    if (loopback) {
+        printf("round trip: longest ramp read back %d samples\n", best_run);
+        CHECK(best_run >= PKT - 1, "the written ramp never came back intact (longest run %d)", best_run);
+    }
+}
+
+// 書かなければ無音で埋め、読まなければ捨てて数える
+static void test_silence_and_drop(AudioEngine *a)
+{
+    AudioStats s0 = a->stats();
+    usleep(200 * 1000);
+    AudioStats s1 = a->stats();
+    printf("idle 200 ms: +%llu frames of silence, +%llu frames dropped unread\n",
+           (unsigned long long)(s1.playback_silence - s0.playback_silence),
+           (unsigned long long)(s1.capture_dropped - s0.capture_dropped));
+    CHECK(s1.playback_silence > s0.playback_silence, "playback silence counter did not move");
+    CHECK(s1.capture_dropped > s0.capture_dropped, "capture drop counter did not move");
+}
+
+static void test_xruns(AudioEngine *a)
+{
+    AudioStats s0 = a->stats();
+    cap_mode  = XRUN_ONCE;
+    play_mode = XRUN_ONCE;
+    bool cap  = wait_until([&] { return a->stats().capture_xruns > s0.capture_xruns; }, 2000);
+    bool play = wait_until([&] { return a->stats().playback_xruns > s0.playback_xruns; }, 2000);
+    CHECK(cap, "capture xrun was not counted");
+    CHECK(play, "playback xrun was not counted");
+    // 戻した後も読み書きが続く
+    std::vector<int16_t> buf(PKT);
+    CHECK(a->read(buf.data(), PKT, 1000) == PKT, "capture did not resume after the xrun");
+    CHECK(a->write(buf.data(), PKT, 1000) == PKT, "playback did not resume after the xrun");
+    AudioStats s1 = a->stats();
+    printf("xruns: capture %llu, playback %llu\n",
+           (unsigned long long)s1.capture_xruns, (unsigned long long)s1.playback_xruns);
+}
+
+// 録音が止まって待っている read() を stop() が返す
+static void test_stop_unblocks_read(AudioEngine *a)
+{
+    cap_mode = STALL;
+    CHECK(wait_until([] { return cap_stalled.load(); }, 1000), "capture thread did not stall");
+    std::vector<int16_t> buf(PKT);
+    while (a->read(buf.data(), PKT, 0) > 0) {}   // 溜まっている分を捨てる
+
+    std::atomic<int> r{1};
+    auto t0 = std::chrono::steady_clock::now();
+    std::thread reader([&] { r = a->read(buf.data(), PKT, 5000); });
+    usleep(50 * 1000);
+    CHECK(r.load() == 1, "read returned %d before stop()", r.load());
+    a->stop();
+    reader.join();
+    int ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+    printf("stop: blocked read returned %d after %d ms\n", r.load(), ms);
+    CHECK(r.load() == -1, "read after stop() returned %d", r.load());
+    CHECK(ms < 1000, "stop() took %d ms to release the reader", ms);
+    CHECK(a->write(buf.data(), PKT, 1000) == -1, "write after stop() did not fail");
+    cap_mode = PASS;
+}
+
+int main()
+{
+    const char *lb = getenv("AUDIO_TEST_LOOPBACK");
+    loopback = lb && atoi(lb);
+    AudioEngine *a = open_engine();
+    if (!a) {
+        fprintf(stderr, "audio_test: cannot open the %s device\n", loopback ? "loopback" : "null");
+        return 1;
+    }
+    test_round_trip(a);
+    test_silence_and_drop(a);
+    test_xruns(a);
+    test_stop_unblocks_read(a);
+    delete a;
+    if (failures) {
+        fprintf(stderr, "audio_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("audio_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,193 @@
+// cc_test.cpp
+// 帯域推定 (congestion_control) を合成トレースで決定的に動かして確かめる
+//   送信側は目標ビットレートで 1200 バイトのパケットを等間隔に出す。
+//   ボトルネックは速さ capacity のキュー（queue_ms を超える分は落とす）に、片道遅延と
+//   任意の割合のランダム損失を足したもの。受信側は ArrivalRecorder で 50 ms ごとに報告し、
+//   1 秒ごとに損失率を返す。乱数の種は固定
+#include "../congestion_control.h"
+#include "check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+struct Link {
+    int64_t capacity_bps = 1'000'000;
+    double  loss = 0;            // ランダム損失
+    int     queue_ms = 300;      // ボトルネックのキューの深さ
+    int     one_way_ms = 20;
+};
+
+struct InFlight {
+    uint16_t seq;
+    int64_t  arrive_us;
+};
+
+// 1 本の通話を 1 ms 刻みで回す。phase(t_ms, link) で途中からリンクを変える
+class Sim {
+public:
+    explicit Sim(const CcConfig &cfg) : cc(cfg), rng(1234) {}
+
+    template <class Phase>
+    void run(int64_t until_ms, Phase phase)
+    {
+        for (; now_ms < until_ms; now_ms++) {
+            phase(now_ms, link);
+            int64_t now_us = now_ms * 1000;
+            send(now_us);
+            deliver(now_us);
+            if (now_ms % 50 == 0) feedback(now_us);
+            if (now_ms % 1000 == 0) loss_report(now_us);
+        }
+    }
+
+    int64_t target() const { return cc.target_bitrate(); }
+    int     max_queue_ms() const { return worst_queue_ms; }
+    void    reset_worst() { worst_queue_ms = 0; }
+
+private:
+    enum { PKT = 1200 };
+
+    void send(int64_t now_us)
+    {
+        credit += cc.target_bitrate() / 8.0 / 1000.0;   // 1 ms 分
+        while (credit >= PKT) {
+            credit -= PKT;
+            uint16_t s = seq++;
+            cc.on_packet_sent(s, PKT, now_us);
+            period_sent++;
+            std::uniform_real_distribution<double> u(0, 1);
+            if (u(rng) < link.loss) continue;
+            // ボトルネック: 前のパケットが出終わってから自分の分だけかかる
+            int64_t start = std::max(now_us, link_free_us);
+            int64_t queue_us = start - now_us;
+            if (queue_us > link.queue_ms * 1000LL) continue;   // あふれた
+            link_free_us = start + PKT * 8 * 1000000LL / link.capacity_bps;
+            worst_queue_ms = std::max(worst_queue_ms, (int)(queue_us / 1000));
+            flight.push_back({s, link_free_us + link.one_way_ms * 1000LL});
+        }
+    }
+
+    void deliver(int64_t now_us)
+    {
+        size_t i = 0;
+        for (; i < flight.size() && flight[i].arrive_us <= now_us; i++) {
+            rec.on_packet(flight[i].seq, flight[i].arrive_us);
+            period_recv++;
+        }
+        flight.erase(flight.begin(), flight.begin() + i);
+    }
+
+    void feedback(int64_t now_us)
+    {
+        uint8_t buf[CC_FEEDBACK_MAX_SIZE];
+        int n = rec.write_feedback(buf, 1, 2);
+        // 報告は片道遅延の後に届くが、キューは通らない
+        if (n > 0) cc.on_feedback(buf, n, now_us + link.one_way_ms * 1000LL);
+    }
+
+    void loss_report(int64_t now_us)
+    {
+        if (period_sent > 0) {
+            double loss = 1.0 - (double)period_recv / period_sent;
+            cc.on_loss_report(loss < 0 ? 0 : loss, now_us);
+        }
+        period_sent = period_recv = 0;
+    }
+
+    CongestionController cc;
+    ArrivalRecorder      rec;
+    std::mt19937         rng;
+    Link                 link;
+    std::vector<InFlight> flight;
+    int64_t  now_ms = 0;
+    int64_t  link_free_us = 0;
+    double   credit = 0;
+    uint16_t seq = 0;
+    int64_t  period_sent = 0, period_recv = 0;
+    int      worst_queue_ms = 0;
+};
+
+// 一定のボトルネックに収束し、キューを溜め続けない
+static void test_converges()
+{
+    Sim sim(CcConfig{});
+    sim.run(30000, [](int64_t, Link &l) { l.capacity_bps = 1'200'000; });
+    sim.reset_worst();
+    sim.run(60000, [](int64_t, Link &) {});
+    int64_t t = sim.target();
+    printf("converge: target %lld bps on a 1.2 Mbps link, worst queue %d ms\n", (long long)t, sim.max_queue_ms());
+    CHECK(t > 700'000 && t < 1'320'000, "target %lld not near the 1.2 Mbps bottleneck", (long long)t);
+    CHECK(sim.max_queue_ms() < 250, "queue kept growing to %d ms", sim.max_queue_ms());
+}
+
+// 途中で帯域が下がれば数秒で下げ、戻れば上げ直す
+static void test_step_down_and_recover()
+{
+    Sim sim(CcConfig{});
+    auto cap = [](int64_t t_ms, Link &l) {
+        l.capacity_bps = t_ms < 20000 ? 2'000'000 : t_ms < 40000 ? 500'000 : 2'000'000;
+    };
+    sim.run(20000, cap);
+    int64_t before = sim.target();
+    sim.run(23000, cap);
+    int64_t after_drop = sim.target();
+    sim.run(40000, cap);
+    int64_t settled = sim.target();
+    sim.run(80000, cap);
+    int64_t recovered = sim.target();
+    printf("step: %lld -> %lld (3 s after 2 -> 0.5 Mbps) -> %lld -> %lld (40 s after back to 2 Mbps)\n",
+           (long long)before, (long long)after_drop, (long long)settled, (long long)recovered);
+    CHECK(before > 1'200'000, "did not ramp up to the 2 Mbps link: %lld", (long long)before);
+    CHECK(after_drop < 600'000, "did not back off within 3 s of overuse: %lld", (long long)after_drop);
+    CHECK(settled < 600'000 && settled > 250'000, "did not settle near 0.5 Mbps: %lld", (long long)settled);
+    CHECK(recovered > 1'200'000, "did not recover after the link came back: %lld", (long long)recovered);
+}
+
+// キューの溜まらない損失だけでも下げ、損失が止めば戻す
+static void test_loss()
+{
+    Sim sim(CcConfig{});
+    auto lossy = [](int64_t t_ms, Link &l) {
+        l.capacity_bps = 10'000'000;
+        l.loss = t_ms >= 10000 && t_ms < 20000 ? 0.2 : 0;
+    };
+    sim.run(10000, lossy);
+    int64_t before = sim.target();
+    sim.run(20000, lossy);
+    int64_t lossy_t = sim.target();
+    sim.run(50000, lossy);
+    int64_t after = sim.target();
+    printf("loss: %lld -> %lld (10 s of 20%% loss) -> %lld (30 s clean)\n",
+           (long long)before, (long long)lossy_t, (long long)after);
+    CHECK(lossy_t < before / 2, "20%% loss did not lower the target: %lld -> %lld", (long long)before, (long long)lossy_t);
+    CHECK(lossy_t >= CcConfig{}.min_bitrate, "went below the minimum: %lld", (long long)lossy_t);
+    CHECK(after > before * 3 / 4, "did not recover after loss stopped: %lld", (long long)after);
+}
+
+// 同じトレースなら同じ結果になる
+static void test_deterministic()
+{
+    auto once = [] {
+        Sim sim(CcConfig{});
+        sim.run(15000, [](int64_t t_ms, Link &l) { l.capacity_bps = t_ms < 8000 ? 1'500'000 : 700'000; l.loss = 0.01; });
+        return sim.target();
+    };
+    int64_t a = once(), b = once();
+    CHECK(a == b, "two runs of the same trace differ: %lld vs %lld", (long long)a, (long long)b);
+}
+
+int main()
+{
+    test_converges();
+    test_step_down_and_recover();
+    test_loss();
+    test_deterministic();
+    if (failures) {
+        fprintf(stderr, "cc_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("cc_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,14 @@
+// check.h
+// テスト共通の CHECK
+//   CHECK(条件, printf の書式, ...): 条件が偽なら場所と理由を出して failures を数える（止めずに続ける）。
+//   main は最後に failures を見て終了コードを決める
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include <stdio.h>
+
+static int failures = 0;
+#define CHECK(cond, ...) do { if (!(cond)) { failures++; fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+                                             fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); } } while (0)
+
+#endif
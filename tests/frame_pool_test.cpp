@@ -0,0 +1,64 @@
+// frame_pool_test.cpp
+// FramePool の寿命: destroy の後も貸し出し中のフレームは使え、最後の unref でプールが解放される
+//   AddressSanitizer 付きでビルドするので、早すぎる解放（use-after-free）も解放漏れも失敗になる
+#include "../frame_pool.h"
+#include "check.h"
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+// 何も貸していなければその場で解放する
+static void test_destroy_idle()
+{
+    FramePool *p = frame_pool_create(64, 16, 4, 3);
+    CHECK(p, "create failed");
+    ImageFrame *f = frame_pool_acquire(p);
+    image_frame_unref(f);
+    frame_pool_destroy(p);
+}
+
+// 貸し出し中のフレームは destroy の後も読み書きでき、最後の unref で解放される
+static void test_destroy_with_frames_out()
+{
+    FramePool *p = frame_pool_create(64, 16, 4, 3);
+    ImageFrame *a = frame_pool_acquire(p);
+    ImageFrame *b = frame_pool_acquire(p);
+    image_frame_ref(b);   // 別のステージも持っている
+    frame_pool_destroy(p);
+
+    CHECK(frame_pool_acquire(p) == NULL, "acquire after destroy handed out a frame");
+    memset(a->data, 1, (size_t)a->stride * a->height);
+    image_frame_unref(a);
+    memset(b->data, 2, (size_t)b->stride * b->height);
+    image_frame_unref(b);
+    CHECK(b->data[0] == 2, "frame changed while still referenced");
+    image_frame_unref(b);   // ここでプールが解放される
+}
+
+// 別々のスレッドが持っているフレームを destroy と同時に返しても、解放はちょうど 1 回
+static void test_concurrent_release()
+{
+    for (int round = 0; round < 200; round++) {
+        FramePool *p = frame_pool_create(32, 8, 1, 4);
+        std::vector<ImageFrame *> held;
+        for (int i = 0; i < 4; i++) held.push_back(frame_pool_acquire(p));
+        std::vector<std::thread> ts;
+        for (ImageFrame *f : held) ts.emplace_back([f] { f->data[0] = 7; image_frame_unref(f); });
+        frame_pool_destroy(p);
+        for (auto &t : ts) t.join();
+    }
+}
+
+int main()
+{
+    test_destroy_idle();
+    test_destroy_with_frames_out();
+    test_concurrent_release();
+    if (failures) {
+        fprintf(stderr, "frame_pool_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("frame_pool_test: ok\n");
+    return 0;
+}
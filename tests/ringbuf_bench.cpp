@@ -0,0 +1,148 @@
+// ringbuf_bench.cpp
+// RingBuf の速さと、消費者を起こすまでの遅れを測る
+//   - 通過量: 生産者と消費者のスレッドで 1 本のリングに BENCH_ITEMS 個を通す
+//       old      : 前の RingBuf（head / tail / 中身が同じ行、1 個ずつ、相手の番号を毎回読む）
+//       push/pop : 今の RingBuf を 1 個ずつ
+//       push_n/pop_n: 今の RingBuf を BENCH_BATCH 個ずつ
+//     どれも空 / 満杯なら yield して待つ（CPU が 1 つでも進むように）
+//   - 起こすまでの遅れ: 生産者が 1 ms おきに 1 個積み、消費者が取り出すまでの時間
+//       poll 2ms / poll 10ms: 前の呼び出し側のように空なら sleep_for して見直す
+//       futex wait          : RingBuf::wait で眠る
+//   数字は機械しだいなので合否は付けない（make -C tests bench で走らせる）
+#include "../ring_buf.h"
+#include "../buf_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#define BENCH_ITEMS   2000000
+#define BENCH_BATCH   16
+#define BENCH_WAKES   1000
+#define RING_N        64
+
+static BufPool pool;
+
+// 前の RingBuf（push / pop だけ。比べるためにそのまま残す）
+template<size_t N>
+class OldRingBuf{
+    struct Slot{ std::atomic<char*> p; std::atomic<int64_t> t_us; std::atomic<bool> key; };
+    Slot s[N];
+    static constexpr std::memory_order rx=std::memory_order_relaxed;
+    std::atomic<uint32_t> head{0},tail{0};
+public:
+    bool push(PoolBuf&& b,int64_t t_us=0,bool key=true){
+        uint32_t h=head.load(std::memory_order_relaxed);
+        if(h-tail.load(std::memory_order_acquire)==N) return false; // full
+        Slot& e=s[h&(N-1)]; e.p.store(b.detach(),rx); e.t_us.store(t_us,rx); e.key.store(key,rx);
+        head.store(h+1,std::memory_order_release);
+        return true;
+    }
+    bool pop(PoolBuf& b){
+        for(;;){
+            uint32_t t=tail.load(std::memory_order_acquire);
+            if(t==head.load(std::memory_order_acquire)) return false; // empty
+            char* ep=s[t&(N-1)].p.load(rx);
+            if(tail.compare_exchange_strong(t,t+1,std::memory_order_acq_rel)){b=PoolBuf::adopt(ep); return true;}
+        }
+    }
+};
+
+// ── 通過量 ──────────────────────────────────────
+
+// 生産者は通し番号を書いたバッファを積み、消費者は順番どおりか確かめる
+template<class Ring,class Push,class Pop>
+static void throughput(const char* name,Ring& rb,Push push,Pop pop){
+    bool in_order=true;
+    int64_t t0=mono_us();
+    std::thread prod([&]{
+        PoolBuf b[BENCH_BATCH];
+        for(uint32_t i=0;i<BENCH_ITEMS;){
+            size_t n=std::min<size_t>(BENCH_BATCH,BENCH_ITEMS-i);
+            for(size_t k=0;k<n;k++) if(!b[k]){ b[k]=pool.get(sizeof(uint32_t)); uint32_t v=i+k; memcpy(b[k].data(),&v,sizeof v); }
+            size_t done=push(rb,b,n);
+            if(!done){ std::this_thread::yield(); continue; }
+            // 積めなかった残りは返して、次の回に番号を付け直す
+            for(size_t k=done;k<n;k++) b[k].reset();
+            i+=done;
+        }
+    });
+    PoolBuf out[BENCH_BATCH];
+    for(uint32_t i=0;i<BENCH_ITEMS;){
+        size_t n=pop(rb,out,BENCH_BATCH);
+        if(!n){ std::this_thread::yield(); continue; }
+        for(size_t k=0;k<n;k++){
+            uint32_t v; memcpy(&v,out[k].data(),sizeof v);
+            in_order&=v==i+k;
+            out[k].reset();
+        }
+        i+=n;
+    }
+    prod.join();
+    double s=(mono_us()-t0)/1e6;
+    printf("  %-14s %7.2f M items/s%s\n",name,BENCH_ITEMS/s/1e6,in_order?"":"  (OUT OF ORDER)");
+    if(!in_order) exit(1);
+}
+
+// ── 起こすまでの遅れ ──────────────────────────────
+
+// 消費者の待ち方: 0 = futex wait、それ以外 = その ms だけ sleep_for して見直す
+static void wake_latency(const char* name,int poll_ms){
+    RingBuf<RING_N> rb;
+    std::vector<int64_t> lat;
+    lat.reserve(BENCH_WAKES);
+    std::thread cons([&]{
+        PoolBuf b;
+        while((int)lat.size()<BENCH_WAKES){
+            if(!rb.pop(b)){
+                if(poll_ms) std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+                else rb.wait(1,100);
+                continue;
+            }
+            int64_t t; memcpy(&t,b.data(),sizeof t);
+            lat.push_back(mono_us()-t);
+            b.reset();
+        }
+    });
+    for(int i=0;i<BENCH_WAKES;i++){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        PoolBuf b=pool.get(sizeof(int64_t));
+        int64_t t=mono_us(); memcpy(b.data(),&t,sizeof t);
+        rb.push(std::move(b));
+    }
+    cons.join();
+    std::sort(lat.begin(),lat.end());
+    printf("  %-14s p50 %6lld us  p99 %6lld us  max %6lld us\n",name,
+           (long long)lat[lat.size()/2],(long long)lat[lat.size()*99/100],(long long)lat.back());
+}
+
+int main(){
+    printf("throughput (%d items, ring %d, batch %d, %u CPUs)\n",BENCH_ITEMS,RING_N,BENCH_BATCH,std::thread::hardware_concurrency());
+    {
+        static OldRingBuf<RING_N> rb;
+        throughput("old",rb,
+            [](OldRingBuf<RING_N>& r,PoolBuf* b,size_t){return r.push(std::move(b[0]))?(size_t)1:0;},
+            [](OldRingBuf<RING_N>& r,PoolBuf* o,size_t){return r.pop(o[0])?(size_t)1:0;});
+    }
+    {
+        static RingBuf<RING_N> rb;
+        throughput("push/pop",rb,
+            [](RingBuf<RING_N>& r,PoolBuf* b,size_t){return r.push(std::move(b[0]))?(size_t)1:0;},
+            [](RingBuf<RING_N>& r,PoolBuf* o,size_t){return r.pop(o[0])?(size_t)1:0;});
+    }
+    {
+        static RingBuf<RING_N> rb;
+        throughput("push_n/pop_n",rb,
+            [](RingBuf<RING_N>& r,PoolBuf* b,size_t n){return r.push_n(b,n);},
+            [](RingBuf<RING_N>& r,PoolBuf* o,size_t n){return r.pop_n(o,n);});
+    }
+    printf("wake latency (%d items, one per ms)\n",BENCH_WAKES);
+    wake_latency("poll 10ms",10);
+    wake_latency("poll 2ms",2);
+    wake_latency("futex wait",0);
+    BufPoolStats st=pool.stats();
+    printf("pool: %llu fallback, %llu rejected\n",(unsigned long long)st.fallback,(unsigned long long)st.rejected);
+    return 0;
+}
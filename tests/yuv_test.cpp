@@ -0,0 +1,227 @@
+// yuv_test.cpp
+// packed_to_yuv420p の AVX2 / SSE4.1 / スカラー版を比べる
+//   - SIMD 版はスカラー版とビット単位で一致すること
+//     （奇数の幅と高さ、SIMD の幅の前後、0 / 255 の端の値、市松、乱数。BGR と RGB）
+//   - 各平面の行の右の余白（stride の残り）に書かないこと
+//   - HAVE_SWSCALE でビルドしたとき（make が libswscale を見つけたとき）は sws_scale とも比べる。
+//     差の上限 YUV_TOL_Y / YUV_TOL_C は libswscale 9.5（FFmpeg 8.0）で測った値:
+//       係数がこちらは 8 bit（66/129/25 …）、swscale は 15 bit なので、全 2^24 色のうち 8.6% で
+//       Y が ±1 ずれる（どちらにも寄らない）。U / V も同じ理由で ±1
+//     比べるのは幅が偶数で高さが 4 以上の偶数のときだけ。そのとき swscale の色差も 2x2 の平均になる。
+//     奇数の幅・高さでは swscale は色差の格子全体を引き伸ばして面積で重み付けし（17 行 → 9 行）、
+//     こちらは右端 / 下端を複製するので定義が違う。高さ 2 では swscale は 2 行目だけを使う
+//   CPU が対応していない実装は飛ばす
+#include "../yuv_convert.h"
+#include "check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+#ifdef HAVE_SWSCALE
+extern "C" {
+#include <libswscale/swscale.h>
+#include <libavutil/pixfmt.h>
+}
+#endif
+
+#define YUV_TOL_Y  1   // sws_scale との差の上限（輝度）。測った最大値
+#define YUV_TOL_C  1   // 同じく色差
+#define SRC_PAD    13  // 入力の行末の余白（stride が 3 × 幅 でないときも見る）
+#define DST_PAD    7   // 出力の行末の余白。ここに書いたら失敗
+#define GUARD      0xA5
+
+enum Pattern { P_RANDOM, P_ZERO, P_FULL, P_CHECKER, P_EXTREMES, P_GRADIENT, P_COUNT };
+static const char *pattern_name[P_COUNT] = {"random", "0", "255", "checker", "0/255 per channel", "gradient"};
+
+struct Packed {
+    int w, h, stride;
+    std::vector<uint8_t> px;
+    Packed(int w_, int h_) : w(w_), h(h_), stride(3 * w_ + SRC_PAD), px((size_t)stride * h_) {}
+};
+
+struct Planes {
+    int w, h, cw, ch;
+    int stride[3];
+    std::vector<uint8_t> buf[3];
+    Planes(int w_, int h_) : w(w_), h(h_), cw((w_ + 1) / 2), ch((h_ + 1) / 2) {
+        stride[0] = w + DST_PAD;
+        stride[1] = stride[2] = cw + DST_PAD;
+        buf[0].assign((size_t)stride[0] * h, GUARD);
+        buf[1].assign((size_t)stride[1] * ch, GUARD);
+        buf[2].assign((size_t)stride[2] * ch, GUARD);
+    }
+    int pw(int i) const { return i ? cw : w; }
+    int ph(int i) const { return i ? ch : h; }
+    const uint8_t *row(int i, int y) const { return buf[i].data() + (size_t)y * stride[i]; }
+};
+
+static void fill(Packed &f, Pattern p, std::mt19937 &rng)
+{
+    for (int y = 0; y < f.h; y++) {
+        uint8_t *r = f.px.data() + (size_t)y * f.stride;
+        for (int x = 0; x < 3 * f.w; x++) {
+            switch (p) {
+            case P_RANDOM:   r[x] = (uint8_t)rng(); break;
+            case P_ZERO:     r[x] = 0; break;
+            case P_FULL:     r[x] = 255; break;
+            case P_CHECKER:  r[x] = ((x / 3 + y) & 1) ? 255 : 0; break;
+            case P_EXTREMES: r[x] = (rng() & 1) ? 255 : 0; break;
+            case P_GRADIENT: r[x] = (uint8_t)((x / 3 * 7 + y * 3 + x % 3 * 85) & 255); break;
+            default: break;
+            }
+        }
+        for (int x = 3 * f.w; x < f.stride; x++) r[x] = (uint8_t)rng();   // 読んではいけない余白
+    }
+}
+
+static void convert(const Packed &f, PackedOrder order, Planes &out)
+{
+    uint8_t *const dst[3] = {out.buf[0].data(), out.buf[1].data(), out.buf[2].data()};
+    packed_to_yuv420p(f.px.data(), f.stride, f.w, f.h, order, dst, out.stride);
+}
+
+// 余白に書いていないか
+static bool guards_intact(const Planes &o)
+{
+    for (int i = 0; i < 3; i++)
+        for (int y = 0; y < o.ph(i); y++)
+            for (int x = o.pw(i); x < o.stride[i]; x++)
+                if (o.row(i, y)[x] != GUARD) return false;
+    return true;
+}
+
+// 平面 i の最大の差（位置も返す）
+static int max_diff(const Planes &a, const Planes &b, int i, int *at_x, int *at_y)
+{
+    int m = 0;
+    for (int y = 0; y < a.ph(i); y++)
+        for (int x = 0; x < a.pw(i); x++) {
+            int d = abs(a.row(i, y)[x] - b.row(i, y)[x]);
+            if (d > m) { m = d; *at_x = x; *at_y = y; }
+        }
+    return m;
+}
+
+#ifdef HAVE_SWSCALE
+static bool convert_sws(const Packed &f, PackedOrder order, Planes &out)
+{
+    // SWS_AREA は 2:1 の色差を 2x2 の箱で平均する（こちらと同じ）
+    SwsContext *c = sws_getContext(f.w, f.h, order == PACKED_BGR ? AV_PIX_FMT_BGR24 : AV_PIX_FMT_RGB24,
+                                   f.w, f.h, AV_PIX_FMT_YUV420P,
+                                   SWS_AREA | SWS_ACCURATE_RND | SWS_BITEXACT, nullptr, nullptr, nullptr);
+    if (!c) return false;
+    // sws_scale は平面のポインタと stride を 4 つずつ読む
+    const uint8_t *src[4] = {f.px.data(), nullptr, nullptr, nullptr};
+    int src_stride[4] = {f.stride, 0, 0, 0};
+    uint8_t *dst[4] = {out.buf[0].data(), out.buf[1].data(), out.buf[2].data(), nullptr};
+    int dst_stride[4] = {out.stride[0], out.stride[1], out.stride[2], 0};
+    sws_scale(c, src, src_stride, 0, f.h, dst, dst_stride);
+    sws_freeContext(c);
+    return true;
+}
+#endif
+
+static const int widths[]  = {1, 2, 3, 5, 15, 16, 17, 31, 32, 33, 47, 48, 49, 63, 64, 65, 95, 97, 127, 129, 641};
+static const int heights[] = {1, 2, 3, 4, 7, 33};
+
+// SIMD 版がスカラー版と同じものを出し、余白を壊さない
+static void test_simd_matches_scalar(const char *impl)
+{
+    if (!yuv_convert_select(impl)) {
+        printf("%s: not supported by this CPU, skipped\n", impl);
+        return;
+    }
+    std::mt19937 rng(42);
+    int frames = 0;
+    for (int w : widths)
+        for (int h : heights)
+            for (int p = 0; p < P_COUNT; p++)
+                for (PackedOrder order : {PACKED_BGR, PACKED_RGB}) {
+                    Packed f(w, h);
+                    fill(f, (Pattern)p, rng);
+                    Planes want(w, h), got(w, h);
+                    yuv_convert_select("scalar");
+                    convert(f, order, want);
+                    yuv_convert_select(impl);
+                    convert(f, order, got);
+                    frames++;
+                    CHECK(guards_intact(got), "%s wrote past the row end (%dx%d %s)", impl, w, h, pattern_name[p]);
+                    for (int i = 0; i < 3; i++) {
+                        int x = 0, y = 0, d = max_diff(want, got, i, &x, &y);
+                        CHECK(d == 0, "%s differs from scalar by %d in plane %d at (%d,%d) (%dx%d %s %s)", impl, d, i,
+                              x, y, w, h, pattern_name[p], order == PACKED_BGR ? "BGR" : "RGB");
+                    }
+                }
+    printf("%s: bit-exact with scalar on %d frames\n", impl, frames);
+}
+
+// 端の値は式どおり（0 → Y 16 / U V 128、255 → Y 235 / U V 128）
+static void test_extremes()
+{
+    yuv_convert_select("scalar");
+    std::mt19937 rng(1);
+    struct { Pattern p; int y; } cases[] = {{P_ZERO, 16}, {P_FULL, 235}};
+    for (auto &c : cases) {
+        Packed f(17, 5);
+        fill(f, c.p, rng);
+        Planes o(17, 5);
+        convert(f, PACKED_BGR, o);
+        bool ok = true;
+        for (int i = 0; i < 3; i++)
+            for (int y = 0; y < o.ph(i); y++)
+                for (int x = 0; x < o.pw(i); x++) ok &= o.row(i, y)[x] == (i ? 128 : c.y);
+        CHECK(ok, "all-%s frame did not give Y %d / UV 128", pattern_name[c.p], c.y);
+    }
+}
+
+#ifdef HAVE_SWSCALE
+static void test_against_sws(const char *impl)
+{
+    if (!yuv_convert_select(impl)) return;
+    // 色差の取り方が swscale と同じになる大きさだけ（冒頭の説明）
+    static const int sw[] = {2, 4, 16, 18, 34, 64, 640, 1280}, sh[] = {4, 6, 18, 34, 360};
+    std::mt19937 rng(7);
+    int worst[3] = {};
+    for (int w : sw)
+        for (int h : sh)
+            for (int p = 0; p < P_COUNT; p++)
+                for (PackedOrder order : {PACKED_BGR, PACKED_RGB}) {
+                    Packed f(w, h);
+                    fill(f, (Pattern)p, rng);
+                    Planes ours(w, h), ref(w, h);
+                    convert(f, order, ours);
+                    if (!convert_sws(f, order, ref)) { CHECK(false, "sws_getContext failed for %dx%d", w, h); return; }
+                    for (int i = 0; i < 3; i++) {
+                        int x = 0, y = 0, d = max_diff(ours, ref, i, &x, &y);
+                        int tol = i ? YUV_TOL_C : YUV_TOL_Y;
+                        if (d > worst[i]) worst[i] = d;
+                        CHECK(d <= tol, "%s differs from sws_scale by %d (> %d) in plane %d at (%d,%d) (%dx%d %s %s)",
+                              impl, d, tol, i, x, y, w, h, pattern_name[p], order == PACKED_BGR ? "BGR" : "RGB");
+                    }
+                }
+    printf("%s vs sws_scale: max difference Y %d, U %d, V %d (tolerance %d / %d)\n", impl, worst[0], worst[1],
+           worst[2], YUV_TOL_Y, YUV_TOL_C);
+}
+#endif
+
+int main()
+{
+    const char *picked = yuv_convert_impl_name();
+    printf("runtime pick: %s\n", picked);
+    test_extremes();
+    test_simd_matches_scalar("sse4.1");
+    test_simd_matches_scalar("avx2");
+#ifdef HAVE_SWSCALE
+    for (const char *impl : {"scalar", "sse4.1", "avx2"}) test_against_sws(impl);
+#else
+    printf("sws_scale comparison skipped (built without libswscale)\n");
+#endif
+    yuv_convert_select(picked);
+    if (failures) {
+        fprintf(stderr, "yuv_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("yuv_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,157 @@
+// udp_batch.cpp
+// sendmmsg / recvmmsg と UDP GSO / GRO の実装
+#include "udp_batch.h"
+#include <netinet/udp.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#define GSO_MAX_SEGS   64       // カーネルの UDP_MAX_SEGMENTS（古い版の値）
+#define GSO_MAX_BYTES  65000    // 1 つの塊の上限（IP の 64KB からヘッダ分を引いておく）
+#define RX_SLOT        2048     // GRO なしの受信バッファ 1 つ（MTU より大きければよい）
+#define RX_SLOT_GRO    65536
+#define CTRL_SIZE      CMSG_SPACE(sizeof(int))
+#define RX_CTRL_SIZE   (CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(struct timespec)))   // GRO + 時刻
+
+// ── 送信 ────────────────────────────────────────
+
+UdpBatchSender::UdpBatchSender(int sock, int batch, bool gso)
+    : sock(sock), batch(std::max(1, batch)), use_gso(gso),
+      msgs(this->batch), iovs(this->batch * GSO_MAX_SEGS), first(this->batch + 1),
+      ctrl(this->batch * CTRL_SIZE)
+{
+}
+
+int UdpBatchSender::send(const UdpDatagram *d, int n)
+{
+    int i = 0, sent = 0;
+    while (i < n) {
+        // 1 回の sendmmsg に入れるメッセージを作る
+        int m = 0, k = 0;
+        while (m < batch && i < n) {
+            int seg = d[i].len, cnt = 1;
+            // 同じ大きさが続き、最後だけ短くてもよい塊を GSO で 1 メッセージに
+            while (use_gso && i + cnt < n && cnt < GSO_MAX_SEGS &&
+                   d[i + cnt - 1].len == seg && d[i + cnt].len <= seg &&
+                   (cnt + 1) * seg <= GSO_MAX_BYTES)
+                cnt++;
+
+            struct msghdr &h = msgs[m].msg_hdr;
+            memset(&h, 0, sizeof(h));
+            for (int j = 0; j < cnt; j++) iovs[k + j] = {(void *)d[i + j].data, (size_t)d[i + j].len};
+            h.msg_iov    = &iovs[k];
+            h.msg_iovlen = cnt;
+            if (cnt > 1) {
+                char *c = &ctrl[m * CTRL_SIZE];
+                memset(c, 0, CTRL_SIZE);
+                h.msg_control    = c;
+                h.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                struct cmsghdr *cm = CMSG_FIRSTHDR(&h);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type  = UDP_SEGMENT;
+                cm->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+                uint16_t gso_size = seg;
+                memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+            }
+            first[m] = i;
+            k += cnt;
+            i += cnt;
+            m++;
+        }
+        first[m] = i;
+
+        int r = sendmmsg(sock, msgs.data(), m, 0);
+        if (r < 0) {
+            if (errno == EINTR) { i = first[0]; continue; }
+            if (use_gso && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP)) {
+                // 経路やカーネルが GSO を受け付けない: 以後は 1 データグラムずつ
+                fprintf(stderr, "udp: GSO unavailable (%s), sending datagrams one by one\n", strerror(errno));
+                use_gso = false;
+                i = first[0];
+                continue;
+            }
+            return sent;   // 相手がいない (ECONNREFUSED) など: この分は捨てる
+        }
+        st.syscalls++;
+        for (int j = 0; j < r; j++) {
+            int cnt = first[j + 1] - first[j];
+            st.datagrams += cnt;
+            if (cnt > 1) st.gso++;
+            sent += cnt;
+        }
+        i = first[r];   // 途中で止まったら残りから
+    }
+    return sent;
+}
+
+// ── 受信 ────────────────────────────────────────
+
+UdpBatchReceiver::UdpBatchReceiver(int sock, int batch, bool gro)
+    : sock(sock), batch(std::max(1, batch)), use_gro(false)
+{
+    int one = 1;
+    if (gro && setsockopt(sock, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0) use_gro = true;
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));   // 使えなければ時刻なし
+    slot_size = use_gro ? RX_SLOT_GRO : RX_SLOT;
+    bufs.resize((size_t)this->batch * slot_size);
+    msgs.resize(this->batch);
+    iovs.resize(this->batch);
+    names.resize(this->batch);
+    ctrl.resize(this->batch * RX_CTRL_SIZE);
+    out.reserve(use_gro ? this->batch * GSO_MAX_SEGS : this->batch);
+    out_us.reserve(out.capacity());
+}
+
+int UdpBatchReceiver::receive(struct sockaddr_in *from)
+{
+    for (int m = 0; m < batch; m++) {
+        iovs[m] = {&bufs[(size_t)m * slot_size], (size_t)slot_size};
+        struct msghdr &h = msgs[m].msg_hdr;
+        memset(&h, 0, sizeof(h));
+        h.msg_name       = &names[m];
+        h.msg_namelen    = sizeof(names[m]);
+        h.msg_iov        = &iovs[m];
+        h.msg_iovlen     = 1;
+        h.msg_control    = &ctrl[m * RX_CTRL_SIZE];
+        h.msg_controllen = RX_CTRL_SIZE;
+    }
+    // 1 つ届いたら、その時点で溜まっている分だけ持って帰る
+    int r = recvmmsg(sock, msgs.data(), batch, MSG_WAITFORONE, nullptr);
+    if (r < 0) return -1;
+    st.syscalls++;
+
+    struct timespec now;   // 時刻が付いていなければ受け取った時刻で代える（同じ時計）
+    clock_gettime(CLOCK_REALTIME, &now);
+    out.clear();
+    out_us.clear();
+    for (int m = 0; m < r; m++) {
+        const struct msghdr &h = msgs[m].msg_hdr;
+        if (h.msg_flags & MSG_TRUNC) continue;
+        int len = msgs[m].msg_len, seg = len;
+        int64_t us = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&h); cm; cm = CMSG_NXTHDR((struct msghdr *)&h, cm)) {
+            if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) memcpy(&seg, CMSG_DATA(cm), sizeof(int));
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+                us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+            }
+        }
+        if (seg <= 0) seg = len;
+        if (seg < len) st.gso++;
+        const uint8_t *p = (const uint8_t *)iovs[m].iov_base;
+        for (int off = 0; off < len; off += seg) {
+            out.push_back({p + off, std::min(seg, len - off)});
+            out_us.push_back(us);
+        }
+    }
+    if (from && r > 0) *from = names[0];
+    st.datagrams += out.size();
+    return (int)out.size();
+}
@@ -0,0 +1,83 @@
+// udp_batch.h
+// UDP のまとめ送り / まとめ受け
+//   送信: sendmmsg で複数のデータグラムを 1 回のシステムコールで送る。同じ大きさが続くところ
+//         （FU-A に分けたキーフレーム）は UDP_SEGMENT (GSO) で 1 つの塊として渡し、
+//         MTU ごとに切るのはカーネル（か NIC）に任せる
+//   受信: recvmmsg で届いている分をまとめて受け取る。UDP_GRO が使えればカーネルがつないだ塊を
+//         gso_size ごとに切り分けて返す
+//         SO_TIMESTAMPNS でカーネルが受け取った時刻も返す（帯域推定の到着時刻に使う）
+//   GSO / GRO が使えないカーネルや経路ではデータグラムごとに戻る。batch = 1 で従来の 1 つずつ
+#ifndef UDP_BATCH_H
+#define UDP_BATCH_H
+
+#include <stdint.h>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define UDP_BATCH_DEFAULT 32
+
+struct UdpDatagram {
+    const uint8_t *data;
+    int            len;
+};
+
+// データグラム数 ÷ システムコール数 が 1 回あたりの数
+struct UdpBatchStats {
+    uint64_t syscalls  = 0;
+    uint64_t datagrams = 0;
+    uint64_t gso       = 0;   // 送信: GSO でまとめた塊 / 受信: GRO でつながっていた塊
+};
+
+class UdpBatchSender {
+public:
+    UdpBatchSender(int sock, int batch = UDP_BATCH_DEFAULT, bool gso = true);
+
+    // n 個を順に送る。送れなかった分は捨てる（UDP なので）。送れたデータグラム数を返す
+    int send(const UdpDatagram *d, int n);
+
+    const UdpBatchStats &stats() const { return st; }
+    bool gso() const { return use_gso; }
+
+private:
+    int  sock;
+    int  batch;
+    bool use_gso;
+    std::vector<struct mmsghdr> msgs;
+    std::vector<struct iovec>   iovs;
+    std::vector<int>            first;   // メッセージごとの先頭データグラム
+    std::vector<char>           ctrl;
+    UdpBatchStats st;
+};
+
+class UdpBatchReceiver {
+public:
+    UdpBatchReceiver(int sock, int batch = UDP_BATCH_DEFAULT, bool gro = true);
+
+    // 届いている分をまとめて受け取り、データグラム数を返す（最初の 1 つは SO_RCVTIMEO まで待つ）。
+    // 失敗は -1 (errno)。from には最初のデータグラムの送り元。at() は次の receive() まで有効
+    int receive(struct sockaddr_in *from);
+    const UdpDatagram &at(int i) const { return out[i]; }
+    // カーネルが受け取った時刻 (CLOCK_REALTIME, µs)。取れなければ recvmmsg から戻った時刻。
+    // GRO でつながっていた分は同じ時刻
+    int64_t arrival_us(int i) const { return out_us[i]; }
+
+    const UdpBatchStats &stats() const { return st; }
+    bool gro() const { return use_gro; }
+
+private:
+    int  sock;
+    int  batch;
+    bool use_gro;
+    int  slot_size;
+    std::vector<uint8_t>            bufs;
+    std::vector<struct mmsghdr>     msgs;
+    std::vector<struct iovec>       iovs;
+    std::vector<struct sockaddr_in> names;
+    std::vector<char>               ctrl;
+    std::vector<UdpDatagram>        out;
+    std::vector<int64_t>            out_us;
+    UdpBatchStats st;
+};
+
+#endif
@@ -0,0 +1,169 @@
+// video_view.cpp
+// GtkDrawingArea + cairo による映像表示
+#include "video_view.h"
+#include "frame_pool.h"
+#include "frame_mailbox.h"
+
+#define SURFACE_CACHE 8        // プールのバッファ数より多めに
+#define SELF_VIEW_FRAC 0.25    // 自分の映像はウィジェット幅の 1/4
+
+static void drop_frame(ImageFrame *f) { image_frame_unref(f); }
+
+// バッファ (data ポインタ) ごとに作り置きした cairo surface
+struct SurfaceSlot {
+    const unsigned char *data;
+    cairo_surface_t     *surface;
+};
+
+struct VideoView {
+    FrameMailbox<ImageFrame> peer_mb{drop_frame};
+    FrameMailbox<ImageFrame> self_mb{drop_frame};
+    ImageFrame *peer = nullptr;     // 表示中のフレーム（参照を保持）
+    ImageFrame *self = nullptr;
+    SurfaceSlot cache[SURFACE_CACHE] = {};
+    int         cache_next = 0;
+};
+
+static VideoView *view_of(GtkWidget *w)
+{
+    return (VideoView *)g_object_get_data(G_OBJECT(w), "video-view");
+}
+
+// ImageFrame の画素をそのまま参照する surface を返す（初回だけ作る）
+static cairo_surface_t *surface_for(VideoView *v, ImageFrame *f)
+{
+    for (int i = 0; i < SURFACE_CACHE; i++) {
+        SurfaceSlot &s = v->cache[i];
+        if (s.data == f->data &&
+            cairo_image_surface_get_width(s.surface) == f->width &&
+            cairo_image_surface_get_height(s.surface) == f->height) {
+            cairo_surface_mark_dirty(s.surface);   // 中身はデコーダが書き換えている
+            return s.surface;
+        }
+    }
+    SurfaceSlot &s = v->cache[v->cache_next];
+    v->cache_next = (v->cache_next + 1) % SURFACE_CACHE;
+    if (s.surface) cairo_surface_destroy(s.surface);
+    s.data    = f->data;
+    s.surface = cairo_image_surface_create_for_data(f->data, CAIRO_FORMAT_RGB24,
+                                                    f->width, f->height, f->stride);
+    return s.surface;
+}
+
+static void drop_cache(VideoView *v)
+{
+    for (int i = 0; i < SURFACE_CACHE; i++) {
+        if (v->cache[i].surface) cairo_surface_destroy(v->cache[i].surface);
+        v->cache[i].surface = nullptr;
+        v->cache[i].data    = nullptr;
+    }
+}
+
+// (x, y, w, h) にアスペクト比を保って収める
+static void paint_frame(cairo_t *cr, VideoView *v, ImageFrame *f,
+                        double x, double y, double w, double h)
+{
+    double s  = MIN(w / f->width, h / f->height);
+    double dw = f->width * s, dh = f->height * s;
+    cairo_save(cr);
+    cairo_translate(cr, x + (w - dw) / 2, y + (h - dh) / 2);
+    cairo_scale(cr, s, s);
+    cairo_set_source_surface(cr, surface_for(v, f), 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_FAST);
+    cairo_paint(cr);
+    cairo_restore(cr);
+}
+
+static gboolean on_draw(GtkWidget *w, cairo_t *cr, gpointer)
+{
+    VideoView *v = view_of(w);
+    double aw = gtk_widget_get_allocated_width(w);
+    double ah = gtk_widget_get_allocated_height(w);
+
+    cairo_set_source_rgb(cr, 0, 0, 0);
+    cairo_paint(cr);
+
+    if (v->peer) paint_frame(cr, v, v->peer, 0, 0, aw, ah);
+    if (v->self) {
+        double sw = aw * SELF_VIEW_FRAC;
+        double sh = sw * v->self->height / v->self->width;
+        paint_frame(cr, v, v->self, aw - sw - 8, ah - sh - 8, sw, sh);
+    }
+    return TRUE;
+}
+
+// ティックごとに最新フレームを取り込み、変化があれば再描画
+static gboolean on_tick(GtkWidget *w, GdkFrameClock *, gpointer)
+{
+    VideoView *v = view_of(w);
+    bool dirty = false;
+    if (ImageFrame *f = v->peer_mb.take()) {
+        if (v->peer) image_frame_unref(v->peer);
+        v->peer = f;
+        dirty = true;
+    }
+    if (ImageFrame *f = v->self_mb.take()) {
+        if (v->self) image_frame_unref(v->self);
+        v->self = f;
+        dirty = true;
+    }
+    if (dirty) gtk_widget_queue_draw(w);
+    return G_SOURCE_CONTINUE;
+}
+
+static void view_free(gpointer data)
+{
+    VideoView *v = (VideoView *)data;
+    v->peer_mb.clear();
+    v->self_mb.clear();
+    if (v->peer) image_frame_unref(v->peer);
+    if (v->self) image_frame_unref(v->self);
+    drop_cache(v);
+    delete v;
+}
+
+GtkWidget *video_view_new(int min_w, int min_h)
+{
+    GtkWidget *w = gtk_drawing_area_new();
+    gtk_widget_set_size_request(w, min_w, min_h);
+    gtk_widget_set_hexpand(w, TRUE);
+    gtk_widget_set_vexpand(w, TRUE);
+    g_object_set_data_full(G_OBJECT(w), "video-view", new VideoView(), view_free);
+    g_signal_connect(w, "draw", G_CALLBACK(on_draw), nullptr);
+    gtk_widget_add_tick_callback(w, on_tick, nullptr, nullptr);
+    return w;
+}
+
+void video_view_publish_peer(GtkWidget *view, ImageFrame *frame)
+{
+    view_of(view)->peer_mb.publish(frame);
+}
+
+void video_view_publish_self(GtkWidget *view, ImageFrame *frame)
+{
+    view_of(view)->self_mb.publish(frame);
+}
+
+void video_view_clear(GtkWidget *view)
+{
+    VideoView *v = view_of(view);
+    v->peer_mb.clear();
+    v->self_mb.clear();
+    if (v->peer) { image_frame_unref(v->peer); v->peer = nullptr; }
+    if (v->self) { image_frame_unref(v->self); v->self = nullptr; }
+    drop_cache(v);
+    gtk_widget_queue_draw(view);
+}
+
+void video_view_peer_stats(GtkWidget *view, uint64_t *published, uint64_t *shown, uint64_t *dropped)
+{
+    VideoView *v = view_of(view);
+    if (published) *published = v->peer_mb.published();
+    if (shown)     *shown     = v->peer_mb.shown();
+    if (dropped)   *dropped   = v->peer_mb.dropped();
+}
+
+void video_view_reset_stats(GtkWidget *view)
+{
+    view_of(view)->peer_mb.reset_stats();
+}
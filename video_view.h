@@ -0,0 +1,27 @@
+// video_view.h
+// 相手映像 + 自分の映像（右下に小さく）を描く GtkDrawingArea
+//   - フレームは BGRx (CAIRO_FORMAT_RGB24, channels = 4) の ImageFrame で受け取る
+//   - プールのバッファごとに cairo surface を作り置きし、画素はコピーしない
+//   - ウィンドウに合わせて拡大縮小（アスペクト比は保つ）
+//   - 受け取りは最新フレーム優先のメールボックス。描画はフレームクロックのティックで
+#ifndef VIDEO_VIEW_H
+#define VIDEO_VIEW_H
+
+#include <gtk/gtk.h>
+#include <stdint.h>
+#include "image_frame.h"
+
+GtkWidget *video_view_new(int min_w, int min_h);
+
+// どのスレッドからでも呼べる。frame の参照を 1 つ渡す（表示後・破棄時に unref される）
+void video_view_publish_peer(GtkWidget *view, ImageFrame *frame);
+void video_view_publish_self(GtkWidget *view, ImageFrame *frame);
+
+// GTK スレッド専用。表示中のフレームと surface をすべて手放す（プール破棄の前に呼ぶ）
+void video_view_clear(GtkWidget *view);
+
+// 相手映像の統計（受け取った数 / 表示した数 / 表示前に上書きされた数）
+void video_view_peer_stats(GtkWidget *view, uint64_t *published, uint64_t *shown, uint64_t *dropped);
+void video_view_reset_stats(GtkWidget *view);
+
+#endif
@@ -0,0 +1,272 @@
+// yuv_convert.cpp
+// packed BGR/RGB → YUV420P の融合カーネル
+//
+//   Y = ((66R + 129G + 25B + 128) >> 8) + 16
+//   U = ((-38R - 74G + 112B + 128) >> 8) + 128   (R,G,B は 2x2 の平均)
+//   V = ((112R - 94G - 18B + 128) >> 8) + 128
+//
+// 2 行ずつ処理し、Y 2 行と U/V 1 行を同時に書く（入力を 1 回だけ読む）。
+#include "yuv_convert.h"
+#include <immintrin.h>
+#include <string.h>
+
+// 2 行分 (s0, s1) を変換する。y1 == nullptr なら最終行（奇数高さ）
+typedef void (*RowsFn)(const uint8_t *s0, const uint8_t *s1,
+                       uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                       int width, int ri, int bi);
+
+static inline uint8_t luma(int r, int g, int b) {
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+// ──────────────────────────────────────────────────
+//   スカラー版（SIMD 版の端数処理にも使う）
+// ──────────────────────────────────────────────────
+static void rows_scalar_from(int x0, const uint8_t *s0, const uint8_t *s1,
+                             uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                             int width, int ri, int bi) {
+    for (int x = x0; x < width; x += 2) {
+        int x1 = (x + 1 < width) ? x + 1 : x;   // 奇数幅は右端を複製
+        const uint8_t *a = s0 + 3 * x, *b = s0 + 3 * x1;
+        const uint8_t *c = s1 + 3 * x, *d = s1 + 3 * x1;
+
+        y0[x] = luma(a[ri], a[1], a[bi]);
+        if (x1 != x) y0[x1] = luma(b[ri], b[1], b[bi]);
+        if (y1) {
+            y1[x] = luma(c[ri], c[1], c[bi]);
+            if (x1 != x) y1[x1] = luma(d[ri], d[1], d[bi]);
+        }
+
+        int r = (a[ri] + b[ri] + c[ri] + d[ri] + 2) >> 2;
+        int g = (a[1]  + b[1]  + c[1]  + d[1]  + 2) >> 2;
+        int bl = (a[bi] + b[bi] + c[bi] + d[bi] + 2) >> 2;
+        u[x / 2] = (uint8_t)(((-38 * r - 74 * g + 112 * bl + 128) >> 8) + 128);
+        v[x / 2] = (uint8_t)(((112 * r - 94 * g - 18 * bl + 128) >> 8) + 128);
+    }
+}
+
+static void rows_scalar(const uint8_t *s0, const uint8_t *s1,
+                        uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                        int width, int ri, int bi) {
+    rows_scalar_from(0, s0, s1, y0, y1, u, v, width, ri, bi);
+}
+
+// ──────────────────────────────────────────────────
+//   SIMD 共通部品
+// ──────────────────────────────────────────────────
+// 48 バイト (16 画素) を 3 チャンネルの 16 バイトに分解する
+__attribute__((target("sse4.1")))
+static inline void deinterleave3(const uint8_t *p, __m128i &c0, __m128i &c1, __m128i &c2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+    c0 = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    c1 = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    c2 = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+// 16bit の x,y,z (8 画素) から (cx*x + cy*y + cz*z + 128) >> 8 + off を 16bit で返す
+__attribute__((target("sse4.1")))
+static inline __m128i dot3_128(__m128i x, __m128i y, __m128i z,
+                               short cx, short cy, short cz, int off) {
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i kxy = _mm_setr_epi16(cx, cy, cx, cy, cx, cy, cx, cy);
+    const __m128i kz  = _mm_setr_epi16(cz, 128, cz, 128, cz, 128, cz, 128);
+    __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x, y), kxy),
+                               _mm_madd_epi16(_mm_unpacklo_epi16(z, one), kz));
+    __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x, y), kxy),
+                               _mm_madd_epi16(_mm_unpackhi_epi16(z, one), kz));
+    lo = _mm_add_epi32(_mm_srai_epi32(lo, 8), _mm_set1_epi32(off));
+    hi = _mm_add_epi32(_mm_srai_epi32(hi, 8), _mm_set1_epi32(off));
+    return _mm_packs_epi32(lo, hi);
+}
+
+// 2x2 の和 (16bit, 8 個) から U/V 8 バイトを書く
+__attribute__((target("sse4.1")))
+static inline void store_chroma(__m128i rs, __m128i gs, __m128i bs, uint8_t *u, uint8_t *v) {
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i r = _mm_srli_epi16(_mm_add_epi16(rs, two), 2);
+    __m128i g = _mm_srli_epi16(_mm_add_epi16(gs, two), 2);
+    __m128i b = _mm_srli_epi16(_mm_add_epi16(bs, two), 2);
+    __m128i uu = dot3_128(r, g, b, -38, -74, 112, 128);
+    __m128i vv = dot3_128(r, g, b, 112, -94, -18, 128);
+    _mm_storel_epi64((__m128i *)u, _mm_packus_epi16(uu, uu));
+    _mm_storel_epi64((__m128i *)v, _mm_packus_epi16(vv, vv));
+}
+
+// ──────────────────────────────────────────────────
+//   SSE4.1 版（16 画素 / ループ）
+// ──────────────────────────────────────────────────
+__attribute__((target("sse4.1")))
+static void rows_sse41(const uint8_t *s0, const uint8_t *s1,
+                       uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                       int width, int ri, int bi) {
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i c[2][3];
+        deinterleave3(s0 + 3 * x, c[0][0], c[0][1], c[0][2]);
+        deinterleave3(s1 + 3 * x, c[1][0], c[1][1], c[1][2]);
+
+        // [行][lo/hi] の 16bit 値
+        __m128i R[2][2], G[2][2], B[2][2];
+        for (int k = 0; k < 2; k++) {
+            __m128i r8 = c[k][ri], g8 = c[k][1], b8 = c[k][bi];
+            R[k][0] = _mm_unpacklo_epi8(r8, zero); R[k][1] = _mm_unpackhi_epi8(r8, zero);
+            G[k][0] = _mm_unpacklo_epi8(g8, zero); G[k][1] = _mm_unpackhi_epi8(g8, zero);
+            B[k][0] = _mm_unpacklo_epi8(b8, zero); B[k][1] = _mm_unpackhi_epi8(b8, zero);
+        }
+
+        for (int k = 0; k < 2; k++) {
+            uint8_t *yd = k ? y1 : y0;
+            if (!yd) continue;
+            __m128i lo = dot3_128(R[k][0], G[k][0], B[k][0], 66, 129, 25, 16);
+            __m128i hi = dot3_128(R[k][1], G[k][1], B[k][1], 66, 129, 25, 16);
+            _mm_storeu_si128((__m128i *)(yd + x), _mm_packus_epi16(lo, hi));
+        }
+
+        // 縦に足してから隣同士を足す → 2x2 の和
+        __m128i rs = _mm_hadd_epi16(_mm_add_epi16(R[0][0], R[1][0]), _mm_add_epi16(R[0][1], R[1][1]));
+        __m128i gs = _mm_hadd_epi16(_mm_add_epi16(G[0][0], G[1][0]), _mm_add_epi16(G[0][1], G[1][1]));
+        __m128i bs = _mm_hadd_epi16(_mm_add_epi16(B[0][0], B[1][0]), _mm_add_epi16(B[0][1], B[1][1]));
+        store_chroma(rs, gs, bs, u + x / 2, v + x / 2);
+    }
+    rows_scalar_from(x, s0, s1, y0, y1, u, v, width, ri, bi);
+}
+
+// ──────────────────────────────────────────────────
+//   AVX2 版（16 画素 / ループ、演算を 256bit で 1 回に）
+// ──────────────────────────────────────────────────
+__attribute__((target("avx2")))
+static inline __m256i dot3_256(__m256i x, __m256i y, __m256i z,
+                               short cx, short cy, short cz, int off) {
+    const __m256i one = _mm256_set1_epi16(1);
+    const __m256i kxy = _mm256_setr_epi16(cx, cy, cx, cy, cx, cy, cx, cy,
+                                          cx, cy, cx, cy, cx, cy, cx, cy);
+    const __m256i kz  = _mm256_setr_epi16(cz, 128, cz, 128, cz, 128, cz, 128,
+                                          cz, 128, cz, 128, cz, 128, cz, 128);
+    // unpack / pack はどちらもレーン内なので、画素順はそのまま戻る
+    __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(x, y), kxy),
+                                  _mm256_madd_epi16(_mm256_unpacklo_epi16(z, one), kz));
+    __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(x, y), kxy),
+                                  _mm256_madd_epi16(_mm256_unpackhi_epi16(z, one), kz));
+    lo = _mm256_add_epi32(_mm256_srai_epi32(lo, 8), _mm256_set1_epi32(off));
+    hi = _mm256_add_epi32(_mm256_srai_epi32(hi, 8), _mm256_set1_epi32(off));
+    return _mm256_packs_epi32(lo, hi);
+}
+
+__attribute__((target("avx2")))
+static inline __m128i pair_sums(__m256i top, __m256i bottom) {
+    __m256i s = _mm256_add_epi16(top, bottom);
+    s = _mm256_hadd_epi16(s, s);   // レーンごとに 4 個ずつ
+    return _mm256_castsi256_si128(_mm256_permute4x64_epi64(s, 0x08));
+}
+
+__attribute__((target("avx2")))
+static void rows_avx2(const uint8_t *s0, const uint8_t *s1,
+                      uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                      int width, int ri, int bi) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i c[2][3];
+        deinterleave3(s0 + 3 * x, c[0][0], c[0][1], c[0][2]);
+        deinterleave3(s1 + 3 * x, c[1][0], c[1][1], c[1][2]);
+
+        __m256i R[2], G[2], B[2];
+        for (int k = 0; k < 2; k++) {
+            R[k] = _mm256_cvtepu8_epi16(c[k][ri]);
+            G[k] = _mm256_cvtepu8_epi16(c[k][1]);
+            B[k] = _mm256_cvtepu8_epi16(c[k][bi]);
+        }
+
+        for (int k = 0; k < 2; k++) {
+            uint8_t *yd = k ? y1 : y0;
+            if (!yd) continue;
+            __m256i yy = dot3_256(R[k], G[k], B[k], 66, 129, 25, 16);
+            _mm_storeu_si128((__m128i *)(yd + x),
+                             _mm_packus_epi16(_mm256_castsi256_si128(yy),
+                                              _mm256_extracti128_si256(yy, 1)));
+        }
+
+        store_chroma(pair_sums(R[0], R[1]), pair_sums(G[0], G[1]), pair_sums(B[0], B[1]),
+                     u + x / 2, v + x / 2);
+    }
+    rows_scalar_from(x, s0, s1, y0, y1, u, v, width, ri, bi);
+}
+
+// ──────────────────────────────────────────────────
+//   実行時ディスパッチ
+// ──────────────────────────────────────────────────
+static RowsFn pick_impl(const char **name) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))   { *name = "avx2";   return rows_avx2; }
+    if (__builtin_cpu_supports("sse4.1")) { *name = "sse4.1"; return rows_sse41; }
+    *name = "scalar";
+    return rows_scalar;
+}
+
+static const char *impl_name = nullptr;
+static RowsFn rows_fn = pick_impl(&impl_name);
+
+const char *yuv_convert_impl_name() { return impl_name; }
+
+bool yuv_convert_select(const char *name) {
+    if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))     { impl_name = "avx2";   rows_fn = rows_avx2;   return true; }
+    if (!strcmp(name, "sse4.1") && __builtin_cpu_supports("sse4.1")) { impl_name = "sse4.1"; rows_fn = rows_sse41; return true; }
+    if (!strcmp(name, "scalar"))                                     { impl_name = "scalar"; rows_fn = rows_scalar; return true; }
+    return false;
+}
+
+void packed_to_yuv420p(const uint8_t *src, int src_stride, int width, int height,
+                       PackedOrder order, uint8_t *const dst[3], const int dst_stride[3]) {
+    int ri = (order == PACKED_RGB) ? 0 : 2;
+    int bi = 2 - ri;
+    for (int y = 0; y < height; y += 2) {
+        const uint8_t *s0 = src + (size_t)y * src_stride;
+        bool last = (y + 1 >= height);   // 奇数高さは最終行を複製
+        const uint8_t *s1 = last ? s0 : s0 + src_stride;
+        rows_fn(s0, s1,
+                dst[0] + (size_t)y * dst_stride[0],
+                last ? nullptr : dst[0] + (size_t)(y + 1) * dst_stride[0],
+                dst[1] + (size_t)(y / 2) * dst_stride[1],
+                dst[2] + (size_t)(y / 2) * dst_stride[2],
+                width, ri, bi);
+    }
+}
+
+// ──────────────────────────────────────────────────
+//   YUYV → YUV420P（メモリ帯域律速なのでスカラーで十分）
+// ──────────────────────────────────────────────────
+void yuyv_to_yuv420p(const uint8_t *src, int src_stride, int width, int height,
+                     uint8_t *const dst[3], const int dst_stride[3]) {
+    int cw = width / 2;   // YUYV は 2 画素で U/V が 1 組
+    for (int y = 0; y < height; y += 2) {
+        const uint8_t *s0 = src + (size_t)y * src_stride;
+        const uint8_t *s1 = (y + 1 < height) ? s0 + src_stride : s0;
+        uint8_t *y0 = dst[0] + (size_t)y * dst_stride[0];
+        uint8_t *y1 = dst[0] + (size_t)(y + 1) * dst_stride[0];
+        uint8_t *u  = dst[1] + (size_t)(y / 2) * dst_stride[1];
+        uint8_t *v  = dst[2] + (size_t)(y / 2) * dst_stride[2];
+        for (int x = 0; x < cw; x++) {
+            y0[2 * x]     = s0[4 * x];
+            y0[2 * x + 1] = s0[4 * x + 2];
+            u[x] = (uint8_t)((s0[4 * x + 1] + s1[4 * x + 1] + 1) >> 1);
+            v[x] = (uint8_t)((s0[4 * x + 3] + s1[4 * x + 3] + 1) >> 1);
+        }
+        if (y + 1 < height) {
+            for (int x = 0; x < cw; x++) {
+                y1[2 * x]     = s1[4 * x];
+                y1[2 * x + 1] = s1[4 * x + 2];
+            }
+        }
+    }
+}
@@ -0,0 +1,35 @@
+// yuv_convert.h
+// エンコーダ入力 (YUV420P) への変換
+//   packed BGR/RGB → YUV420P（色変換と 2x2 クロマ平均を 1 パスで行う）
+//   AVX2 / SSE4.1 / スカラーを CPU に合わせて実行時に選ぶ。
+//   どの実装も同じ整数演算なので結果はビット単位で一致する。
+//   カメラの YUYV → YUV420P（色変換なしの詰め替えのみ）
+#ifndef YUV_CONVERT_H
+#define YUV_CONVERT_H
+
+#include <stdint.h>
+
+// 入力の色の並び
+enum PackedOrder {
+    PACKED_BGR,   // OpenCV の cv::Mat
+    PACKED_RGB,
+};
+
+// src (width × height, 3 バイト/画素) を dst[0..2] (Y, U, V 平面) に書き込む。
+// BT.601 limited range。縮小・拡大はしない（サイズが違うときは sws_scale を使う）
+void packed_to_yuv420p(const uint8_t *src, int src_stride, int width, int height,
+                       PackedOrder order, uint8_t *const dst[3], const int dst_stride[3]);
+
+// カメラの YUYV (4:2:2 packed) → YUV420P への詰め替え。
+// 色変換はなく、Y はそのままコピー、U/V は縦 2 行を平均するだけ
+void yuyv_to_yuv420p(const uint8_t *src, int src_stride, int width, int height,
+                     uint8_t *const dst[3], const int dst_stride[3]);
+
+// 選ばれた実装名 ("avx2" / "sse4.1" / "scalar")
+const char *yuv_convert_impl_name();
+
+// 実装を名前で選び直す（テストで各実装を比べる用）。CPU が対応していない / 知らない名前なら false
+// 変換中に呼ばないこと
+bool yuv_convert_select(const char *name);
+
+#endif